@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+#
+# Generates a firmware delta applied by iop_hal::DeltaApplier (src/cpp17/delta.hpp)
+#
+# Usage: mkDelta.py <current firmware> <new firmware> <output>
+#
+# Servers may send it instead of the full image, with Content-Type application/x-iop-delta,
+# when the VERSION header sent by the device matches the current firmware's MD5
+
+import hashlib
+import struct
+import sys
+
+BLOCK = 16
+MIN_MATCH = 32
+# ADD regions are extended while at least half of the bytes in this window match
+WINDOW = 32
+
+END, COPY, ADD, INSERT = 0, 1, 2, 3
+
+
+def index(source):
+    blocks = {}
+    for offset in range(0, len(source) - BLOCK + 1, BLOCK):
+        blocks.setdefault(source[offset:offset + BLOCK], offset)
+    return blocks
+
+
+def match(source, target, sourceOffset, targetOffset):
+    length = 0
+    while sourceOffset + length < len(source) and targetOffset + length < len(target) \
+            and source[sourceOffset + length] == target[targetOffset + length]:
+        length += 1
+    return length
+
+
+def similar(source, target, sourceOffset, targetOffset):
+    window = min(WINDOW, len(source) - sourceOffset, len(target) - targetOffset)
+    if window < WINDOW:
+        return False
+    equal = sum(1 for i in range(window) if source[sourceOffset + i] == target[targetOffset + i])
+    return equal * 2 >= window
+
+
+def diff(source, target):
+    blocks = index(source)
+    operations = []
+    literal = bytearray()
+    offset = 0
+
+    def flush():
+        if literal:
+            operations.append(struct.pack("<BI", INSERT, len(literal)) + bytes(literal))
+            literal.clear()
+
+    while offset < len(target):
+        candidate = blocks.get(target[offset:offset + BLOCK])
+        length = match(source, target, candidate, offset) if candidate is not None else 0
+        if length < MIN_MATCH:
+            literal.append(target[offset])
+            offset += 1
+            continue
+
+        flush()
+        operations.append(struct.pack("<BII", COPY, candidate, length))
+        sourceOffset, offset = candidate + length, offset + length
+
+        # Code shifted by a few bytes still mostly matches, bsdiff style diff blocks encode it compactly
+        start = offset
+        while similar(source, target, sourceOffset + offset - start, offset) \
+                and match(source, target, sourceOffset + offset - start, offset) < MIN_MATCH:
+            offset += WINDOW
+        if offset > start:
+            data = bytes((target[start + i] - source[sourceOffset + i]) & 0xFF for i in range(offset - start))
+            operations.append(struct.pack("<BII", ADD, sourceOffset, len(data)) + data)
+
+    flush()
+    operations.append(struct.pack("<B", END))
+    return operations
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit("Usage: mkDelta.py <current firmware> <new firmware> <output>")
+
+    source = open(sys.argv[1], "rb").read()
+    target = open(sys.argv[2], "rb").read()
+
+    header = b"IOPDELTA" + bytes([1])
+    header += hashlib.md5(source).hexdigest().upper().encode()
+    header += hashlib.md5(target).hexdigest().upper().encode()
+    header += struct.pack("<I", len(target))
+
+    with open(sys.argv[3], "wb") as output:
+        output.write(header)
+        for operation in diff(source, target):
+            output.write(operation)
+
+
+if __name__ == "__main__":
+    main()
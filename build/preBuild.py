@@ -12,4 +12,8 @@ preBuildCertificates(env)
 
 from preBuildOpenSSLCertificates import preBuildCertificates
 
-preBuildCertificates(env)
\ No newline at end of file
+preBuildCertificates(env)
+
+from preBuildAssets import preBuildAssets
+
+preBuildAssets(env)
\ No newline at end of file
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+
+from os import path, walk, makedirs
+import inspect
+import gzip
+import hashlib
+import mimetypes
+import re
+import sys
+
+# Bakes the project's static assets (the `assets` directory, or `custom_iop_assets` in platformio.ini) gzipped into
+# the source code, so the device serves them from flash without compressing anything at runtime.
+#
+# The header only declares them, they are defined once in `src/generated/assets.cpp`, so every translation unit
+# including it shares the same copy in flash.
+#
+# Use them with `#include <iop-hal/generated/assets.hpp>`:
+#   for (const auto &asset : generated::assets)
+#     server.on(asset.path, [&asset](iop_hal::HttpConnection &conn, iop::Log const &) { conn.sendAsset(asset); });
+
+def cString(string):
+    return "\"" + string.replace("\\", "\\\\").replace("\"", "\\\"") + "\""
+
+def romString(name, string):
+    # StaticStrings are read with 32 bits alignment on the ESP8266
+    return "static const char " + name + "[] __attribute__((aligned(4))) IOP_ROM = " + cString(string) + ";\n"
+
+def staticString(name):
+    return "iop::StaticString(reinterpret_cast<const __FlashStringHelper *>(" + name + "))"
+
+def preBuildAssets(env, source = None):
+    dir_path = path.dirname(path.abspath(inspect.getframeinfo(inspect.currentframe()).filename))
+    destination = path.join(dir_path, "../include/iop-hal/generated/assets.hpp")
+    definitions = path.join(dir_path, "../src/generated/assets.cpp")
+
+    if source is None and env is not None:
+        source = path.join(env.subst("$PROJECT_DIR"), env.GetProjectOption("custom_iop_assets", "assets"))
+    elif source is None:
+        source = "assets"
+
+    files = []
+    if path.isdir(source):
+        for root, dirs, names in walk(source):
+            dirs.sort()
+            for name in sorted(names):
+                if not name.startswith("."):
+                    files.append(path.join(root, name))
+
+    # Gzip output depends on the timestamp, it's fixed so unchanged assets generate the same header
+    assets = []
+    hasher = hashlib.sha256()
+    for file in files:
+        with open(file, "rb") as f:
+            content = f.read()
+        route = "/" + path.relpath(file, source).replace(path.sep, "/")
+        compressed = gzip.compress(content, compresslevel = 9, mtime = 0)
+        etag = "\"" + hashlib.sha256(compressed).hexdigest()[:16] + "\""
+        contentType = mimetypes.guess_type(file)[0] or "application/octet-stream"
+        assets.append((route, content, compressed, etag, contentType))
+        hasher.update(route.encode("utf-8"))
+        hasher.update(compressed)
+    sourceHash = hasher.hexdigest()
+
+    def upToDate(file):
+        try:
+            with open(file, "r") as generated:
+                for line in filter(lambda x: "SHA256: " in x, generated.read().split("\n")):
+                    return line.split("SHA256: ")[1] == sourceHash
+        except FileNotFoundError:
+            pass
+        return False
+
+    if upToDate(destination) and upToDate(definitions):
+        print("Assets already are up-to-date")
+        return
+
+    print("Generating " + destination)
+    makedirs(path.dirname(destination), exist_ok = True)
+    makedirs(path.dirname(definitions), exist_ok = True)
+
+    f = open(definitions, "w", encoding="utf8")
+    f.write("#include \"iop-hal/generated/assets.hpp\"\n\n")
+    f.write("namespace generated {\n")
+    f.write("// This file is computer generated at build time (`build/preBuildAssets.py` called by PlatformIO)\n\n")
+    f.write("// SHA256: " + sourceHash + "\n\n")
+
+    entries = []
+    for idx, (route, content, compressed, etag, contentType) in enumerate(assets):
+        name = "asset_" + str(idx)
+        f.write("// " + re.sub(r"[^ -~]", "", route) + ": " + str(len(content)) + " bytes, " + str(len(compressed)) + " gzipped\n")
+        f.write("static const uint8_t " + name + "[] IOP_ROM = {")
+        f.write(", ".join(hex(byte) for byte in compressed))
+        f.write("};\n")
+        f.write(romString(name + "_type", contentType))
+        f.write(romString(name + "_etag", etag))
+
+        # Directories are served by their index page too
+        routes = [route]
+        if route.endswith("/index.html"):
+            routes.append(route[:-len("index.html")])
+        for index, alias in enumerate(routes):
+            f.write(romString(name + "_path_" + str(index), alias))
+            entries.append("  iop_hal::StaticAsset { " + ", ".join([
+                staticString(name + "_path_" + str(index)),
+                name,
+                "sizeof(" + name + ")",
+                staticString(name + "_type"),
+                staticString(name + "_etag"),
+            ]) + " },\n")
+        f.write("\n")
+
+    f.write("const std::array<iop_hal::StaticAsset, " + str(len(entries)) + "> assets = {{\n")
+    for entry in entries:
+        f.write(entry)
+    f.write("}};\n")
+    f.write("} // namespace generated\n")
+    f.close()
+
+    f = open(destination, "w", encoding="utf8")
+    f.write("#ifndef IOP_GENERATED_ASSETS_HPP\n")
+    f.write("#define IOP_GENERATED_ASSETS_HPP\n\n")
+    f.write("#include \"iop-hal/server.hpp\"\n")
+    f.write("#include <array>\n\n")
+    f.write("namespace generated {\n")
+    f.write("// This file is computer generated at build time (`build/preBuildAssets.py` called by PlatformIO)\n\n")
+    f.write("// SHA256: " + sourceHash + "\n\n")
+    f.write("extern const std::array<iop_hal::StaticAsset, " + str(len(entries)) + "> assets;\n")
+    f.write("} // namespace generated\n")
+    f.write("\n#endif\n")
+    f.close()
+
+if __name__ == "__main__":
+    preBuildAssets(None, sys.argv[1] if len(sys.argv) > 1 else None)
@@ -0,0 +1,92 @@
+// MD5 throughput on firmware sized images, with the portable kernel of `src/cpp17/md5.hpp` and with OpenSSL's EVP,
+// that `src/cpp17/md5.hpp` wraps when `HAVE_OPENSSL` is defined. Images are hashed in the pieces downloads arrive in.
+//
+//   g++ -std=c++17 -O2 -Iinclude -Isrc examples/bench_md5.cpp -o bench_md5 -lcrypto
+//   ./bench_md5 [image MB...] [-c chunk size]
+
+// The portable kernel, OpenSSL's EVP is called directly so both can be compared in the same binary
+#include "cpp17/md5.hpp"
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using Digest = std::array<unsigned char, 16>;
+
+static auto portable(const std::vector<unsigned char> &image, const size_t chunk) -> Digest {
+    MD5_CTX ctx;
+    MD5_Init(&ctx);
+    for (size_t offset = 0; offset < image.size(); offset += chunk) {
+        MD5_Update(&ctx, image.data() + offset, static_cast<unsigned long>(std::min(chunk, image.size() - offset)));
+    }
+    Digest digest;
+    MD5_Final(digest.data(), &ctx);
+    return digest;
+}
+
+static auto evp(const std::vector<unsigned char> &image, const size_t chunk) -> Digest {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (ctx == nullptr || EVP_DigestInit_ex(ctx, EVP_md5(), nullptr) != 1) abort();
+    for (size_t offset = 0; offset < image.size(); offset += chunk) {
+        if (EVP_DigestUpdate(ctx, image.data() + offset, std::min(chunk, image.size() - offset)) != 1) abort();
+    }
+    Digest digest;
+    if (EVP_DigestFinal_ex(ctx, digest.data(), nullptr) != 1) abort();
+    EVP_MD_CTX_free(ctx);
+    return digest;
+}
+
+/// Best of a few runs, in MB/s
+template <typename Hash>
+static auto throughput(const Hash &hash, const std::vector<unsigned char> &image, const size_t chunk, Digest &digest) -> double {
+    double best = 0;
+    for (uint8_t run = 0; run < 5; ++run) {
+        const auto start = std::chrono::steady_clock::now();
+        digest = hash(image, chunk);
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::max(best, static_cast<double>(image.size()) / elapsed / 1e6);
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    std::vector<size_t> sizes;
+    size_t chunk = 4096;
+    for (int index = 1; index < argc; ++index) {
+        if (strcmp(argv[index], "-c") == 0 && index + 1 < argc) {
+            chunk = strtoul(argv[++index], nullptr, 10);
+        } else {
+            sizes.push_back(strtoul(argv[index], nullptr, 10) * 1024 * 1024);
+        }
+    }
+    if (sizes.empty()) sizes = { 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024 };
+    if (chunk == 0 || std::find(sizes.begin(), sizes.end(), 0) != sizes.end()) {
+        fprintf(stderr, "Usage: %s [image MB...] [-c chunk size]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 random(42);
+    printf("%10s %14s %14s\n", "image", "portable MB/s", "EVP MB/s");
+    for (const auto size : sizes) {
+        std::vector<unsigned char> image(size);
+        for (auto &byte : image) byte = static_cast<unsigned char>(random());
+
+        Digest portableDigest, evpDigest;
+        const auto portableSpeed = throughput(portable, image, chunk, portableDigest);
+        const auto evpSpeed = throughput(evp, image, chunk, evpDigest);
+        if (portableDigest != evpDigest) {
+            fprintf(stderr, "Digests of the %zu bytes image differ\n", size);
+            return 1;
+        }
+        printf("%8zuMB %14.1f %14.1f\n", size / 1024 / 1024, portableSpeed, evpSpeed);
+    }
+    return 0;
+}
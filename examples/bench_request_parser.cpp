@@ -0,0 +1,62 @@
+// Throughput of `iop_hal::RequestParser` over pipelined requests, read the way the Linux HttpServer reads its sockets.
+//
+//   g++ -std=c++17 -O2 -Iinclude -Isrc examples/bench_request_parser.cpp -o bench_request_parser
+//   ./bench_request_parser [requests] [read size]
+
+#include "cpp17/http_parser.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// Same limits as the Linux HttpServer
+constexpr size_t maxLineLength = 4096;
+constexpr size_t maxHeadersSize = 8 * 1024;
+constexpr size_t maxRequestSize = 16 * 1024;
+
+int main(int argc, char **argv) {
+    const size_t requests = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    const size_t readSize = argc > 2 ? strtoul(argv[2], nullptr, 10) : 4096;
+    if (requests == 0 || readSize == 0) {
+        fprintf(stderr, "Usage: %s [requests] [read size]\n", argv[0]);
+        return 1;
+    }
+
+    // A form submission and a chunked upload, alternated
+    const std::string form = "POST /connect HTTP/1.1\r\nHost: 192.168.4.1\r\nUser-Agent: Mozilla/5.0\r\nAccept: */*\r\n"
+                             "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: 40\r\n\r\n"
+                             "ssid=network&password=supersecretpasswd1";
+    const std::string chunked = "POST /upload HTTP/1.1\r\nHost: 192.168.4.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                "10\r\n0123456789abcdef\r\n10\r\n0123456789abcdef\r\n0\r\n\r\n";
+    std::string stream;
+    stream.reserve((requests / 2 + 1) * (form.length() + chunked.length()));
+    for (size_t index = 0; index < requests; ++index) stream.append(index % 2 == 0 ? form : chunked);
+
+    iop_hal::RequestParser parser(maxLineLength, maxHeadersSize, maxRequestSize);
+    size_t parsed = 0, bodySize = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t offset = 0; offset < stream.length(); offset += readSize) {
+        auto input = std::string_view(stream).substr(offset, readSize);
+        while (input.length() > 0) {
+            bodySize += parser.parse(input).length();
+            if (parser.state() == iop_hal::RequestParser::State::ERROR) {
+                fprintf(stderr, "Request %zu failed: %d\n", parsed, static_cast<int>(parser.error()));
+                return 1;
+            }
+            if (parser.state() == iop_hal::RequestParser::State::DONE) {
+                parser.reset();
+                parsed++;
+            }
+        }
+    }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (parsed != requests) {
+        fprintf(stderr, "Parsed %zu of %zu requests\n", parsed, requests);
+        return 1;
+    }
+    printf("%zu requests (%zu body bytes) in %.3f ms\n", parsed, bodySize, elapsed * 1e3);
+    printf("%.1f ns/request, %.1f MB/s\n", elapsed * 1e9 / static_cast<double>(parsed), static_cast<double>(stream.length()) / elapsed / 1e6);
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Time to parse a response with `iop_hal::ResponseParser`, against the loop the Linux client used before it, that
+// shifted its whole buffer after every header line and lowercased a copy of each line per collected header.
+//
+//   g++ -std=c++17 -O2 -Iinclude -Isrc examples/bench_response_parser.cpp -o bench_response_parser
+//   ./bench_response_parser [responses] [headers]
+
+#include "cpp17/http_parser.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Same as the Linux client's receive buffer
+constexpr size_t bufferSize = 8192;
+
+static void shiftChars(char *ptr, const size_t start, const size_t end) {
+    memmove(ptr, ptr + start, end);
+    memset(ptr + end, '\0', bufferSize - end);
+}
+
+/// The previous loop, without its logs, for a response that fits in one read. Returns the body size
+static auto shiftCharsLoop(char *buffer, const std::string &response, const std::vector<std::string> &keys, std::unordered_map<std::string, std::string> &headers) -> size_t {
+    memset(buffer, '\0', bufferSize);
+    memcpy(buffer, response.data(), response.length());
+    auto size = response.length();
+    auto buff = std::string_view(buffer, size);
+
+    // Status line
+    const auto newlineIndex = buff.find("\n") + 1;
+    if (atoi(std::string(buff.substr(9, 3)).c_str()) <= 0) return 0;
+    size -= newlineIndex;
+    shiftChars(buffer, newlineIndex, size);
+    buff = std::string_view(buffer, size);
+
+    std::optional<size_t> contentLength;
+    auto persistent = true;
+    while (size > 0) {
+        if (buff.find("\r\n") == 0) {
+            size -= 2;
+            shiftChars(buffer, 2, size);
+            break;
+        }
+
+        const auto line = buff.substr(0, buff.find("\r\n"));
+        if (const auto value = iop_hal::headerValue(line, "Content-Length")) {
+            size_t length = 0;
+            const auto result = std::from_chars(value->data(), value->data() + value->length(), length);
+            if (result.ec == std::errc() && result.ptr == value->data() + value->length()) contentLength = length;
+        } else if (const auto value = iop_hal::headerValue(line, "Connection")) {
+            persistent = strncasecmp(value->data(), "close", value->length()) != 0;
+        }
+
+        for (const auto &key : keys) {
+            if (size < key.length() + 2) continue;
+            std::string headerKey(buff.substr(0, key.length()));
+            std::transform(headerKey.begin(), headerKey.end(), headerKey.begin(), [](unsigned char c) { return std::tolower(c); });
+            if (headerKey != key) continue;
+
+            auto valueView = buff.substr(key.length());
+            if (*valueView.begin() == ':') valueView = valueView.substr(1);
+            while (*valueView.begin() == ' ') valueView = valueView.substr(1);
+            headers.emplace(key, std::string(valueView, 0, valueView.find("\r\n")));
+        }
+
+        const auto startIndex = buff.find("\r\n") + 2;
+        size -= startIndex;
+        shiftChars(buffer, startIndex, size);
+        buff = std::string_view(buffer, size);
+    }
+    (void) persistent;
+    return std::min(size, contentLength.value_or(size));
+}
+
+static auto parserLoop(const std::string &response, const std::vector<std::string> &keys, std::unordered_map<std::string, std::string> &headers) -> size_t {
+    iop_hal::ResponseParser parser(keys, true);
+    auto input = std::string_view(response);
+    size_t body = 0;
+    while (input.length() > 0 && parser.state() != iop_hal::ResponseParser::State::DONE && parser.state() != iop_hal::ResponseParser::State::ERROR) {
+        body += parser.parse(input).length();
+    }
+    headers = std::move(parser.headers());
+    return body;
+}
+
+int main(int argc, char **argv) {
+    const size_t responses = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    const size_t headerCount = argc > 2 ? strtoul(argv[2], nullptr, 10) : 30;
+    if (responses == 0) {
+        fprintf(stderr, "Usage: %s [responses] [headers]\n", argv[0]);
+        return 1;
+    }
+
+    // The headers the client collects, the old loop expected them lowercased
+    const std::vector<std::string> keys = { "latest_version", "content-range", "content-type" };
+    std::string response = "HTTP/1.1 200 OK\r\n";
+    for (size_t index = 0; index < headerCount; ++index) {
+        response.append("X-Header-Number-").append(std::to_string(index)).append(": some value that is moderately long\r\n");
+    }
+    response.append("LATEST_VERSION: 0123456789ABCDEF0123456789ABCDEF\r\nContent-Type: application/json\r\nContent-Length: 100\r\n\r\n");
+    response.append(100, 'x');
+    if (response.length() > bufferSize) {
+        fprintf(stderr, "The response must fit in the client's buffer (%zu bytes)\n", bufferSize);
+        return 1;
+    }
+
+    auto buffer = std::make_unique<char[]>(bufferSize);
+    double elapsed[2] = {};
+    for (size_t method = 0; method < 2; ++method) {
+        size_t body = 0, collected = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t index = 0; index < responses; ++index) {
+            std::unordered_map<std::string, std::string> headers;
+            body += method == 0 ? shiftCharsLoop(buffer.get(), response, keys, headers) : parserLoop(response, keys, headers);
+            collected += headers.size();
+        }
+        elapsed[method] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (body != responses * 100 || collected != responses * 2) {
+            fprintf(stderr, "Invalid parse: %zu body bytes, %zu headers\n", body, collected);
+            return 1;
+        }
+        printf("%-10s %8.1f ns/response, %7.1f MB/s\n", method == 0 ? "shiftChars" : "parser",
+               elapsed[method] * 1e9 / static_cast<double>(responses), static_cast<double>(response.length() * responses) / elapsed[method] / 1e6);
+    }
+    printf("%.1fx faster\n", elapsed[0] / elapsed[1]);
+    return 0;
+}
@@ -0,0 +1,35 @@
+// Counts the write syscalls a program makes to sockets and files, printed to stderr when it exits. It's preloaded,
+// so the same client binary is measured unchanged, like before and after sending request heads with a single write:
+//
+//   g++ -std=c++17 -O2 -shared -fPIC examples/count_writes.cpp -o count_writes.so -ldl
+//   LD_PRELOAD=./count_writes.so ./client
+//
+// Where `client` posts 10 times to the same server with `iop::Network::httpPost`, over keep-alive connections.
+// Standard streams aren't counted, so logs don't get in the way. Over TLS every record is a write, the handshake included.
+
+#include <dlfcn.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+
+static std::atomic<unsigned long> writes(0);
+
+__attribute__((destructor)) static void report() {
+    fprintf(stderr, "Write syscalls: %lu\n", writes.load());
+}
+
+/// Calls the real `name`, counting the call if it's not a standard stream
+#define IOP_COUNT_WRITES(ret, name, params, args)                                      \
+    extern "C" ret name params {                                                         \
+        static auto real = reinterpret_cast<ret (*) params>(dlsym(RTLD_NEXT, #name)); \
+        if (fd > STDERR_FILENO) writes++;                                                \
+        return real args;                                                                \
+    }
+
+IOP_COUNT_WRITES(ssize_t, write, (int fd, const void *data, size_t length), (fd, data, length))
+IOP_COUNT_WRITES(ssize_t, writev, (int fd, const struct iovec *iov, int count), (fd, iov, count))
+IOP_COUNT_WRITES(ssize_t, send, (int fd, const void *data, size_t length, int flags), (fd, data, length, flags))
+IOP_COUNT_WRITES(ssize_t, sendmsg, (int fd, const struct msghdr *message, int flags), (fd, message, flags))
@@ -0,0 +1,59 @@
+// libFuzzer harness for `iop_hal::RequestParser`, that parses untrusted input from anyone connected to the Access Point.
+//
+// It's header only, so it builds without the rest of the library:
+//   clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -Iinclude -Isrc examples/fuzz_request_parser.cpp -o fuzz_request_parser
+//   ./fuzz_request_parser -max_len=32768
+//
+// The first byte of the input picks the size of the reads, so requests split at every point are covered.
+
+#include "cpp17/http_parser.hpp"
+
+#include <cstdlib>
+#include <string>
+
+// Same limits as the Linux HttpServer
+constexpr size_t maxLineLength = 4096;
+constexpr size_t maxHeadersSize = 8 * 1024;
+constexpr size_t maxRequestSize = 16 * 1024;
+
+extern "C" auto LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) -> int {
+    if (size == 0) return 0;
+    const size_t readSize = data[0] == 0 ? size : data[0];
+    auto stream = std::string_view(reinterpret_cast<const char *>(data + 1), size - 1);
+
+    using State = iop_hal::RequestParser::State;
+    iop_hal::RequestParser parser(maxLineLength, maxHeadersSize, maxRequestSize);
+    size_t bodySize = 0;
+    while (stream.length() > 0) {
+        // Reads are copied, so nothing past them can be referenced by the parser
+        const auto read = std::string(stream.substr(0, readSize));
+        stream.remove_prefix(read.length());
+
+        auto input = std::string_view(read);
+        while (input.length() > 0) {
+            const auto before = input.length();
+            const auto state = parser.state();
+            const auto body = parser.parse(input);
+
+            // Bodies reference the read, and are bounded by the limit
+            if (body.length() > 0 && (body.data() < read.data() || body.data() + body.length() > read.data() + read.length())) abort();
+            bodySize += body.length();
+            if (bodySize > maxRequestSize) abort();
+            if (parser.headers().length() > maxHeadersSize) abort();
+
+            if (parser.state() == State::ERROR) {
+                if (parser.error() == iop_hal::RequestParser::Error::NONE) abort();
+                return 0;
+            }
+            if (parser.state() == State::DONE) {
+                // Pipelined requests follow
+                parser.reset();
+                bodySize = 0;
+                continue;
+            }
+            // Every call must make progress, or the server would spin on the connection
+            if (input.length() == before && parser.state() == state) abort();
+        }
+    }
+    return 0;
+}
@@ -3,10 +3,12 @@
 
 #include "iop-hal/string.hpp"
 #include "iop-hal/response.hpp"
+#include "iop-hal/thread.hpp"
 #include <functional>
 #include <string>
 #include <optional>
 #include <memory>
+#include <vector>
 
 class HTTPClient;
 
@@ -14,6 +16,17 @@ namespace iop_hal {
 class HTTPClient;
 
 class SessionContext;
+class AsyncContext;
+
+/// Request of a pipeline, see `Session::sendRequests`
+struct PipelinedRequest {
+  std::string_view method;
+  /// Relative to the origin the session was started with
+  std::string_view path;
+  std::string_view data;
+  /// Headers of this request alone, serialized as `Key: value\r\n` lines
+  std::string_view headers;
+};
 
 // References HTTPClient, should never outlive it
 class Session {
@@ -27,9 +40,16 @@ public:
   void addHeader(iop::StaticString key, std::string_view value) noexcept;
   void addHeader(std::string_view key, iop::StaticString value) noexcept;
   void addHeader(std::string_view key, std::string_view value) noexcept;
-  void setAuthorization(std::string auth) noexcept;
+  /// Appends headers already serialized as `Key: value\r\n` lines, so constant headers aren't rebuilt for every request
+  void addHeaders(std::string_view block) noexcept;
+  void setAuthorization(std::string_view auth) noexcept;
   // How to represent that this moves the server out
   auto sendRequest(std::string method, std::string_view data) noexcept -> Response;
+  /// Sends every request before reading any response (HTTP/1.1 pipelining), on this connection, with the headers `prepare` adds to the session.
+  ///
+  /// Responses come in the same order, their bodies downloaded up to `maxSize`. Requests left without a response if the connection breaks are IO_ERROR.
+  /// The ESPs' client can't pipeline, so there they are sent one after the other on the same connection. Changing the path clears its headers, so `prepare` runs for each request
+  auto sendRequests(const std::vector<PipelinedRequest> &requests, size_t maxSize, const std::function<void(Session &)> &prepare) noexcept -> std::vector<Response>;
   Session(Session &&other) noexcept = delete;
   Session(const Session &other) noexcept = delete;
   auto operator==(Session &&other) noexcept -> Session & = delete;
@@ -37,9 +57,49 @@ public:
   ~Session() noexcept = default;
 };
 
+#if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)
+/// Requests started by `HTTPClient::beginAsync` progress without blocking
+constexpr bool nonBlockingRequests = true;
+#else
+/// The ESPs' core client blocks through DNS, TLS and the request, so `HTTPClient::beginAsync` runs it before returning
+constexpr bool nonBlockingRequests = false;
+#endif
+
+/// Request in flight, it progresses without blocking whenever it's polled, by its owner or by `HTTPClient::poll`.
+///
+/// Its body is downloaded with it, so the response is complete once the request is done. Dropping the handle aborts it.
+/// Where `nonBlockingRequests` is false it's already done when returned
+class AsyncRequest {
+  std::unique_ptr<AsyncContext> ctx;
+
+public:
+  explicit AsyncRequest(std::unique_ptr<AsyncContext> context) noexcept;
+
+  /// Progresses the request as much as possible without blocking, returns true once it's done
+  auto poll() noexcept -> bool;
+  /// Takes the response of a finished request, it can only be taken once
+  auto response() noexcept -> Response;
+
+  AsyncRequest(AsyncRequest &&other) noexcept;
+  AsyncRequest(const AsyncRequest &other) noexcept = delete;
+  auto operator=(AsyncRequest &&other) noexcept -> AsyncRequest &;
+  auto operator=(const AsyncRequest &other) noexcept -> AsyncRequest & = delete;
+  ~AsyncRequest() noexcept;
+};
+
+#if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)
+/// Counts TLS handshakes, to measure the session resumption hit rate
+struct HandshakeStats {
+  uint64_t resumed;
+  uint64_t full;
+};
+#endif
+
 class HTTPClient {
 #if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)
   std::vector<std::string> headersToCollect_;
+  // Reused by every request, so serializing headers only allocates while the buffer grows
+  std::string requestHeaders_;
 #elif defined(IOP_ESP8266) || defined(IOP_ESP32)
   ::HTTPClient * http;
 #elif defined(IOP_NOOP)
@@ -51,7 +111,18 @@ public:
   ~HTTPClient() noexcept;
   static auto setup() noexcept -> void;
   auto begin(std::string_view uri, std::function<Response(Session &)> func) noexcept -> Response;
+  /// Starts a request without waiting for it. `prepare` may only add headers, the body is downloaded up to `maxSize`,
+  /// and the complete response is replaced by what `process` returns, if set. Both may run after this returns.
+  ///
+  /// Where `nonBlockingRequests` is false the whole request runs here instead
+  auto beginAsync(std::string_view uri, std::string_view method, std::string_view data, size_t maxSize, std::function<void(Session &)> prepare, std::function<Response(Response &)> process) noexcept -> AsyncRequest;
+  /// Progresses every request in flight, waiting up to `timeout` for their sockets. Used by the runtime between `iop_hal::loop` runs
+  static auto poll(iop::time::milliseconds timeout) noexcept -> void;
   auto headersToCollect(std::vector<std::string> headers) noexcept -> void;
+#if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)
+  /// Handshakes done by all clients since boot
+  static auto handshakeStats() noexcept -> HandshakeStats;
+#endif
 
   HTTPClient(HTTPClient &&other) noexcept;
   HTTPClient(const HTTPClient &other) noexcept = delete;
@@ -0,0 +1,26 @@
+#ifndef IOP_DRIVER_COMPRESSION_HPP
+#define IOP_DRIVER_COMPRESSION_HPP
+
+#include "iop-hal/string.hpp"
+#include <string>
+#include <string_view>
+
+namespace iop_hal {
+enum class ContentEncoding {
+  /// RFC 1952
+  GZIP,
+  /// Zlib wrapped deflate stream, RFC 1950
+  DEFLATE,
+};
+
+/// Value of the Content-Encoding header
+auto contentEncodingName(ContentEncoding encoding) noexcept -> iop::StaticString;
+
+/// Compresses `data` into `output`, returns false if it fails.
+///
+/// Linux uses zlib if `IOP_ZLIB` is defined, with its full 32KB window. Otherwise a built-in encoder (LZ77 + fixed Huffman codes) is used,
+/// its window is 32KB on Linux and 2KB on the ESPs, so its hash table stays small
+auto compress(std::string_view data, ContentEncoding encoding, std::string &output) noexcept -> bool;
+}
+
+#endif
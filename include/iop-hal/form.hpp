@@ -0,0 +1,49 @@
+#ifndef IOP_DRIVER_FORM_HPP
+#define IOP_DRIVER_FORM_HPP
+
+#include <string_view>
+#include <optional>
+#include <stdint.h>
+#include <vector>
+
+namespace iop_hal {
+/// Index of a request's arguments, spans of the buffers they came from, parsed once.
+///
+/// Values are decoded in place the first time they are read, as decoding only shrinks them. So the buffers
+/// must outlive the index, and are modified by it.
+class FormIndex {
+  enum class Encoding : uint8_t { RAW, URL, JSON };
+
+  struct Field {
+    std::string_view name;
+    char *value;
+    size_t length;
+    Encoding encoding;
+  };
+
+  std::vector<Field> fields;
+
+  auto indexMultipart(char *data, size_t length, std::string_view boundary) noexcept -> bool;
+  auto indexJson(char *data, size_t length) noexcept -> bool;
+
+public:
+  FormIndex() noexcept: fields() {}
+
+  void clear() noexcept { this->fields.clear(); }
+  auto size() const noexcept -> size_t { return this->fields.size(); }
+
+  /// `application/x-www-form-urlencoded`, also used by query strings
+  auto urlEncoded(char *data, size_t length) noexcept -> bool;
+  /// `multipart/form-data`, files are indexed like any other field. Invalid bodies index nothing
+  auto multipart(char *data, size_t length, std::string_view boundary) noexcept -> bool;
+  /// Members of a JSON object, nested objects and arrays are kept as JSON. Null members are skipped. Invalid bodies index nothing
+  auto json(char *data, size_t length) noexcept -> bool;
+  /// Picks the parser from the body's Content-Type, defaulting to urlencoded. Returns false if the body is invalid
+  auto body(char *data, size_t length, std::string_view contentType) noexcept -> bool;
+
+  /// The first value named `name`. Invalid encodings have no value
+  auto get(std::string_view name) noexcept -> std::optional<std::string_view>;
+};
+} // namespace iop_hal
+
+#endif
@@ -1,10 +1,14 @@
 #ifndef IOP_DRIVER_NETWORK_HPP
 #define IOP_DRIVER_NETWORK_HPP
 
+#include "iop-hal/compression.hpp"
 #include "iop-hal/response.hpp"
+#include "iop-hal/client.hpp"
 #include "iop-hal/wifi.hpp"
 #include "iop-hal/log.hpp"
 
+#include <functional>
+#include <string>
 #include <vector>
 
 namespace iop {
@@ -24,6 +28,19 @@ public:
   static void defaultHook() noexcept;
 };
 
+/// Inspects a response before its body is downloaded, returning false skips the download
+using ResponseInspector = std::function<bool(const iop_hal::Response &response)>;
+
+/// Optional settings of `Network::httpStream`
+struct StreamOptions {
+  /// Requests the body from this byte onwards (HTTP Range). Servers may ignore it, sending all of it with 200 instead of 206
+  size_t offset = 0;
+  /// Sent as the Accept header, if not empty
+  std::string_view accept = std::string_view();
+  /// Called before the body is streamed, so the caller can prepare for it, or refuse it (BROKEN_CLIENT)
+  ResponseInspector inspect = nullptr;
+};
+
 enum class HttpMethod {
   GET,
   HEAD,
@@ -35,6 +52,36 @@ enum class HttpMethod {
   OPTIONS,
 };
 
+/// Requests sent together by `Network::httpBatch` or `Network::httpBatchMerged`, so the per-request cost (connections, round trips) is paid once
+class Batch {
+public:
+  /// Receives the item's response, after the whole batch is done
+  using Callback = std::function<void(iop_hal::Response &response)>;
+
+  struct Item {
+    HttpMethod method;
+    StaticString path;
+    std::string data;
+    Callback callback;
+  };
+
+private:
+  std::vector<Item> items_;
+
+public:
+  Batch() noexcept: items_() {}
+
+  /// Copies the data, returns the index of the item's response
+  auto add(HttpMethod method, StaticString path, std::string_view data, Callback callback = nullptr) noexcept -> size_t {
+    this->items_.push_back(Item { method, path, std::string(data), std::move(callback) });
+    return this->items_.size() - 1;
+  }
+  auto items() const noexcept -> const std::vector<Item> & { return this->items_; }
+  auto size() const noexcept -> size_t { return this->items_.size(); }
+  auto isEmpty() const noexcept -> bool { return this->items_.empty(); }
+  auto clear() noexcept -> void { this->items_.clear(); }
+};
+
 /// General higher level HTTPs client made to interact with IoP's server
 /// Its purposes are security, good error reporting, no UB possible and ergonomy, in that order.
 ///
@@ -44,14 +91,36 @@ enum class HttpMethod {
 class Network {
   Log logger_;
   StaticString uri_;
+  size_t maxPayloadSize_;
+  std::optional<iop_hal::ContentEncoding> requestEncoding_;
+  size_t minCompressedSize_;
 
 public:
+  /// Default limit for response bodies, they are supposed to be small JSONs
+  static constexpr size_t defaultMaxPayloadSize = iop_hal::defaultMaxPayloadSize;
+  /// Smaller bodies fit in a packet anyway, compressing them only costs CPU
+  static constexpr size_t defaultMinCompressedSize = 256;
+
   Network(StaticString uri) noexcept;
 
   static auto setup() noexcept -> void;
   auto uri() const noexcept -> StaticString { return this->uri_; }
   auto endpoint(StaticString path) const noexcept -> std::string { return this->uri_.toString() + path.toString(); }
 
+  /// Response bodies bigger than this are aborted before being downloaded, returning BROKEN_SERVER
+  auto setMaxPayloadSize(size_t size) noexcept -> void { this->maxPayloadSize_ = size; }
+  auto maxPayloadSize() const noexcept -> size_t { return this->maxPayloadSize_; }
+
+  /// Compresses request bodies of at least `minSize` bytes, setting their `Content-Encoding`, the server must accept it. Disabled by default.
+  ///
+  /// Bodies that wouldn't shrink are sent as is. Pipelined batches (`httpBatch`) aren't compressed, merged ones are
+  auto setRequestCompression(std::optional<iop_hal::ContentEncoding> encoding, size_t minSize = defaultMinCompressedSize) noexcept -> void {
+    this->requestEncoding_ = encoding;
+    this->minCompressedSize_ = minSize;
+  }
+  auto requestEncoding() const noexcept -> std::optional<iop_hal::ContentEncoding> { return this->requestEncoding_; }
+  auto minCompressedSize() const noexcept -> size_t { return this->minCompressedSize_; }
+
   /// Sets new firmware update hook for this. Very useful to support updates
   /// reported by the network (LAST_VERSION header different than current
   /// sketch hash) Default is a noop
@@ -76,6 +145,54 @@ public:
   /// Sends a custom HTTP request that may be authenticated to the monitor server (primitive used by higher level methods)
   auto httpRequest(HttpMethod method, const std::optional<std::string_view> &token, StaticString path, const std::optional<std::string_view> &data) noexcept -> iop_hal::Response;
 
+  /// Sends a custom HTTP request, feeding the body of successful responses to `handler` as it's downloaded, instead of buffering it.
+  ///
+  /// Bodies bigger than `maxSize` are aborted (BROKEN_SERVER), the returned response only keeps the headers.
+  auto httpStream(HttpMethod method, const std::optional<std::string_view> &token, StaticString path, const std::optional<std::string_view> &data, size_t maxSize, const iop_hal::ChunkHandler &handler, const StreamOptions &options = StreamOptions()) noexcept -> iop_hal::Response;
+
+  /// Starts a custom HTTP request without waiting for it, the handle is progressed by the runtime or by polling it.
+  ///
+  /// The body is downloaded with it, bounded by `maxPayloadSize`. The network must outlive the request.
+  ///
+  /// On the ESPs it blocks until the request is done, see `iop_hal::nonBlockingRequests`
+  auto httpRequestAsync(HttpMethod method, const std::optional<std::string_view> &token, StaticString path, const std::optional<std::string_view> &data) noexcept -> iop_hal::AsyncRequest;
+
+  /// Sets up the queue of undelivered POSTs, `size` bytes from `address` of `iop_hal::Storage` on the ESPs (it must fit), a file on Linux.
+  ///
+  /// With `coalesce` consecutive records to the same path are delivered together, as a JSON array of them, so the server must accept it
+  ///
+  /// Delivery is at-least-once: records delivered since the queue was last committed are sent again after a reboot
+  static auto setupQueue(uintmax_t address, size_t size, bool coalesce) noexcept -> bool;
+  /// Commits the queue right away, call it before rebooting or deep sleeping. Otherwise commits are rate-limited to spare the flash
+  static auto flushQueue() noexcept -> bool;
+
+  /// Sends an authenticated POST, queueing it if offline, or if it fails in a way that may succeed later (IO errors, 401, 408, 429 and 5xx).
+  ///
+  /// Records queued before it are delivered first. Returns the response of the delivery that carried it, IO_ERROR if it's still queued
+  auto httpPostQueued(std::string_view token, StaticString path, std::string_view data) noexcept -> iop_hal::Response;
+
+  /// Delivers up to `maxBatchRecords` queued records, if connected and not backing off from a failure. Call it from the loop, it's cheap when idle.
+  ///
+  /// Failures back off exponentially, from `initialBackoff` up to `maxBackoff`. Returns true if the queue is empty
+  auto drainQueue(std::string_view token) noexcept -> bool;
+
+  static constexpr size_t maxBatchRecords = 16;
+  /// Coalesced records are bounded by this many bytes, a single record may exceed it
+  static constexpr size_t maxBatchSize = 2048;
+  static constexpr iop::time::milliseconds initialBackoff = 5000;
+  static constexpr iop::time::milliseconds maxBackoff = 10 * 60 * 1000;
+
+  /// Sends every item of the batch pipelined on one keep-alive connection, sharing the headers. Meant for small requests.
+  ///
+  /// Returns the responses in the items' order, bodies bounded by `maxPayloadSize`, after calling the items' callbacks with them
+  auto httpBatch(const std::optional<std::string_view> &token, const Batch &batch) noexcept -> std::vector<iop_hal::Response>;
+
+  /// Merges the batch into a single POST to `path`, framed as `application/x-iop-batch`, splitting the response back into the items'.
+  ///
+  /// Each item is framed as `METHOD path length\n` followed by its data, the server must answer with a frame per item, in order, as `code length\n` followed by the body.
+  /// The merged response is bounded by `maxPayloadSize` times the number of items. Returns like `httpBatch`
+  auto httpBatchMerged(const std::optional<std::string_view> &token, StaticString path, const Batch &batch) noexcept -> std::vector<iop_hal::Response>;
+
   /// Fetches firmware update from the network
   auto update(StaticString path, std::string_view token) noexcept -> iop_hal::UpdateStatus;
 
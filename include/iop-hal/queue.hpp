@@ -0,0 +1,79 @@
+#ifndef IOP_DRIVER_QUEUE_HPP
+#define IOP_DRIVER_QUEUE_HPP
+
+#include "iop-hal/thread.hpp"
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace iop_hal {
+/// Record read back from `PersistentQueue`
+struct QueuedRecord {
+  std::string path;
+  std::string data;
+};
+
+/// Persistent FIFO of outbound records, it survives being offline and reboots. When full the oldest records are dropped.
+///
+/// It's a ring buffer in a region of `iop_hal::Storage` on the ESPs, on Linux the region is its own file (`queue.dat`).
+///
+/// Changes are kept in memory and committed at most every `commitInterval`, unless a quarter of the region changed, bounding flash wear.
+/// So records pushed since the last commit are lost if power is, `flush` commits them right away
+class PersistentQueue {
+  uintmax_t address;
+  size_t capacity;
+  uint32_t head;
+  uint32_t used;
+  uint32_t count;
+  size_t dirty;
+  iop::time::milliseconds lastCommit;
+  bool ready;
+#if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX) || defined(IOP_NOOP)
+  std::vector<uint8_t> region;
+#elif defined(IOP_ESP8266) || defined(IOP_ESP32)
+#else
+#error "Target not valid"
+#endif
+
+  // Implemented by each target, offsets are relative to the region
+  auto load() noexcept -> bool;
+  auto readBytes(size_t offset, uint8_t *output, size_t length) const noexcept -> void;
+  auto writeBytes(size_t offset, const uint8_t *input, size_t length) noexcept -> void;
+  auto persist() noexcept -> bool;
+
+  auto dataSize() const noexcept -> size_t;
+  auto readRing(uint32_t position, uint8_t *output, size_t length) const noexcept -> void;
+  auto writeRing(uint32_t position, const uint8_t *input, size_t length) noexcept -> void;
+  auto writeHeader() noexcept -> void;
+  auto changed(size_t bytes) noexcept -> void;
+
+public:
+  /// Unless a quarter of the region changed, commits are at least this far apart
+  static constexpr iop::time::milliseconds commitInterval = 60000;
+
+  PersistentQueue() noexcept;
+
+  /// Uses `size` bytes from `address`. On the ESPs `iop_hal::Storage` must already be set up and fit it, on Linux `address` is ignored.
+  ///
+  /// Returns false if it can't be used, a corrupted or resized queue is cleared
+  auto setup(uintmax_t address, size_t size) noexcept -> bool;
+
+  /// Returns false if it's not set up, or if the record wouldn't fit even in an empty queue
+  auto push(std::string_view path, std::string_view data) noexcept -> bool;
+  /// Reads records from the front without removing them, up to `maxRecords` and `maxBytes` of data (at least one is read)
+  auto front(std::vector<QueuedRecord> &records, size_t maxRecords, size_t maxBytes) const noexcept -> void;
+  /// Removes records from the front
+  auto pop(size_t records) noexcept -> void;
+
+  auto size() const noexcept -> size_t { return this->count; }
+  auto isEmpty() const noexcept -> bool { return this->count == 0; }
+
+  /// Commits if it's time to, following the wear bounds
+  auto commit() noexcept -> bool;
+  /// Commits pending changes right away, before a reboot or deep sleep
+  auto flush() noexcept -> bool;
+};
+}
+
+#endif
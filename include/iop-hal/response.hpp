@@ -4,6 +4,7 @@
 #include "iop-hal/string.hpp"
 
 #include <unordered_map>
+#include <functional>
 #include <optional>
 #include <vector>
 
@@ -29,24 +30,50 @@ public:
   explicit Payload(std::vector<uint8_t> data) noexcept: payload(std::move(data)) {}
 };
 
+/// Bound of `Response::await()`, bodies are supposed to be small JSONs
+constexpr size_t defaultMaxPayloadSize = 4096;
+
+/// Receives the body piece by piece, as it's downloaded. Returning false aborts the download.
+using ChunkHandler = std::function<bool(std::string_view chunk)>;
+/// Downloads the body into the handler, bailing out before going over `maxSize` bytes
+using BodyReader = std::function<iop::NetworkStatus(size_t maxSize, const ChunkHandler &handler)>;
+
+/// The body is downloaded on demand, from the connection that produced the response.
+///
+/// Lazy bodies are only available inside the `HTTPClient::begin` callback, and can be consumed once.
 class Response {
   std::unordered_map<std::string, std::string> headers_;
-  Payload promise;
+  std::optional<Payload> promise;
+  BodyReader reader;
+  std::optional<size_t> contentLength_;
   int code_;
   std::optional<iop::NetworkStatus> status_;
 
 public:
-  Response(const Payload payload, const iop::NetworkStatus status) noexcept: headers_({}), promise(payload), code_(static_cast<uint8_t>(status)), status_(status) {}
-  Response(std::unordered_map<std::string, std::string> headers, const Payload payload, const int code) noexcept: headers_(headers), promise(payload), code_(code), status_(iop_hal::networkStatus(code)) {}
+  Response(Payload payload, const iop::NetworkStatus status) noexcept: headers_({}), promise(std::move(payload)), code_(static_cast<int>(status)), status_(status) {}
+  Response(std::unordered_map<std::string, std::string> headers, Payload payload, const int code) noexcept: headers_(std::move(headers)), promise(std::move(payload)), code_(code), status_(iop_hal::networkStatus(code)) {}
+  Response(std::unordered_map<std::string, std::string> headers, BodyReader reader, const std::optional<size_t> contentLength, const int code) noexcept:
+    headers_(std::move(headers)), reader(std::move(reader)), contentLength_(contentLength), code_(code), status_(iop_hal::networkStatus(code)) {}
   explicit Response(const int code) noexcept: code_(code), status_(iop_hal::networkStatus(code)) {}
-  explicit Response(const iop::NetworkStatus status) noexcept: code_(static_cast<uint8_t>(status)), status_(status) {}
+  explicit Response(const iop::NetworkStatus status) noexcept: code_(static_cast<int>(status)), status_(status) {}
   auto code() const noexcept -> int { return this->code_; }
   auto status() const noexcept -> std::optional<iop::NetworkStatus> { return this->status_; }
   auto header(iop::StaticString key) const noexcept -> std::optional<std::string>;
-  auto await() noexcept -> Payload {
-    // TODO: make it actually lazy
-    return std::move(this->promise);
-  }
+  /// Body size announced by the server, if any
+  auto contentLength() const noexcept -> std::optional<size_t> { return this->contentLength_; }
+
+  /// Feeds the body to `handler` as it's downloaded, never buffering all of it.
+  ///
+  /// Returns BROKEN_SERVER if the body is bigger than `maxSize`, BROKEN_CLIENT if `handler` aborts it.
+  auto stream(size_t maxSize, const ChunkHandler &handler) noexcept -> iop::NetworkStatus;
+  /// Downloads the whole body, std::nullopt if it fails or is bigger than `maxSize`
+  auto await(size_t maxSize) noexcept -> std::optional<Payload>;
+  /// Downloads the whole body, bounded by `defaultMaxPayloadSize`. It's empty if the download fails
+  auto await() noexcept -> Payload;
+  /// Downloads the lazy body into the response, so it outlives the connection. False if it fails or is bigger than `maxSize`
+  auto preload(size_t maxSize) noexcept -> bool;
+  /// Drops the reference to the connection, unread lazy bodies become empty
+  auto detach() noexcept -> void { this->reader = nullptr; }
 };
 }
 
@@ -0,0 +1,172 @@
+#ifndef IOP_DRIVER_ROUTER_HPP
+#define IOP_DRIVER_ROUTER_HPP
+
+#include <string_view>
+#include <algorithm>
+#include <optional>
+#include <utility>
+#include <string>
+#include <vector>
+#include <array>
+
+namespace iop_hal {
+/// Path parameters captured while routing. They point into the request, so they are only valid while it's handled
+class RouteParams {
+public:
+  static constexpr size_t capacity = 4;
+
+private:
+  std::array<std::pair<std::string_view, std::string_view>, capacity> params;
+  size_t count;
+
+public:
+  RouteParams() noexcept: params(), count(0) {}
+
+  auto get(const std::string_view name) const noexcept -> std::optional<std::string_view> {
+    for (size_t index = 0; index < this->count; ++index) {
+      if (this->params[index].first == name) return this->params[index].second;
+    }
+    return std::nullopt;
+  }
+  auto push(const std::string_view name, const std::string_view value) noexcept -> bool {
+    if (this->count >= capacity) return false;
+    this->params[this->count++] = std::make_pair(name, value);
+    return true;
+  }
+  void pop() noexcept { if (this->count > 0) --this->count; }
+  void clear() noexcept { this->count = 0; }
+  auto size() const noexcept -> size_t { return this->count; }
+};
+
+/// Radix trie over the path segments, built as routes are registered during setup.
+///
+/// Routes are `[METHOD ]/path`, without the method they match any of them. Segments starting with `:` capture
+/// the request's segment as a parameter, and a trailing `*` matches any suffix, captured as the `*` parameter.
+///
+/// Literal segments win over parameters, that win over prefixes. Lookups walk the request in place, never allocating.
+template <typename Handler>
+class Router {
+  struct Route {
+    std::string method;
+    Handler handler;
+  };
+
+  struct Node {
+    std::string segment;
+    std::vector<Node> children;
+    // Routes may name the same parameter differently, each name has its own subtree, with it as the segment
+    std::vector<Node> params;
+    std::vector<Route> routes;
+    std::vector<Route> prefixes;
+  };
+
+  Node root;
+
+  /// Splits the first segment out of `path`, `last` is set if there is nothing after it
+  static auto nextSegment(std::string_view &path, bool &last) noexcept -> std::string_view {
+    const auto end = path.find('/');
+    const auto segment = path.substr(0, end);
+    last = end == path.npos;
+    path = last ? std::string_view() : path.substr(end + 1);
+    return segment;
+  }
+
+  /// Method specific routes take precedence over the generic ones
+  static auto select(const std::vector<Route> &routes, const std::string_view method) noexcept -> const Route * {
+    const Route *fallback = nullptr;
+    for (const auto &route: routes) {
+      if (route.method == method) return &route;
+      if (route.method.empty() && !fallback) fallback = &route;
+    }
+    return fallback;
+  }
+
+  auto match(const Node &node, const std::string_view path, const bool end, const std::string_view method, RouteParams &params) const noexcept -> const Handler * {
+    if (end) {
+      if (const auto *route = select(node.routes, method)) return &route->handler;
+    } else {
+      auto rest = path;
+      auto last = false;
+      const auto segment = nextSegment(rest, last);
+
+      for (const auto &child: node.children) {
+        if (child.segment != segment) continue;
+        if (const auto *handler = this->match(child, rest, last, method, params)) return handler;
+        break;
+      }
+
+      for (const auto &param: node.params) {
+        if (segment.empty() || !params.push(param.segment, segment)) break;
+        if (const auto *handler = this->match(param, rest, last, method, params)) return handler;
+        params.pop();
+      }
+    }
+
+    if (const auto *route = select(node.prefixes, method)) {
+      if (params.push("*", path)) return &route->handler;
+    }
+    return nullptr;
+  }
+
+public:
+  Router() noexcept: root() {}
+
+  /// Returns false if the route is invalid or has too many parameters
+  auto insert(const std::string_view route, Handler handler) noexcept -> bool {
+    auto path = route;
+    auto method = std::string_view();
+    const auto space = path.find(' ');
+    if (space != path.npos) {
+      method = path.substr(0, space);
+      path = path.substr(space + 1);
+    }
+    if (path.empty() || path.front() != '/') return false;
+    path = path.substr(1);
+
+    auto *node = &this->root;
+    size_t paramsCount = 0;
+    auto prefix = false;
+    auto last = path.empty();
+    while (!last) {
+      const auto segment = nextSegment(path, last);
+      if (segment == "*" && last) {
+        prefix = true;
+        break;
+      }
+
+      const auto isParam = segment.length() > 1 && segment.front() == ':';
+      // One slot is left for the prefix's suffix
+      if (isParam && ++paramsCount >= RouteParams::capacity) return false;
+
+      auto &children = isParam ? node->params : node->children;
+      const auto name = isParam ? segment.substr(1) : segment;
+      auto child = std::find_if(children.begin(), children.end(), [name](const Node &n) { return n.segment == name; });
+      if (child == children.end()) {
+        children.emplace_back();
+        children.back().segment = std::string(name);
+        child = children.end() - 1;
+      }
+      node = &*child;
+    }
+
+    auto &routes = prefix ? node->prefixes : node->routes;
+    const auto existing = std::find_if(routes.begin(), routes.end(), [method](const Route &r) { return r.method == method; });
+    if (existing != routes.end()) {
+      existing->handler = std::move(handler);
+    } else {
+      routes.push_back(Route { std::string(method), std::move(handler) });
+    }
+    return true;
+  }
+
+  /// Finds the handler for the request's path, ignoring the query string. Parameters captured are stored in `params`
+  auto find(const std::string_view method, std::string_view path, RouteParams &params) const noexcept -> const Handler * {
+    path = path.substr(0, path.find_first_of("?#"));
+    if (path.empty() || path.front() != '/') return nullptr;
+    params.clear();
+    return this->match(this->root, path.substr(1), path.length() == 1, method, params);
+  }
+};
+} // namespace iop_hal
+
+#endif
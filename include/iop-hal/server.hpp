@@ -2,8 +2,14 @@
 #define IOP_DRIVER_SERVER_HPP
 
 #include "iop-hal/log.hpp"
+#include "iop-hal/thread.hpp"
+#include "iop-hal/router.hpp"
+#include "iop-hal/form.hpp"
 #include <functional>
-#include <unordered_map>
+#include <optional>
+#include <string>
+#include <array>
+#include <vector>
 #include <memory>
 
 #if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)
@@ -16,21 +22,63 @@ class DNSServer;
 #endif
 
 namespace iop_hal {
+class HttpServerLoop;
+
+/// Static file stored gzipped in flash, generated by `build/preBuildAssets.py`
+struct StaticAsset {
+  iop::StaticString path;
+  /// Gzipped content, it's binary so it isn't a `StaticString`
+  const uint8_t *data;
+  size_t length;
+  iop::StaticString contentType;
+  /// Quoted hash of the content, browsers send it back in `If-None-Match` to revalidate their copy
+  iop::StaticString etag;
+};
+
 class HttpConnection {
 // TODO: make variables private with setters/getters available to friend classes (make HttpServer a friend)
 public:
+  using Writer = std::function<bool(HttpConnection &)>;
 #if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)
   std::optional<int32_t> currentClient;
   std::string currentHeaders;
   std::string currentPayload;
   std::optional<size_t> currentContentLength;
+  std::string currentMethod;
   std::string currentRoute;
+  // Header lines of the request, each ended by a line break
+  std::string currentRequestHeaders;
+  // Response data the socket couldn't take yet, it's sent once the socket is writable
+  mutable std::string currentOutput;
+  iop::time::milliseconds lastActivity = 0;
+  // The connection serves the next request after the response, as the client asked
+  bool keepAlive = false;
+  // Connections without a response for the current request are closed, as the client would wait forever
+  mutable bool responded = false;
+  // Minor version of the request's HTTP/1.x, only HTTP/1.1 clients understand chunked bodies
+  uint8_t currentVersion = 1;
+  // The streamed response's length is unknown, so its body is sent in chunks
+  bool chunked = false;
+  // The client stopped reading the streamed response
+  bool broken = false;
+  // Length of the response head at the start of `currentStream`, it's sent with the first chunk
+  size_t streamHead = 0;
+  // File whose body `sendFile` is sending, from `fileOffset`, as the socket takes it
+  int currentFile = -1;
+  size_t fileOffset = 0;
+  size_t fileLeft = 0;
+  // Continues the streamed response once the handler returned, see `onWritable`
+  Writer currentWriter;
 
   using Buffer = std::array<char, 4096>;
 #elif defined(IOP_ESP8266) || defined(IOP_ESP32)
 private:
   void *server; // ESP8266WebServer
 public:
+  // JSON bodies are left by the WebServer in the "plain" argument, they are indexed from here
+  mutable std::string currentBody;
+  bool currentContentLengthKnown = false;
+
   ~HttpConnection() noexcept;
   HttpConnection(void *parent) noexcept;
 
@@ -42,7 +90,17 @@ public:
 #else
 #error "Target not supported"
 #endif
+  RouteParams currentParams;
+  // Arguments from the query string and the body, indexed by the first `arg` call
+  mutable FormIndex currentArgs;
+  mutable bool currentArgsIndexed = false;
+  // Body of a streamed response, buffered until it's worth sending
+  std::string currentStream;
+  bool streaming = false;
 
+  /// Path parameter captured by the route, like `id` in `/plants/:id`, or the suffix matched by `*`
+  auto param(std::string_view name) const noexcept -> std::optional<std::string_view>;
+  /// Argument from the query string or the body, which may be urlencoded, `multipart/form-data` or a JSON object
   auto arg(iop::StaticString arg) const noexcept -> std::optional<std::string>;
   void sendHeader(iop::StaticString name, iop::StaticString value) noexcept;
 
@@ -51,25 +109,66 @@ public:
   void send(uint16_t code, iop::StaticString type, iop::StaticString data) const noexcept;
 
   void sendData(iop::StaticString data) const noexcept;
+
+  /// Starts a response whose body is written piece by piece. Unless `setContentLength` was called it's sent
+  /// chunked, or until the connection closes for HTTP/1.0 clients
+  void beginResponse(uint16_t code, iop::StaticString type) noexcept;
+  /// Buffers the data, sending it once the buffer is full. Returns false while the client is behind, or once it's gone.
+  /// The data is queued anyway, but the handler should stop writing and leave the rest to `onWritable`
+  auto write(std::string_view data) noexcept -> bool;
+  /// Data in flash is sent without being copied to RAM
+  auto write(iop::StaticString data) noexcept -> bool;
+  /// Sends what is buffered and ends the body. Responses still streaming when the handler returns are ended for it
+  void endResponse() noexcept;
+  /// The handler may return before the streamed body is done, leaving `writer` to write the rest. It's called each time
+  /// the client catches up, and the response ends once it returns false. The next request waits for it
+  void onWritable(Writer writer) noexcept;
+  /// Sends the gzipped asset, or `304 Not Modified` if the client already has this version of it
+  void sendAsset(const StaticAsset &asset) noexcept;
+#if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)
+  /// Sends the file as the body with `sendfile`, without copying it through userspace, as the socket takes it.
+  /// Returns false if it can't be read
+  auto sendFile(uint16_t code, iop::StaticString type, const std::string &path) noexcept -> bool;
+#endif
+
   void setContentLength(size_t length) noexcept;
   void reset() noexcept;
 };
 
 class HttpServer {
-  // TODO: currently we only support one client at a time, this is not thread safe tho
+  // Handlers can't handle other clients while they run, this is not thread safe tho
   bool isHandlingRequest = false;
 public:
   using Callback = std::function<void(HttpConnection&, iop::Log &)>;
 #if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)
 private:
-  std::unordered_map<std::string, Callback> router;
+  Router<Callback> router;
   Callback notFoundHandler;
   uint32_t port;
+  uint8_t workers;
 
-  std::optional<int> maybeFD;
   sockaddr_in *address;
+  // Each one waits on its listening socket and every client at once, so slow clients don't stall the others.
+  // There is one per worker thread, or a single one polled by `handleClient`
+  std::vector<std::unique_ptr<HttpServerLoop>> loops;
+
+  void dispatch(HttpConnection &conn, bool concurrent) noexcept;
+  friend HttpServerLoop;
+public:
+  ~HttpServer() noexcept;
+
+  /// Serves clients from `count` threads instead of `handleClient`, each accepting from its own `SO_REUSEPORT` socket.
+  /// Zero, the default, disables them. Takes effect on the next `begin`.
+  ///
+  /// Route handlers then run concurrently, so they must be thread safe
+  void setWorkers(uint8_t count) noexcept;
 #elif defined(IOP_ESP8266) || defined(IOP_ESP32)
   void *server; // ESP8266WebServer
+  // The WebServer only calls us when it doesn't know the route, so every route is ours
+  Router<Callback> router;
+  Callback notFoundHandler;
+
+  void dispatch() noexcept;
 public:
   HttpServer(HttpServer &other) noexcept = delete;
   HttpServer(HttpServer &&other) noexcept;
@@ -86,6 +185,9 @@ public:
   void begin() noexcept;
   void close() noexcept;
   void handleClient() noexcept;
+  /// Routes are `[METHOD ]/path`, like `POST /plants/:id/events` or `/static/*`, see `Router`.
+  ///
+  /// Registering an existing route replaces its handler
   void on(iop::StaticString uri, Callback handler) noexcept;
   void onNotFound(Callback fn) noexcept;
 };
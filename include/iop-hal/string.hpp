@@ -102,6 +102,9 @@ public:
   auto get() const noexcept -> const __FlashStringHelper * { return this->str; }
 
   auto length() const noexcept -> size_t;
+
+  /// Copies the first `size` characters to a RAM buffer, without allocating. `size` must not exceed `length()`
+  auto copy(char *destination, size_t size) const noexcept -> void;
 };
 
 auto to_view(const std::string& str) -> std::string_view;
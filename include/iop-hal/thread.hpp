@@ -2,8 +2,9 @@
 #define IOP_DRIVER_THREAD
 
 #include <stdint.h>
-#include <unordered_map>
 #include <string_view>
+#include <utility>
+#include <array>
 
 namespace iop {
 namespace time {
@@ -13,15 +14,36 @@ using seconds = uint32_t;
 }
 
 namespace iop_hal {
+/// Fixed capacity list of named memory regions, so measuring memory doesn't allocate
+class MemoryRegions {
+public:
+  using Region = std::pair<std::string_view, uintmax_t>;
+  static constexpr size_t capacity = 4;
+
+private:
+  std::array<Region, capacity> regions;
+  size_t size_;
+
+public:
+  MemoryRegions() noexcept: regions(), size_(0) {}
+
+  /// Regions past the capacity are ignored. The names should have static lifetime
+  auto insert(const Region region) noexcept -> void {
+    if (this->size_ < capacity) this->regions[this->size_++] = region;
+  }
+  auto begin() const noexcept -> const Region * { return this->regions.begin(); }
+  auto end() const noexcept -> const Region * { return this->regions.begin() + this->size_; }
+  auto size() const noexcept -> size_t { return this->size_; }
+};
+
 /// Describes the device's memory state in an instant.
 struct Memory {
   uintmax_t availableStack;
-  // It's a map because some environments have multiple, specialized, RAMs.
-  // This allocation sucks tho. The keys should have static lifetime
-  std::unordered_map<std::string_view, uintmax_t> availableHeap;
-  std::unordered_map<std::string_view, uintmax_t> biggestHeapBlock;
+  // Some environments have multiple, specialized, RAMs.
+  MemoryRegions availableHeap;
+  MemoryRegions biggestHeapBlock;
 
-  Memory(uintmax_t stack, std::unordered_map<std::string_view, uintmax_t> heap, std::unordered_map<std::string_view, uintmax_t> biggestBlock) noexcept:
+  Memory(uintmax_t stack, MemoryRegions heap, MemoryRegions biggestBlock) noexcept:
     availableStack(stack), availableHeap(heap), biggestHeapBlock(biggestBlock) {}
 };
 
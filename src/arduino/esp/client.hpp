@@ -82,6 +82,8 @@ auto networkStatus(const int code) noexcept -> std::optional<iop::NetworkStatus>
   IOP_TRACE();
   switch (code) {
   case 200:
+  // Partial Content, the requested range of the body
+  case 206:
     return iop::NetworkStatus::OK;
   case 500:
   case HTTPC_ERROR_NO_HTTP_SERVER:
@@ -150,9 +152,25 @@ void Session::addHeader(std::string_view key, std::string_view value) noexcept {
   header.concat(key.begin(), key.length());
   this->ctx.http.http->addHeader(header, val);
 }
-void Session::setAuthorization(std::string auth) noexcept {
+void Session::addHeaders(std::string_view block) noexcept {
+  // The core's client only takes headers one at a time
+  while (block.length() > 0) {
+    const auto end = block.find("\r\n");
+    const auto line = block.substr(0, end);
+    block = end == block.npos ? std::string_view() : block.substr(end + 2);
+
+    const auto separator = line.find(':');
+    if (separator == line.npos) continue;
+    auto value = line.substr(separator + 1);
+    while (value.length() > 0 && value[0] == ' ') value.remove_prefix(1);
+    this->addHeader(line.substr(0, separator), value);
+  }
+}
+void Session::setAuthorization(std::string_view auth) noexcept {
   iop_assert(this->ctx.http.http, IOP_STR("Session has been moved out"));
-  this->ctx.http.http->setAuthorization(auth.c_str());
+  String token;
+  token.concat(auth.begin(), auth.length());
+  this->ctx.http.http->setAuthorization(token.c_str());
 }
 
 auto parseHeaders(::HTTPClient & client) noexcept -> std::unordered_map<std::string, std::string> {
@@ -167,6 +185,60 @@ auto parseHeaders(::HTTPClient & client) noexcept -> std::unordered_map<std::str
   return headers;
 }
 
+static auto clientLogger() noexcept -> iop::Log & {
+  static iop::Log logger_(IOP_STR("HTTP Client"));
+  return logger_;
+}
+
+/// Forwards what `::HTTPClient::writeToStream` writes to a `ChunkHandler`, it's never read from
+class ChunkStream : public Stream {
+  const ChunkHandler &handler;
+  size_t maxSize;
+  size_t size;
+
+public:
+  bool tooBig;
+  bool aborted;
+
+  ChunkStream(const ChunkHandler &handler, const size_t maxSize) noexcept: handler(handler), maxSize(maxSize), size(0), tooBig(false), aborted(false) {}
+
+  // Returning less than `length` makes `writeToStream` abort the download
+  auto write(const uint8_t *buffer, const size_t length) -> size_t override {
+    this->size += length;
+    if (this->size > this->maxSize) {
+      this->tooBig = true;
+      return 0;
+    }
+    if (!this->handler(std::string_view(reinterpret_cast<const char*>(buffer), length))) {
+      this->aborted = true;
+      return 0;
+    }
+    return length;
+  }
+  auto write(const uint8_t byte) -> size_t override { return this->write(&byte, 1); }
+  auto available() -> int override { return 0; }
+  auto read() -> int override { return -1; }
+  auto peek() -> int override { return -1; }
+};
+
+static auto readBody(::HTTPClient &http, const size_t maxSize, const ChunkHandler &handler) noexcept -> iop::NetworkStatus {
+  IOP_TRACE();
+  // Bails out before downloading anything, so big bodies can't make us run out of memory
+  const auto contentLength = http.getSize();
+  if (contentLength > 0 && static_cast<size_t>(contentLength) > maxSize) {
+    clientLogger().error(IOP_STR("Payload from server was too big: "));
+    clientLogger().errorln(static_cast<uint64_t>(contentLength));
+    return iop::NetworkStatus::BROKEN_SERVER;
+  }
+
+  auto stream = ChunkStream(handler, maxSize);
+  const auto result = http.writeToStream(&stream);
+  if (stream.tooBig) return iop::NetworkStatus::BROKEN_SERVER;
+  if (stream.aborted) return iop::NetworkStatus::BROKEN_CLIENT;
+  if (result < 0) return networkStatus(result).value_or(iop::NetworkStatus::IO_ERROR);
+  return iop::NetworkStatus::OK;
+}
+
 auto Session::sendRequest(const std::string method, const std::string_view data) noexcept -> Response {
   IOP_TRACE();
 
@@ -177,14 +249,33 @@ auto Session::sendRequest(const std::string method, const std::string_view data)
     return Response(code);
   }
 
-  const auto headers = parseHeaders(*this->ctx.http.http);
-  const auto httpString = this->ctx.http.http->getString();
+  auto *http = this->ctx.http.http;
+  const auto reader = [http](const size_t maxSize, const ChunkHandler &handler) {
+    return readBody(*http, maxSize, handler);
+  };
+  const auto size = http->getSize();
+  return Response(parseHeaders(*http), reader, size < 0 ? std::nullopt : std::make_optional(static_cast<size_t>(size)), code);
+}
+
+auto Session::sendRequests(const std::vector<PipelinedRequest> &requests, const size_t maxSize, const std::function<void(Session &)> &prepare) noexcept -> std::vector<Response> {
+  IOP_TRACE();
+  iop_assert(this->ctx.http.http, IOP_STR("Session has been moved out"));
 
-  auto storage = std::vector<uint8_t>();
-  storage.insert(storage.end(), httpString.c_str(), httpString.c_str() + httpString.length());
+  std::vector<Response> responses;
+  responses.reserve(requests.size());
+  for (const auto &request : requests) {
+    // A path keeps the connection, but the headers are cleared
+    String path;
+    path.concat(request.path.begin(), request.path.length());
+    this->ctx.http.http->setURL(path);
+    if (prepare) prepare(*this);
+    this->addHeaders(request.headers);
 
-  const auto response = Response(headers, Payload(storage), code);
-  return response;
+    auto response = this->sendRequest(std::string(request.method), request.data);
+    if (!response.preload(maxSize)) response = Response(iop::NetworkStatus::BROKEN_SERVER);
+    responses.push_back(std::move(response));
+  }
+  return responses;
 }
 
 HTTPClient::HTTPClient() noexcept: http(new (std::nothrow) ::HTTPClient()) {
@@ -245,13 +336,48 @@ auto HTTPClient::begin(const std::string_view uri, std::function<Response(Sessio
   if (this->http->begin(*static_cast<NetworkClient*>(iop::wifi.client), uriArduino)) {
     auto ctx = SessionContext(*this, uri);
     auto session = Session(ctx);
-    const auto ret = func(session);
+    auto ret = func(session);
+    // Lazy bodies reference this connection, so they can't leave this scope
+    ret.detach();
     this->http->end();
     return ret;
   }
 
   return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
 }
+/// The core's client blocks through DNS, TLS and the whole request, so it isn't left for the runtime to run between
+/// `iop_hal::loop` runs, where it would freeze the loop unexpectedly. `beginAsync` runs it, the handle is always done
+class AsyncContext {
+public:
+  Response result;
+
+  explicit AsyncContext(Response result) noexcept: result(std::move(result)) {}
+
+  auto done() const noexcept -> bool { return true; }
+  auto take() noexcept -> Response { return std::move(this->result); }
+  auto poll() noexcept -> bool { return true; }
+};
+
+auto HTTPClient::beginAsync(const std::string_view uri, const std::string_view method, const std::string_view data, const size_t maxSize, std::function<void(Session &)> prepare, std::function<Response(Response &)> process) noexcept -> AsyncRequest {
+  const auto methodStr = std::string(method);
+  auto response = this->begin(uri, [&](Session &session) {
+    if (prepare) prepare(session);
+    auto response = session.sendRequest(methodStr, data);
+    if (process) return process(response);
+    if (!response.preload(maxSize)) return Response(iop::NetworkStatus::BROKEN_SERVER);
+    return response;
+  });
+  auto ctx = std::unique_ptr<AsyncContext>(new (std::nothrow) AsyncContext(std::move(response)));
+  iop_assert(ctx, IOP_STR("OOM"));
+  return AsyncRequest(std::move(ctx));
+}
+
+/// Requests are done before their handles exist, there are no sockets to wait for
+static void waitForRequests(const std::vector<AsyncContext *> &requests, const iop::time::milliseconds timeout) noexcept {
+  (void) requests;
+  (void) timeout;
+}
+
 HTTPClient::HTTPClient(HTTPClient &&other) noexcept: http(other.http) {
   other.http = nullptr;
 }
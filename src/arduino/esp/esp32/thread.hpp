@@ -9,13 +9,10 @@ auto Thread::abort() const noexcept -> void {
 }
 
 auto Thread::availableMemory() const noexcept -> Memory {
-  static std::unordered_map<std::string_view, uintmax_t> heap;
-  static std::unordered_map<std::string_view, uintmax_t> biggestBlock;
+  MemoryRegions heap;
+  MemoryRegions biggestBlock;
 
   // TODO: get IRAM
-  heap.clear();
-  biggestBlock.clear();
-
   {
     heap.insert({ std::string_view("DRAM"), ESP.getFreeHeap() });
     biggestBlock.insert({ std::string_view("DRAM"), ESP.getMaxAllocHeap() });
@@ -12,11 +12,8 @@ auto Thread::abort() const noexcept -> void {
 }
 
 auto Thread::availableMemory() const noexcept -> Memory {
-  static std::unordered_map<std::string_view, uintmax_t> heap;
-  static std::unordered_map<std::string_view, uintmax_t> biggestBlock;
-
-  heap.clear();
-  biggestBlock.clear();
+  MemoryRegions heap;
+  MemoryRegions biggestBlock;
 
   umm_info(NULL, false);
 
@@ -31,7 +28,7 @@ auto Thread::availableMemory() const noexcept -> Memory {
     HeapSelectIram _guard;
     const auto free = umm_free_heap_size_core(umm_get_current_heap());
     heap.insert({ "IRAM", free });
-    biggestBlock.insert({ "DRAM", ESP.getMaxFreeBlockSize() });
+    biggestBlock.insert({ "IRAM", ESP.getMaxFreeBlockSize() });
   }
 #endif
 
@@ -1,5 +1,6 @@
 #include "iop-hal/server.hpp"
 #include "iop-hal/panic.hpp"
+#include "cpp17/http_parser.hpp"
 
 #ifdef IOP_ESP8266
 #include "ESP8266WebServer.h"
@@ -23,10 +24,23 @@ auto to_server(void *ptr) noexcept -> WebServer & {
   return *reinterpret_cast<WebServer *>(ptr);
 }
 
-HttpConnection::HttpConnection(void * parent) noexcept: server(parent) {}
+HttpConnection::HttpConnection(void * parent) noexcept: server(parent), currentBody() {}
 auto HttpConnection::arg(iop::StaticString arg) const noexcept -> std::optional<std::string> {
-  if (!to_server(this->server).hasArg(arg.get())) return std::nullopt;
-  return std::string(to_server(this->server).arg(arg.get()).c_str());
+  auto &server = to_server(this->server);
+  // The WebServer parses query strings, urlencoded and multipart bodies
+  if (server.hasArg(arg.get())) return std::string(server.arg(arg.get()).c_str());
+
+  if (!this->currentArgsIndexed) {
+    this->currentArgsIndexed = true;
+    if (server.hasArg(IOP_STR("plain").get())) {
+      this->currentBody = server.arg(IOP_STR("plain").get()).c_str();
+      this->currentArgs.json(this->currentBody.data(), this->currentBody.length());
+    }
+  }
+  const auto name = arg.toString();
+  const auto value = this->currentArgs.get(name);
+  if (!value) return std::nullopt;
+  return std::string(*value);
 }
 void HttpConnection::sendHeader(iop::StaticString name, iop::StaticString value) noexcept {
   to_server(this->server).sendHeader(String(name.get()), String(value.get()));
@@ -39,11 +53,95 @@ void HttpConnection::sendData(iop::StaticString data) const noexcept {
 }
 void HttpConnection::setContentLength(size_t length) noexcept {
   to_server(this->server).setContentLength(length);
+  this->currentContentLengthKnown = true;
+}
+
+// Streamed data is copied here until it's worth a TCP write, RAM is scarce so it's kept small
+constexpr size_t streamBufferSize = 256;
+
+static auto flushStream(HttpConnection &conn, WebServer &server) noexcept -> bool {
+  if (conn.currentStream.length() > 0) server.sendContent(conn.currentStream.data(), conn.currentStream.length());
+  conn.currentStream.clear();
+  return server.client().connected();
+}
+void HttpConnection::beginResponse(uint16_t code, iop::StaticString type) noexcept {
+  iop_assert(!this->streaming, IOP_STR("Response already started"));
+  auto &server = to_server(this->server);
+  // The WebServer sends the body in chunks if the length is unknown
+  if (!this->currentContentLengthKnown) server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(code, String(type.get()), String());
+  this->streaming = true;
+}
+auto HttpConnection::write(std::string_view data) noexcept -> bool {
+  iop_assert(this->streaming, IOP_STR("Response not started"));
+  auto &server = to_server(this->server);
+  if (this->currentStream.length() + data.length() <= streamBufferSize) {
+    this->currentStream.append(data);
+    return server.client().connected();
+  }
+  if (!flushStream(*this, server)) return false;
+  server.sendContent(data.data(), data.length());
+  return server.client().connected();
+}
+auto HttpConnection::write(iop::StaticString data) noexcept -> bool {
+  iop_assert(this->streaming, IOP_STR("Response not started"));
+  auto &server = to_server(this->server);
+  if (!flushStream(*this, server)) return false;
+  // Sent straight from flash
+  server.sendContent_P(data.asCharPtr());
+  return server.client().connected();
+}
+void HttpConnection::endResponse() noexcept {
+  iop_assert(this->streaming, IOP_STR("Response not started"));
+  auto &server = to_server(this->server);
+  this->streaming = false;
+  flushStream(*this, server);
+  // Empty chunk, signaling the end of the body
+  if (!this->currentContentLengthKnown) server.sendContent("", 0);
+}
+void HttpConnection::onWritable(Writer writer) noexcept {
+  iop_assert(this->streaming, IOP_STR("Response not started"));
+  // The WebServer's writes block until the client takes them, so the rest is written right away
+  while (to_server(this->server).client().connected() && writer(*this)) {}
+}
+void HttpConnection::sendAsset(const StaticAsset &asset) noexcept {
+  auto &server = to_server(this->server);
+  // Browsers revalidate their copy every time, it's cheap as the asset only changes with the firmware
+  server.sendHeader(String(IOP_STR("ETag").get()), String(asset.etag.get()));
+  server.sendHeader(String(IOP_STR("Cache-Control").get()), String(IOP_STR("no-cache").get()));
+  if (server.hasHeader(IOP_STR("If-None-Match").get())) {
+    const auto ifNoneMatch = server.header(IOP_STR("If-None-Match").get());
+    if (etagMatches(std::string_view(ifNoneMatch.c_str(), ifNoneMatch.length()), asset.etag.toString())) {
+      server.send(304);
+      return;
+    }
+  }
+
+  // Every browser accepts gzip, so `Accept-Encoding` isn't checked
+  server.sendHeader(String(IOP_STR("Content-Encoding").get()), String(IOP_STR("gzip").get()));
+  server.send_P(200, asset.contentType.asCharPtr(), reinterpret_cast<PGM_P>(asset.data), asset.length);
 }
 void HttpConnection::reset() noexcept {}
 
 static uint32_t serverPort = 0;
-HttpServer::HttpServer(uint32_t port) noexcept { serverPort = port; }
+HttpServer::HttpServer(uint32_t port) noexcept: server(nullptr), router(), notFoundHandler() {
+  serverPort = port;
+  this->notFoundHandler = [](HttpConnection &conn, iop::Log const &logger) {
+    conn.send(404, IOP_STR("text/plain"), IOP_STR("Not Found"));
+    (void) logger;
+  };
+}
+
+static auto methodName(const HTTPMethod method) noexcept -> std::string_view {
+  if (method == HTTP_GET) return "GET";
+  if (method == HTTP_POST) return "POST";
+  if (method == HTTP_PUT) return "PUT";
+  if (method == HTTP_PATCH) return "PATCH";
+  if (method == HTTP_DELETE) return "DELETE";
+  if (method == HTTP_OPTIONS) return "OPTIONS";
+  if (method == HTTP_HEAD) return "HEAD";
+  return "";
+}
 
 auto validateServer(void **ptr) noexcept -> WebServer & {
   if (!*ptr) {
@@ -54,29 +152,65 @@ auto validateServer(void **ptr) noexcept -> WebServer & {
   iop_assert(*ptr, IOP_STR("Unable to allocate WebServer"));
   return to_server(*ptr);
 }
-HttpConnection::HttpConnection(HttpConnection &&other) noexcept: server(other.server) {
+// The arguments index points into the body, that may move, so it's rebuilt when needed
+HttpConnection::HttpConnection(HttpConnection &&other) noexcept: server(other.server), currentBody(), currentContentLengthKnown(other.currentContentLengthKnown), currentParams(other.currentParams), currentStream(std::move(other.currentStream)), streaming(other.streaming) {
   other.server = nullptr;
+  other.streaming = false;
 }
 auto HttpConnection::operator=(HttpConnection &&other) noexcept -> HttpConnection & {
   this->server = other.server;
+  this->currentParams = other.currentParams;
+  this->currentBody.clear();
+  this->currentArgs.clear();
+  this->currentArgsIndexed = false;
+  this->currentContentLengthKnown = other.currentContentLengthKnown;
+  this->currentStream = std::move(other.currentStream);
+  this->streaming = other.streaming;
   other.server = nullptr;
+  other.streaming = false;
   return *this;
 }
 HttpConnection::~HttpConnection() noexcept {
   //delete reinterpret_cast<WebServer *>(this->server);
 }
-HttpServer::HttpServer(HttpServer &&other) noexcept: server(other.server) {
+HttpServer::HttpServer(HttpServer &&other) noexcept: server(other.server), router(std::move(other.router)), notFoundHandler(std::move(other.notFoundHandler)) {
   other.server = nullptr;
+  // The hook points to the old object
+  if (this->server) to_server(this->server).onNotFound([this]() { this->dispatch(); });
 }
 auto HttpServer::operator=(HttpServer &&other) noexcept -> HttpServer & {
   this->server = other.server;
+  this->router = std::move(other.router);
+  this->notFoundHandler = std::move(other.notFoundHandler);
   other.server = nullptr;
+  if (this->server) to_server(this->server).onNotFound([this]() { this->dispatch(); });
   return *this;
 }
 HttpServer::~HttpServer() noexcept {
   delete reinterpret_cast<WebServer *>(this->server);
 }
-void HttpServer::begin() noexcept { IOP_TRACE(); validateServer(&this->server).begin(); }
+void HttpServer::dispatch() noexcept {
+  auto &server = to_server(this->server);
+  // Parameters point into it, so it must outlive the handler
+  const String uri = server.uri();
+  HttpConnection conn(this->server);
+  if (const auto *handler = this->router.find(methodName(server.method()), std::string_view(uri.c_str(), uri.length()), conn.currentParams)) {
+    (*handler)(conn, logger());
+  } else {
+    this->notFoundHandler(conn, logger());
+  }
+  if (conn.streaming) conn.endResponse();
+}
+void HttpServer::begin() noexcept {
+  IOP_TRACE();
+  auto &server = validateServer(&this->server);
+  // Routes aren't registered in the WebServer, so every request ends up here
+  server.onNotFound([this]() { this->dispatch(); });
+  // The WebServer only keeps the request headers it's told to, static assets are revalidated with this one
+  static const char *headers[] = { "If-None-Match" };
+  server.collectHeaders(headers, 1);
+  server.begin();
+}
 void HttpServer::close() noexcept { IOP_TRACE(); validateServer(&this->server).close(); }
 void HttpServer::handleClient() noexcept {
   IOP_TRACE();
@@ -87,13 +221,12 @@ void HttpServer::handleClient() noexcept {
 }
 void HttpServer::on(iop::StaticString uri, Callback handler) noexcept {
   IOP_TRACE();
-  auto *_server = &iop_hal::validateServer(&this->server);
-  validateServer(&this->server).on(uri.get(), [handler, _server]() { HttpConnection conn(_server); handler(conn, logger()); });
+  const auto inserted = this->router.insert(uri.toString(), std::move(handler));
+  iop_assert(inserted, IOP_STR("Invalid route"));
 }
 void HttpServer::onNotFound(Callback handler) noexcept {
   IOP_TRACE();
-  auto *_server = &iop_hal::validateServer(&this->server);
-  validateServer(&this->server).onNotFound([handler, _server]() { HttpConnection conn(_server); handler(conn, logger()); });
+  this->notFoundHandler = std::move(handler);
 }
 CaptivePortal::CaptivePortal(CaptivePortal &&other) noexcept: server(other.server) {
   other.server = nullptr;
@@ -1,71 +1,153 @@
 #include "iop-hal/update.hpp"
 #include "iop-hal/client.hpp"
+#include "iop-hal/device.hpp"
 #include "iop-hal/panic.hpp"
 #include "iop-hal/network.hpp"
+#include "cpp17/delta.hpp"
 
-#include <memory>
+#include <algorithm>
+#include <optional>
+#include <cctype>
+#include <array>
 
 #ifdef IOP_ESP8266
 #include "ESP8266WiFi.h"
-#ifdef IOP_SSL
-using NetworkClient = BearSSL::WiFiClientSecure;
-#else
-using NetworkClient = WiFiClient;
-#endif
-#include "ESP8266httpUpdate.h"
-using HTTPUpdate = ESP8266HTTPUpdate;
+#include "Updater.h"
 #elif defined(IOP_ESP32)
-#include "HTTPUpdate.h"
-using NetworkClient = WiFiClient;
+#include "Update.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
 #else
 #error "Non supported arduino based update device"
 #endif
 
 
 namespace iop_hal {
-auto Update::run(iop::Network &network, const iop::StaticString path, const std::string_view authorization_header) noexcept -> iop_hal::UpdateStatus {
-  auto *client = static_cast<NetworkClient*>(iop::wifi.client);
-  iop_assert(client, IOP_STR("Wifi has been moved out, client is nullptr"));
-
-  auto route = String();
-  route.concat(network.uri().toString().c_str(), network.uri().length());
-  route.concat(path.toString().c_str(), path.length());
-
-  auto ESPhttpUpdate = std::unique_ptr<HTTPUpdate>(new (std::nothrow) HTTPUpdate());
-  iop_assert(ESPhttpUpdate, IOP_STR("Unable to allocate HTTPUpdate"));
-  ESPhttpUpdate->rebootOnUpdate(true);
+// Deltas that fail to apply aren't requested again until reboot, so the server sends the full image
+static bool deltaFailed = false;
 
+/// Reads the running firmware, the source of deltas
+static auto readFirmware(const size_t offset, uint8_t *buffer, const size_t length) noexcept -> bool {
 #ifdef IOP_ESP8266
-  //ESPhttpUpdate->setLedPin(LED_BUILTIN);
-  ESPhttpUpdate->setAuthorization(std::string(authorization_header).c_str());
-  ESPhttpUpdate->closeConnectionsOnUpdate(true);
-  const auto result = ESPhttpUpdate->update(*client, route, "");
+  // Flash reads must be 4 bytes aligned
+  std::array<uint32_t, 16> aligned;
+  size_t done = 0;
+  while (done < length) {
+    const auto position = offset + done;
+    const auto start = position & ~static_cast<size_t>(3);
+    const auto skip = position - start;
+    const auto size = std::min(length - done, sizeof(aligned) - skip);
+    if (!ESP.flashRead(start, aligned.data(), (skip + size + 3) & ~static_cast<size_t>(3))) return false;
+    memcpy(buffer + done, reinterpret_cast<const uint8_t*>(aligned.data()) + skip, size);
+    done += size;
+  }
+  return true;
 #elif defined(IOP_ESP32)
-  ::HTTPClient http;
-  if (!http.begin(*client, route)) {
-    return iop_hal::UpdateStatus::IO_ERROR;
+  const auto *partition = esp_ota_get_running_partition();
+  return partition && esp_partition_read(partition, offset, buffer, length) == ESP_OK;
+#endif
+}
+
+/// Starts writing the new firmware to the OTA partition, the core's Updater checks its MD5 when it ends
+static auto beginFirmware(iop::Network &network, const size_t size, const std::optional<std::string> &md5) noexcept -> bool {
+  // Unverified images are never installed, checked before beginning as it erases the OTA partition
+  if (!md5 || md5->length() != 32) {
+    network.logger().errorln(IOP_STR("Server didn't send the firmware MD5, unable to verify it"));
+    return false;
   }
-  http.setAuthorization(std::string(authorization_header).c_str());
-  const auto result = ESPhttpUpdate->update(http, "");
+  if (!::Update.begin(size)) {
+    network.logger().error(IOP_STR("Unable to begin update: "));
+    network.logger().errorln(static_cast<uint64_t>(::Update.getError()));
+    return false;
+  }
+
+  // The updater compares it with a lowercase hex digest
+  auto lowercase = *md5;
+  std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(), [](unsigned char c){ return std::tolower(c); });
+  ::Update.setMD5(lowercase.c_str());
+  return true;
+}
+
+static auto abortFirmware() noexcept -> void {
+#ifdef IOP_ESP32
+  ::Update.abort();
 #else
-  #error "Non supported arduino based update device"
+  // Ending an incomplete update discards it
+  ::Update.end();
 #endif
+}
 
-switch (result) {
-  case HTTP_UPDATE_NO_UPDATES:
-  case HTTP_UPDATE_OK:
-    return iop_hal::UpdateStatus::NO_UPGRADE;
+auto Update::run(iop::Network &network, const iop::StaticString path, const std::string_view authorization_header) noexcept -> iop_hal::UpdateStatus {
+  // Downloads can't be resumed here, the core's Updater erases the OTA partition when it begins and has no offset support
+  auto began = false;
+  auto writeFailed = false;
+  auto applier = std::optional<DeltaApplier>();
+
+  const auto write = [&writeFailed](const std::string_view data) {
+    const auto written = ::Update.write(reinterpret_cast<uint8_t*>(const_cast<char*>(data.data())), data.length());
+    writeFailed = written != data.length();
+    return !writeFailed;
+  };
+
+  auto options = iop::StreamOptions();
+  options.accept = deltaFailed ? "application/octet-stream" : firmwareAccept;
+  options.inspect = [&](const iop_hal::Response &response) {
+    const auto latest = response.header(IOP_STR("LATEST_VERSION"));
+    const auto contentType = response.header(IOP_STR("Content-Type"));
+    if (!contentType || !isDeltaContentType(*contentType)) {
+      // Chunked responses have no length, so we reserve the whole partition
+      began = beginFirmware(network, response.contentLength().value_or(ESP.getFreeSketchSpace()), latest);
+      return began;
+    }
+
+    // The OTA partition is only prepared once the delta header reports the size of the new firmware
+    const auto onHeader = [&network, &began, latest](const size_t size, const iop::MD5Hash &md5) {
+      if (latest && (latest->length() != md5.size() || strncasecmp(latest->c_str(), md5.data(), md5.size()) != 0)) return false;
+      began = beginFirmware(network, size, std::string(iop::to_view(md5)));
+      return began;
+    };
+    applier.emplace(readFirmware, write, ESP.getSketchSize(), iop_hal::device.firmwareMD5(), onHeader);
+    return true;
+  };
+
+  const auto handler = [&applier, &write](const std::string_view chunk) {
+    if (applier) return applier->feed(chunk);
+    return write(chunk);
+  };
+  const auto response = network.httpStream(iop::HttpMethod::GET, authorization_header, path, std::string_view(), ESP.getFreeSketchSpace(), handler, options);
+
+  const auto status = response.status();
+  const auto deltaBroken = applier && !writeFailed && applier->state() != DeltaApplier::State::DONE;
+  if (!status || *status != iop::NetworkStatus::OK || deltaBroken || writeFailed) {
+    if (began) abortFirmware();
+
+    if (response.code() == 304) return iop_hal::UpdateStatus::NO_UPGRADE;
+    if (status == iop::NetworkStatus::UNAUTHORIZED) return iop_hal::UpdateStatus::UNAUTHORIZED;
 
-  case HTTP_UPDATE_FAILED:
-    // TODO(pc): properly handle ESPhttpUpdate.getLastError()
+    if (deltaBroken && status == iop::NetworkStatus::BROKEN_CLIENT) {
+      network.logger().errorln(IOP_STR("Unable to apply firmware delta"));
+      deltaFailed = true;
+      return iop_hal::UpdateStatus::BROKEN_SERVER;
+    } else if (writeFailed) {
+      network.logger().error(IOP_STR("Unable to write firmware: "));
+      network.logger().errorln(static_cast<uint64_t>(::Update.getError()));
+      return iop_hal::UpdateStatus::IO_ERROR;
+    }
+
+    network.logger().error(IOP_STR("Update failed: "));
+    network.logger().errorln(response.code());
+    return status == iop::NetworkStatus::IO_ERROR ? iop_hal::UpdateStatus::IO_ERROR : iop_hal::UpdateStatus::BROKEN_SERVER;
+  }
+
+  // Validates the MD5 and marks the new firmware to be booted, the size is only known upfront for non chunked full images
+  if (!::Update.end(true)) {
     network.logger().error(IOP_STR("Update failed: "));
-    network.logger().errorln(std::string_view(ESPhttpUpdate->getLastErrorString().c_str()));
+    network.logger().errorln(static_cast<uint64_t>(::Update.getError()));
     return iop_hal::UpdateStatus::BROKEN_SERVER;
-}
+  }
 
-// TODO(pc): properly handle ESPhttpUpdate.getLastError()
-network.logger().error(IOP_STR("Update failed (UNKNOWN): "));
-network.logger().errorln(std::string_view(ESPhttpUpdate->getLastErrorString().c_str()));
-return iop_hal::UpdateStatus::BROKEN_SERVER;
+  network.logger().infoln(IOP_STR("Upgrading firmware"));
+  ESP.restart();
+  return iop_hal::UpdateStatus::NO_UPGRADE;
 }
-} // namespace iop_hal
\ No newline at end of file
+} // namespace iop_hal
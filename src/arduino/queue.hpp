@@ -0,0 +1,26 @@
+#include "iop-hal/queue.hpp"
+#include "iop-hal/storage.hpp"
+
+namespace iop_hal {
+/// The region must fit the storage the user set up
+auto PersistentQueue::load() noexcept -> bool {
+  return storage.get(this->address + this->capacity - 1).has_value();
+}
+
+auto PersistentQueue::readBytes(const size_t offset, uint8_t *output, const size_t length) const noexcept -> void {
+  for (size_t index = 0; index < length; ++index) {
+    output[index] = storage.get(this->address + offset + index).value_or(0);
+  }
+}
+
+auto PersistentQueue::writeBytes(const size_t offset, const uint8_t *input, const size_t length) noexcept -> void {
+  for (size_t index = 0; index < length; ++index) {
+    storage.set(this->address + offset + index, input[index]);
+  }
+}
+
+/// Commits the whole storage, as the EEPROM emulation writes entire flash sectors anyway
+auto PersistentQueue::persist() noexcept -> bool {
+  return storage.commit();
+}
+}
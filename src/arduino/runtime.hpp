@@ -1,4 +1,5 @@
 #include "iop-hal/runtime.hpp"
+#include "iop-hal/client.hpp"
 
 #include <Arduino.h>
 
@@ -8,4 +9,5 @@ void setup() {
 
 void loop() {
     iop_hal::loop();
+    iop_hal::HTTPClient::poll(0);
 }
\ No newline at end of file
@@ -9,4 +9,5 @@ auto StaticString::toString() const noexcept -> std::string {
   return msg;
 }
 auto StaticString::length() const noexcept -> size_t { return strlen_P(this->asCharPtr()); }
+auto StaticString::copy(char *destination, const size_t size) const noexcept -> void { memcpy_P(destination, this->asCharPtr(), size); }
 }
\ No newline at end of file
@@ -8,4 +8,110 @@
 #include "noop/client.hpp"
 #else
 #error "Target not supported"
-#endif
\ No newline at end of file
+#endif
+
+#include "iop-hal/panic.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace iop_hal {
+auto Response::stream(const size_t maxSize, const ChunkHandler &handler) noexcept -> iop::NetworkStatus {
+  IOP_TRACE();
+  if (this->reader) {
+    auto reader = std::move(this->reader);
+    this->reader = nullptr;
+    return reader(maxSize, handler);
+  }
+
+  // Eager bodies are yielded at once
+  if (!this->promise) return iop::NetworkStatus::OK;
+  const auto payload = std::move(this->promise->payload);
+  this->promise.reset();
+  if (payload.size() > maxSize) return iop::NetworkStatus::BROKEN_SERVER;
+  if (payload.size() > 0 && !handler(iop::to_view(payload))) return iop::NetworkStatus::BROKEN_CLIENT;
+  return iop::NetworkStatus::OK;
+}
+
+auto Response::await(const size_t maxSize) noexcept -> std::optional<Payload> {
+  IOP_TRACE();
+  // Already downloaded, no need to copy it
+  if (!this->reader) {
+    auto payload = std::move(this->promise).value_or(Payload());
+    this->promise.reset();
+    if (payload.payload.size() > maxSize) return std::nullopt;
+    return payload;
+  }
+
+  auto storage = std::vector<uint8_t>();
+  if (this->contentLength_) storage.reserve(std::min(*this->contentLength_, maxSize));
+  const auto status = this->stream(maxSize, [&storage](const std::string_view chunk) {
+    storage.insert(storage.end(), chunk.begin(), chunk.end());
+    return true;
+  });
+  if (status != iop::NetworkStatus::OK) return std::nullopt;
+  return Payload(std::move(storage));
+}
+
+auto Response::await() noexcept -> Payload {
+  return this->await(defaultMaxPayloadSize).value_or(Payload());
+}
+
+auto Response::preload(const size_t maxSize) noexcept -> bool {
+  IOP_TRACE();
+  if (!this->reader) return !this->promise || this->promise->payload.size() <= maxSize;
+  auto payload = this->await(maxSize);
+  if (!payload) return false;
+  this->promise = std::move(payload);
+  return true;
+}
+
+// Requests in flight, so the runtime can progress them even if their owners aren't polling
+static std::vector<AsyncContext *> inFlight;
+
+static void forget(const AsyncContext *ctx) noexcept {
+  const auto it = std::find(inFlight.begin(), inFlight.end(), ctx);
+  if (it != inFlight.end()) inFlight.erase(it);
+}
+
+AsyncRequest::AsyncRequest(std::unique_ptr<AsyncContext> context) noexcept: ctx(std::move(context)) {
+  if (this->ctx && !this->ctx->done()) inFlight.push_back(this->ctx.get());
+}
+AsyncRequest::AsyncRequest(AsyncRequest &&other) noexcept: ctx(std::move(other.ctx)) {}
+auto AsyncRequest::operator=(AsyncRequest &&other) noexcept -> AsyncRequest & {
+  forget(this->ctx.get());
+  this->ctx = std::move(other.ctx);
+  return *this;
+}
+AsyncRequest::~AsyncRequest() noexcept {
+  forget(this->ctx.get());
+}
+auto AsyncRequest::poll() noexcept -> bool {
+  IOP_TRACE();
+  if (!this->ctx) return true;
+  const auto done = this->ctx->poll();
+  if (done) forget(this->ctx.get());
+  return done;
+}
+auto AsyncRequest::response() noexcept -> Response {
+  IOP_TRACE();
+  iop_assert(this->ctx, IOP_STR("Response already taken"));
+  iop_assert(this->ctx->done(), IOP_STR("Request still in flight"));
+  forget(this->ctx.get());
+  auto response = this->ctx->take();
+  this->ctx.reset();
+  return response;
+}
+auto HTTPClient::poll(const iop::time::milliseconds timeout) noexcept -> void {
+  IOP_TRACE();
+  for (auto it = inFlight.begin(); it != inFlight.end();) {
+    if ((*it)->poll()) {
+      it = inFlight.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  waitForRequests(inFlight, timeout);
+  inFlight.erase(std::remove_if(inFlight.begin(), inFlight.end(), [](const AsyncContext *ctx) { return ctx->done(); }), inFlight.end());
+}
+}
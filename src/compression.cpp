@@ -0,0 +1,21 @@
+#if (defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)) && defined(IOP_ZLIB)
+#include "posix/compression.hpp"
+#elif defined(IOP_LINUX_MOCK) || defined(IOP_LINUX) || defined(IOP_ESP8266) || defined(IOP_ESP32) || defined(IOP_NOOP)
+#include "cpp17/deflate.hpp"
+#else
+#error "Target not supported"
+#endif
+
+#include "iop-hal/panic.hpp"
+
+namespace iop_hal {
+auto contentEncodingName(const ContentEncoding encoding) noexcept -> iop::StaticString {
+  switch (encoding) {
+  case ContentEncoding::GZIP:
+    return IOP_STR("gzip");
+  case ContentEncoding::DEFLATE:
+    return IOP_STR("deflate");
+  }
+  iop_panic(IOP_STR("Invalid content encoding"));
+}
+}
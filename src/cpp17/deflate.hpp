@@ -0,0 +1,197 @@
+#ifndef IOP_CPP17_DEFLATE_HPP
+#define IOP_CPP17_DEFLATE_HPP
+
+#include "iop-hal/compression.hpp"
+#include "iop-hal/panic.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdint.h>
+
+namespace iop_hal {
+#if defined(IOP_ESP8266) || defined(IOP_ESP32)
+// Matches can reach 2KB back, the hash table takes 2KB of heap while compressing
+constexpr size_t deflateWindowBits = 11;
+constexpr size_t deflateHashBits = 9;
+#else
+// Deflate's full 32KB window
+constexpr size_t deflateWindowBits = 15;
+constexpr size_t deflateHashBits = 14;
+#endif
+constexpr size_t deflateMinMatch = 3;
+constexpr size_t deflateMaxMatch = 258;
+
+constexpr static uint16_t deflateLengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+constexpr static uint8_t deflateLengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+constexpr static uint16_t deflateDistanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+constexpr static uint8_t deflateDistanceExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/// Deflate's bit stream is packed from the least significant bit, Huffman codes from their most significant one (RFC 1951)
+class BitWriter {
+  std::string &output;
+  uint32_t bits;
+  uint8_t count;
+
+public:
+  explicit BitWriter(std::string &output) noexcept: output(output), bits(0), count(0) {}
+
+  auto write(const uint32_t value, const uint8_t length) noexcept -> void {
+    this->bits |= value << this->count;
+    this->count = static_cast<uint8_t>(this->count + length);
+    while (this->count >= 8) {
+      this->output.push_back(static_cast<char>(this->bits & 0xFF));
+      this->bits >>= 8;
+      this->count = static_cast<uint8_t>(this->count - 8);
+    }
+  }
+
+  auto writeCode(const uint32_t code, const uint8_t length) noexcept -> void {
+    uint32_t reversed = 0;
+    for (uint8_t index = 0; index < length; ++index) reversed |= ((code >> index) & 1) << (length - 1 - index);
+    this->write(reversed, length);
+  }
+
+  auto flush() noexcept -> void {
+    if (this->count > 0) this->output.push_back(static_cast<char>(this->bits & 0xFF));
+    this->bits = 0;
+    this->count = 0;
+  }
+};
+
+/// Fixed Huffman code of a literal/length symbol
+inline auto writeDeflateSymbol(BitWriter &writer, const uint16_t symbol) noexcept -> void {
+  if (symbol < 144) {
+    writer.writeCode(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    writer.writeCode(0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    writer.writeCode(symbol - 256, 7);
+  } else {
+    writer.writeCode(0xC0 + symbol - 280, 8);
+  }
+}
+
+inline auto writeDeflateMatch(BitWriter &writer, const size_t length, const size_t distance) noexcept -> void {
+  uint8_t code = sizeof(deflateLengthBase) / sizeof(deflateLengthBase[0]) - 1;
+  while (deflateLengthBase[code] > length) code--;
+  writeDeflateSymbol(writer, static_cast<uint16_t>(257 + code));
+  writer.write(static_cast<uint32_t>(length - deflateLengthBase[code]), deflateLengthExtra[code]);
+
+  code = sizeof(deflateDistanceBase) / sizeof(deflateDistanceBase[0]) - 1;
+  while (deflateDistanceBase[code] > distance) code--;
+  writer.writeCode(code, 5);
+  writer.write(static_cast<uint32_t>(distance - deflateDistanceBase[code]), deflateDistanceExtra[code]);
+}
+
+/// Raw deflate stream: a single block with the fixed Huffman codes, matches are found by a one probe hash table.
+/// Its ratio is below zlib's, but there is no tree to build and memory use is only the hash table
+inline auto deflateRaw(const std::string_view data, std::string &output) noexcept -> bool {
+  constexpr uint32_t empty = UINT32_MAX;
+  std::unique_ptr<uint32_t[]> head(new (std::nothrow) uint32_t[1 << deflateHashBits]);
+  if (!head) return false;
+  std::fill(head.get(), head.get() + (1 << deflateHashBits), empty);
+
+  const auto *bytes = reinterpret_cast<const uint8_t *>(data.data());
+  const auto hash = [bytes](const size_t position) {
+    const uint32_t value = static_cast<uint32_t>(bytes[position]) << 16 | static_cast<uint32_t>(bytes[position + 1]) << 8 | bytes[position + 2];
+    return (value * 2654435761U) >> (32 - deflateHashBits);
+  };
+
+  BitWriter writer(output);
+  // Final block, fixed Huffman codes
+  writer.write(1, 1);
+  writer.write(1, 2);
+
+  size_t position = 0;
+  while (position < data.length()) {
+    if (position + deflateMinMatch <= data.length()) {
+      const auto key = hash(position);
+      const auto candidate = head[key];
+      head[key] = static_cast<uint32_t>(position);
+
+      if (candidate != empty && position - candidate <= (1 << deflateWindowBits) && memcmp(bytes + candidate, bytes + position, deflateMinMatch) == 0) {
+        size_t length = deflateMinMatch;
+        const auto maxLength = std::min(deflateMaxMatch, data.length() - position);
+        while (length < maxLength && bytes[candidate + length] == bytes[position + length]) length++;
+        writeDeflateMatch(writer, length, position - candidate);
+
+        // Positions inside the match are indexed too, so repetitions keep matching
+        for (size_t index = position + 1; index < position + length && index + deflateMinMatch <= data.length(); ++index) {
+          head[hash(index)] = static_cast<uint32_t>(index);
+        }
+        position += length;
+        continue;
+      }
+    }
+    writeDeflateSymbol(writer, bytes[position++]);
+  }
+
+  // End of block
+  writeDeflateSymbol(writer, 256);
+  writer.flush();
+  return true;
+}
+
+inline auto crc32(const std::string_view data) noexcept -> uint32_t {
+  uint32_t crc = 0xFFFFFFFF;
+  for (const auto byte : data) {
+    crc ^= static_cast<uint8_t>(byte);
+    for (uint8_t bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+inline auto adler32(const std::string_view data) noexcept -> uint32_t {
+  uint32_t a = 1, b = 0;
+  size_t index = 0;
+  while (index < data.length()) {
+    // Largest run that can't overflow before the modulo
+    const auto end = std::min(data.length(), index + 5552);
+    for (; index < end; ++index) {
+      a += static_cast<uint8_t>(data[index]);
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+inline auto writeLittleEndian(std::string &output, const uint32_t value) noexcept -> void {
+  for (uint8_t index = 0; index < 4; ++index) output.push_back(static_cast<char>((value >> (index * 8)) & 0xFF));
+}
+
+auto compress(const std::string_view data, const ContentEncoding encoding, std::string &output) noexcept -> bool {
+  output.clear();
+  // Fixed codes never expand a literal past 9 bits
+  output.reserve(data.length() + data.length() / 8 + 32);
+
+  switch (encoding) {
+  case ContentEncoding::GZIP: {
+    // Magic, deflate, no flags, no modification time, no extra flags, unknown OS
+    constexpr static uint8_t header[] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+    output.append(reinterpret_cast<const char *>(header), sizeof(header));
+    if (!deflateRaw(data, output)) return false;
+    writeLittleEndian(output, crc32(data));
+    writeLittleEndian(output, static_cast<uint32_t>(data.length()));
+    return true;
+  }
+  case ContentEncoding::DEFLATE: {
+    // Deflate with our window size, the check bits make the header a multiple of 31
+    const auto cmf = static_cast<uint8_t>(((deflateWindowBits - 8) << 4) | 8);
+    const auto remainder = (static_cast<uint32_t>(cmf) << 8) % 31;
+    output.push_back(static_cast<char>(cmf));
+    output.push_back(static_cast<char>(remainder == 0 ? 0 : 31 - remainder));
+    if (!deflateRaw(data, output)) return false;
+    const auto checksum = adler32(data);
+    for (int8_t index = 3; index >= 0; --index) output.push_back(static_cast<char>((checksum >> (index * 8)) & 0xFF));
+    return true;
+  }
+  }
+  iop_panic(IOP_STR("Invalid content encoding"));
+}
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef IOP_CPP17_DELTA_HPP
+#define IOP_CPP17_DELTA_HPP
+
+#include "iop-hal/string.hpp"
+
+#include <functional>
+#include <algorithm>
+#include <string_view>
+#include <strings.h>
+#include <stdint.h>
+#include <array>
+
+namespace iop_hal {
+/// Content-Type of firmware deltas, servers may send them instead of the full image if the client accepts it
+constexpr static char deltaContentType[] = "application/x-iop-delta";
+/// Accept header of firmware downloads, the server sends the full image if no delta from our firmware is available
+constexpr static char firmwareAccept[] = "application/x-iop-delta, application/octet-stream";
+
+inline auto isDeltaContentType(const std::string_view contentType) noexcept -> bool {
+  return contentType.length() >= sizeof(deltaContentType) - 1 && strncasecmp(contentType.data(), deltaContentType, sizeof(deltaContentType) - 1) == 0;
+}
+
+/// Applies a firmware delta as it's downloaded, reconstructing the target image from the current one in bounded memory.
+///
+/// Format (integers are little endian u32):
+///   "IOPDELTA" | version (1 byte) | source MD5 (32 hex chars) | target MD5 (32 hex chars) | target size
+///   followed by operations, each an opcode byte and its arguments:
+///     COPY   (1): source offset, length              - copies from the current image
+///     ADD    (2): source offset, length, bytes       - bytewise sum of the current image and the bytes (bsdiff's diff blocks)
+///     INSERT (3): length, bytes                      - literal data
+///     END    (0)
+class DeltaApplier {
+public:
+  /// Reads `length` bytes of the current image, starting at `offset`
+  using SourceReader = std::function<bool(size_t offset, uint8_t *buffer, size_t length)>;
+  /// Receives the reconstructed image, in order
+  using TargetWriter = std::function<bool(std::string_view data)>;
+  /// Called once the header is parsed, before anything is written. Returning false refuses the delta
+  using HeaderHandler = std::function<bool(size_t targetSize, const iop::MD5Hash &targetMD5)>;
+
+  enum class State { HEADER, OPCODE, ARGUMENTS, DATA, DONE, ERROR };
+
+private:
+  static constexpr uint8_t version = 1;
+  static constexpr size_t headerSize = 8 + 1 + 32 + 32 + 4;
+
+  enum class Operation : uint8_t { END = 0, COPY = 1, ADD = 2, INSERT = 3 };
+
+  SourceReader source;
+  TargetWriter target;
+  HeaderHandler onHeader;
+  size_t sourceSize;
+  iop::MD5Hash sourceMD5;
+  iop::MD5Hash targetMD5_;
+  size_t targetSize_;
+  size_t written;
+
+  State state_;
+  Operation operation;
+  // Both the header and the operation arguments are small, they are accumulated here
+  std::array<uint8_t, headerSize> pending;
+  size_t pendingSize;
+  size_t sourceOffset;
+  size_t dataLeft;
+  std::array<uint8_t, 256> work;
+
+  static auto readU32(const uint8_t *data) noexcept -> uint32_t {
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+  }
+
+  /// Accumulates `size` bytes from `input` into `pending`, returns true once they are all there
+  auto accumulate(std::string_view &input, const size_t size) noexcept -> bool {
+    const auto length = std::min(size - this->pendingSize, input.length());
+    std::copy(input.begin(), input.begin() + length, this->pending.begin() + this->pendingSize);
+    this->pendingSize += length;
+    input = input.substr(length);
+    return this->pendingSize == size;
+  }
+
+  auto emit(const uint8_t *data, const size_t length) noexcept -> bool {
+    if (this->written + length > this->targetSize_) return false;
+    this->written += length;
+    return this->target(std::string_view(reinterpret_cast<const char*>(data), length));
+  }
+
+  auto fail() noexcept -> bool {
+    this->state_ = State::ERROR;
+    return false;
+  }
+
+  auto parseHeader() noexcept -> bool {
+    const auto *data = this->pending.data();
+    if (std::string_view(reinterpret_cast<const char*>(data), 8) != "IOPDELTA" || data[8] != version) return this->fail();
+
+    // Deltas only apply over the exact image they were generated from
+    if (strncasecmp(reinterpret_cast<const char*>(data + 9), this->sourceMD5.data(), this->sourceMD5.size()) != 0) return this->fail();
+    std::copy(data + 41, data + 73, this->targetMD5_.begin());
+    this->targetSize_ = readU32(data + 73);
+    if (this->onHeader && !this->onHeader(this->targetSize_, this->targetMD5_)) return this->fail();
+    this->state_ = State::OPCODE;
+    return true;
+  }
+
+  auto argumentsSize() const noexcept -> size_t {
+    switch (this->operation) {
+      case Operation::COPY:
+      case Operation::ADD:
+        return 8;
+      case Operation::INSERT:
+        return 4;
+      case Operation::END:
+        break;
+    }
+    return 0;
+  }
+
+  auto parseArguments() noexcept -> bool {
+    const auto *data = this->pending.data();
+    if (this->operation == Operation::INSERT) {
+      this->sourceOffset = 0;
+      this->dataLeft = readU32(data);
+    } else {
+      this->sourceOffset = readU32(data);
+      this->dataLeft = readU32(data + 4);
+      if (this->sourceOffset > this->sourceSize || this->dataLeft > this->sourceSize - this->sourceOffset) return this->fail();
+    }
+
+    if (this->operation == Operation::COPY) {
+      // Doesn't depend on the input, so it's done at once
+      while (this->dataLeft > 0) {
+        const auto length = std::min(this->dataLeft, this->work.size());
+        if (!this->source(this->sourceOffset, this->work.data(), length)) return this->fail();
+        if (!this->emit(this->work.data(), length)) return this->fail();
+        this->sourceOffset += length;
+        this->dataLeft -= length;
+      }
+      this->state_ = State::OPCODE;
+      return true;
+    }
+
+    this->state_ = this->dataLeft > 0 ? State::DATA : State::OPCODE;
+    return true;
+  }
+
+  auto applyData(std::string_view &input) noexcept -> bool {
+    const auto length = std::min({ this->dataLeft, input.length(), this->work.size() });
+    const auto *data = reinterpret_cast<const uint8_t*>(input.data());
+    if (this->operation == Operation::ADD) {
+      if (!this->source(this->sourceOffset, this->work.data(), length)) return this->fail();
+      for (size_t index = 0; index < length; ++index) {
+        this->work[index] = static_cast<uint8_t>(this->work[index] + data[index]);
+      }
+      data = this->work.data();
+    }
+    if (!this->emit(data, length)) return this->fail();
+
+    input = input.substr(length);
+    this->sourceOffset += length;
+    this->dataLeft -= length;
+    if (this->dataLeft == 0) this->state_ = State::OPCODE;
+    return true;
+  }
+
+public:
+  DeltaApplier(SourceReader source, TargetWriter target, const size_t sourceSize, const iop::MD5Hash &sourceMD5, HeaderHandler onHeader = nullptr) noexcept:
+    source(std::move(source)), target(std::move(target)), onHeader(std::move(onHeader)), sourceSize(sourceSize), sourceMD5(sourceMD5), targetMD5_(), targetSize_(0),
+    written(0), state_(State::HEADER), operation(Operation::END), pending(), pendingSize(0), sourceOffset(0), dataLeft(0), work() {}
+
+  /// Consumes the next piece of the delta, returns false if it's invalid or the target can't be written
+  auto feed(std::string_view input) noexcept -> bool {
+    while (input.length() > 0) {
+      switch (this->state_) {
+        case State::HEADER:
+          if (!this->accumulate(input, headerSize)) break;
+          this->pendingSize = 0;
+          if (!this->parseHeader()) return false;
+          break;
+        case State::OPCODE:
+          this->operation = static_cast<Operation>(input[0]);
+          input = input.substr(1);
+          if (this->operation == Operation::END) {
+            if (this->written != this->targetSize_) return this->fail();
+            this->state_ = State::DONE;
+          } else if (this->argumentsSize() == 0) {
+            return this->fail();
+          } else {
+            this->state_ = State::ARGUMENTS;
+          }
+          break;
+        case State::ARGUMENTS:
+          if (!this->accumulate(input, this->argumentsSize())) break;
+          this->pendingSize = 0;
+          if (!this->parseArguments()) return false;
+          break;
+        case State::DATA:
+          if (!this->applyData(input)) return false;
+          break;
+        case State::DONE:
+          // Trailing data means the delta is corrupted
+          return this->fail();
+        case State::ERROR:
+          return false;
+      }
+    }
+    return this->state_ != State::ERROR;
+  }
+
+  auto state() const noexcept -> State { return this->state_; }
+  /// Only valid after the header has been fed
+  auto targetMD5() const noexcept -> const iop::MD5Hash & { return this->targetMD5_; }
+  auto targetSize() const noexcept -> size_t { return this->targetSize_; }
+};
+} // namespace iop_hal
+
+#endif
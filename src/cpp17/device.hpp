@@ -6,6 +6,11 @@
 #include <thread>
 #include <filesystem>
 #include <fstream>
+#include <string>
+#include <array>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 namespace iop_hal {
 auto Device::availableStorage() const noexcept -> uintmax_t {
@@ -22,6 +27,38 @@ void Device::deepSleep(uintmax_t seconds) const noexcept {
   std::this_thread::sleep_for(std::chrono::seconds(seconds));
 }
 
+/// Identifies the binary's contents without reading them, any change to the file (like an update) changes it
+static auto firmwareKey(const struct stat &info) noexcept -> std::string {
+  return std::to_string(info.st_dev) + " " + std::to_string(info.st_ino) + " " + std::to_string(info.st_size) + " "
+    + std::to_string(info.st_mtim.tv_sec) + "." + std::to_string(info.st_mtim.tv_nsec);
+}
+
+static auto loadFirmwareMD5(const std::string &path, const std::string &key, iop::MD5Hash &hash) noexcept -> bool {
+  std::ifstream file(path);
+  if (!file.is_open()) return false;
+
+  auto cachedKey = std::string();
+  auto digest = std::string();
+  std::getline(file, cachedKey);
+  std::getline(file, digest);
+  if (file.fail() || cachedKey != key || digest.length() != hash.size()) return false;
+  std::copy(digest.begin(), digest.end(), hash.begin());
+  return true;
+}
+
+/// Best effort, the binary's directory may not be writable
+static auto saveFirmwareMD5(const std::string &path, const std::string &key, const iop::MD5Hash &hash) noexcept -> void {
+  const auto tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::trunc);
+    if (!file.is_open()) return;
+    file << key << '\n' << iop::to_view(hash) << '\n';
+    file.close();
+    if (file.fail()) return;
+  }
+  rename(tmpPath.c_str(), path.c_str());
+}
+
 iop::MD5Hash & Device::firmwareMD5() const noexcept {
   static iop::MD5Hash hash;
   static bool cached = false;
@@ -30,24 +67,42 @@ iop::MD5Hash & Device::firmwareMD5() const noexcept {
   hash.fill('\0');
 
   const auto filename = std::filesystem::current_path().append(iop_hal::execution_path());
-  std::ifstream file(filename);
-  iop_assert(file.is_open(), IOP_STR("Unable to open firmware file"));
+  const auto fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  iop_assert(fd >= 0, IOP_STR("Unable to open firmware file"));
 
-  const auto data = std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-  iop_assert(!file.fail(), IOP_STR("Unable to read from firmware file"));
+  struct stat info;
+  iop_assert(fstat(fd, &info) == 0, IOP_STR("Unable to stat firmware file"));
 
-  file.close();
-  iop_assert(!file.fail(), IOP_STR("Unable to close firmware file"));
+  // Hashing big binaries delays the startup, so the digest is kept across restarts
+  const auto cachePath = filename.string().append(".md5");
+  const auto key = firmwareKey(info);
+  if (loadFirmwareMD5(cachePath, key, hash)) {
+    close(fd);
+    cached = true;
+    return hash;
+  }
 
-  std::array<uint8_t, 16> buff;
+  std::array<uint8_t, 16 * 1024> buffer;
   MD5_CTX md5;
   MD5_Init(&md5);
-  MD5_Update(&md5, &data.front(), data.size());
-  MD5_Final(buff.data(), &md5);
+  while (true) {
+    const auto signedSize = read(fd, buffer.data(), buffer.size());
+    if (signedSize < 0 && errno == EINTR) continue;
+    iop_assert(signedSize >= 0, IOP_STR("Unable to read from firmware file"));
+    if (signedSize == 0) break;
+    MD5_Update(&md5, buffer.data(), static_cast<unsigned long>(signedSize));
+  }
+  iop_assert(close(fd) == 0, IOP_STR("Unable to close firmware file"));
+
+  std::array<uint8_t, 16> digest;
+  MD5_Final(digest.data(), &md5);
+  constexpr char hex[] = "0123456789ABCDEF";
   for (uint8_t i = 0; i < 16; i++){
-    sprintf(hash.data() + (i * 2), "%02X", buff[i]);
+    hash[i * 2] = hex[digest[i] >> 4];
+    hash[i * 2 + 1] = hex[digest[i] & 0xF];
   }
 
+  saveFirmwareMD5(cachePath, key, hash);
   cached = true;
   return hash;
 }
@@ -0,0 +1,590 @@
+#ifndef IOP_CPP17_HTTP_PARSER_HPP
+#define IOP_CPP17_HTTP_PARSER_HPP
+
+#include <unordered_map>
+#include <string_view>
+#include <optional>
+#include <charconv>
+#include <string>
+#include <vector>
+#include <strings.h>
+#include <stdint.h>
+#include <algorithm>
+
+namespace iop_hal {
+/// Returns the value of the header line if its key is `key` (case insensitive)
+inline auto headerValue(std::string_view line, const std::string_view key) noexcept -> std::optional<std::string_view> {
+  if (line.length() <= key.length() || line[key.length()] != ':') return std::nullopt;
+  if (strncasecmp(line.data(), key.data(), key.length()) != 0) return std::nullopt;
+
+  line = line.substr(key.length() + 1);
+  while (line.length() > 0 && (line.front() == ' ' || line.front() == '\t')) line = line.substr(1);
+  while (line.length() > 0 && (line.back() == ' ' || line.back() == '\t')) line = line.substr(0, line.length() - 1);
+  return line;
+}
+
+/// Compares header values, that are case insensitive
+inline auto headerEquals(const std::string_view value, const std::string_view expected) noexcept -> bool {
+  return value.length() == expected.length() && strncasecmp(value.data(), expected.data(), value.length()) == 0;
+}
+
+/// Checks if `If-None-Match` lists `etag`, comparing them weakly as recommended by RFC 9110
+inline auto etagMatches(std::string_view ifNoneMatch, std::string_view etag) noexcept -> bool {
+  if (etag.substr(0, 2) == "W/") etag = etag.substr(2);
+  while (ifNoneMatch.length() > 0) {
+    const auto end = std::min(ifNoneMatch.find(','), ifNoneMatch.length());
+    auto tag = ifNoneMatch.substr(0, end);
+    ifNoneMatch = ifNoneMatch.substr(std::min(end + 1, ifNoneMatch.length()));
+
+    while (tag.length() > 0 && (tag.front() == ' ' || tag.front() == '\t')) tag = tag.substr(1);
+    while (tag.length() > 0 && (tag.back() == ' ' || tag.back() == '\t')) tag = tag.substr(0, tag.length() - 1);
+    if (tag.substr(0, 2) == "W/") tag = tag.substr(2);
+    if (tag == "*" || tag == etag) return true;
+  }
+  return false;
+}
+
+/// Splits the input in lines without copying it. Only lines split between two reads are buffered, until they end
+class LineReader {
+  std::string partial;
+  size_t maxLength;
+
+public:
+  explicit LineReader(const size_t maxLength) noexcept: partial(), maxLength(maxLength) {}
+
+  /// Extracts the next complete line (without the line break) from `input`, buffers incomplete ones.
+  ///
+  /// `overflow` is set if the line is longer than allowed. The line may reference the buffer, it's valid until `clear`
+  auto next(std::string_view &input, bool &overflow) noexcept -> std::optional<std::string_view> {
+    overflow = false;
+    const auto newline = input.find('\n');
+    if (newline == input.npos) {
+      if (this->partial.length() + input.length() > this->maxLength) {
+        overflow = true;
+      } else {
+        this->partial.append(input);
+      }
+      input = std::string_view();
+      return std::nullopt;
+    }
+
+    auto line = input.substr(0, newline);
+    input = input.substr(newline + 1);
+    // Checked whether the line arrived in one read or not, so the outcome doesn't depend on how it was split
+    if (this->partial.length() + line.length() > this->maxLength) {
+      overflow = true;
+      return std::nullopt;
+    }
+    if (this->partial.length() > 0) {
+      this->partial.append(line);
+      line = this->partial;
+    }
+    if (line.length() > 0 && line.back() == '\r') line = line.substr(0, line.length() - 1);
+    return line;
+  }
+
+  void clear() noexcept { this->partial.clear(); }
+};
+
+/// Incremental HTTP/1.x response parser. It walks the data it's fed with a cursor, never shifting nor copying it.
+///
+/// The only exception are lines split between two reads, the start is kept until the rest arrives.
+///
+/// Bodies are framed by `Transfer-Encoding: chunked`, `Content-Length` or the connection closing, in that order.
+class ResponseParser {
+public:
+  enum class State { STATUS_LINE, HEADERS, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILERS, DONE, ERROR };
+
+private:
+  const std::vector<std::string> &headersToCollect;
+  std::unordered_map<std::string, std::string> headers_;
+  LineReader lines;
+  State state_;
+  int status_;
+  bool persistent_;
+  bool hasBody;
+  bool chunked_;
+  bool encoded_;
+  std::optional<size_t> contentLength_;
+  size_t bodyLeft;
+
+  auto nextLine(std::string_view &input) noexcept -> std::optional<std::string_view> {
+    auto overflow = false;
+    const auto line = this->lines.next(input, overflow);
+    if (overflow) this->state_ = State::ERROR;
+    return line;
+  }
+
+  auto parseStatusLine(const std::string_view line) noexcept -> void {
+    // HTTP/1.x XXX Reason
+    if (line.length() < 12 || line.substr(0, 7) != "HTTP/1." || line[8] != ' ') {
+      this->state_ = State::ERROR;
+      return;
+    }
+
+    int status = 0;
+    const auto code = line.substr(9, 3);
+    const auto result = std::from_chars(code.data(), code.data() + code.length(), status);
+    if (result.ec != std::errc() || result.ptr != code.data() + code.length()) {
+      this->state_ = State::ERROR;
+      return;
+    }
+
+    this->status_ = status;
+    // HTTP/1.1 connections are persistent by default, HTTP/1.0 ones need "Connection: keep-alive"
+    this->persistent_ = line[7] == '1';
+    this->state_ = State::HEADERS;
+  }
+
+  auto parseHeader(const std::string_view line) noexcept -> void {
+    if (line.length() == 0) {
+      this->endHeaders();
+      return;
+    }
+
+    if (const auto value = headerValue(line, "Content-Length")) {
+      size_t length = 0;
+      const auto result = std::from_chars(value->data(), value->data() + value->length(), length);
+      if (result.ec != std::errc() || result.ptr != value->data() + value->length()) {
+        this->state_ = State::ERROR;
+        return;
+      }
+      this->contentLength_ = length;
+    } else if (const auto value = headerValue(line, "Transfer-Encoding")) {
+      // Only the last coding matters, chunked must be the final one (RFC 7230 3.3.1)
+      const auto comma = value->rfind(',');
+      auto coding = comma == value->npos ? *value : value->substr(comma + 1);
+      while (coding.length() > 0 && (coding.front() == ' ' || coding.front() == '\t')) coding = coding.substr(1);
+      this->chunked_ = headerEquals(coding, "chunked");
+    } else if (const auto value = headerValue(line, "Content-Encoding")) {
+      this->encoded_ = headerEquals(*value, "gzip") || headerEquals(*value, "x-gzip") || headerEquals(*value, "deflate");
+    } else if (const auto value = headerValue(line, "Connection")) {
+      if (headerEquals(*value, "close")) {
+        this->persistent_ = false;
+      } else if (headerEquals(*value, "keep-alive")) {
+        this->persistent_ = true;
+      }
+    }
+
+    for (const auto &key: this->headersToCollect) {
+      if (const auto value = headerValue(line, key)) {
+        this->headers_.emplace(key, std::string(*value));
+        break;
+      }
+    }
+  }
+
+  auto endHeaders() noexcept -> void {
+    // Interim responses (like 100 Continue) are followed by the actual one
+    if (this->status_ >= 100 && this->status_ < 200) {
+      this->contentLength_.reset();
+      this->chunked_ = false;
+      this->encoded_ = false;
+      this->headers_.clear();
+      this->state_ = State::STATUS_LINE;
+      return;
+    }
+
+    if (!this->hasBody || this->status_ == 204 || this->status_ == 304) {
+      this->state_ = State::DONE;
+      return;
+    }
+
+    // Transfer-Encoding overrides Content-Length (RFC 7230 3.3.3)
+    if (this->chunked_) {
+      this->contentLength_.reset();
+      this->state_ = State::CHUNK_SIZE;
+      return;
+    }
+
+    this->bodyLeft = this->contentLength_.value_or(0);
+    this->state_ = this->contentLength_ && *this->contentLength_ == 0 ? State::DONE : State::BODY;
+  }
+
+  auto parseChunkSize(std::string_view line) noexcept -> void {
+    // Chunk extensions are allowed, but we don't care about them
+    const auto extension = line.find(';');
+    if (extension != line.npos) line = line.substr(0, extension);
+    while (line.length() > 0 && (line.back() == ' ' || line.back() == '\t')) line = line.substr(0, line.length() - 1);
+
+    size_t size = 0;
+    const auto result = std::from_chars(line.data(), line.data() + line.length(), size, 16);
+    if (line.length() == 0 || result.ec != std::errc() || result.ptr != line.data() + line.length()) {
+      this->state_ = State::ERROR;
+      return;
+    }
+
+    this->bodyLeft = size;
+    this->state_ = size == 0 ? State::TRAILERS : State::CHUNK_DATA;
+  }
+
+public:
+  /// `hasBody` must be false for responses to HEAD requests, as they have Content-Length but no body
+  ResponseParser(const std::vector<std::string> &headersToCollect, const bool hasBody, const size_t maxLineLength = 8192) noexcept:
+    headersToCollect(headersToCollect), headers_({}), lines(maxLineLength), state_(State::STATUS_LINE),
+    status_(0), persistent_(false), hasBody(hasBody), chunked_(false), encoded_(false), contentLength_(std::nullopt), bodyLeft(0) {}
+
+  /// Consumes `input` until a piece of the body is found, or until it runs out, returning an empty view.
+  ///
+  /// It also returns an empty view once the headers end, so they can be inspected before the body is consumed.
+  ///
+  /// The returned body references `input`'s data, it's not copied.
+  auto parse(std::string_view &input) noexcept -> std::string_view {
+    while (input.length() > 0) {
+      switch (this->state_) {
+        case State::STATUS_LINE:
+        case State::HEADERS:
+        case State::CHUNK_SIZE:
+        case State::CHUNK_END:
+        case State::TRAILERS: {
+          const auto line = this->nextLine(input);
+          if (!line) break;
+
+          switch (this->state_) {
+            case State::STATUS_LINE:
+              // Tolerates empty lines before the status line (RFC 7230 3.5)
+              if (line->length() > 0) this->parseStatusLine(*line);
+              break;
+            case State::HEADERS:
+              this->parseHeader(*line);
+              if (this->headersDone()) {
+                this->lines.clear();
+                return std::string_view();
+              }
+              break;
+            case State::CHUNK_SIZE:
+              this->parseChunkSize(*line);
+              break;
+            case State::CHUNK_END:
+              this->state_ = line->length() == 0 ? State::CHUNK_SIZE : State::ERROR;
+              break;
+            case State::TRAILERS:
+              // Trailer fields are discarded, the empty line ends the message
+              if (line->length() == 0) this->state_ = State::DONE;
+              break;
+            default:
+              break;
+          }
+          this->lines.clear();
+          break;
+        }
+        case State::CHUNK_DATA: {
+          const auto body = input.substr(0, this->bodyLeft);
+          input = input.substr(body.length());
+          this->bodyLeft -= body.length();
+          if (this->bodyLeft == 0) this->state_ = State::CHUNK_END;
+          return body;
+        }
+        case State::BODY: {
+          if (!this->contentLength_) {
+            const auto body = input;
+            input = std::string_view();
+            return body;
+          }
+
+          const auto body = input.substr(0, this->bodyLeft);
+          input = input.substr(body.length());
+          this->bodyLeft -= body.length();
+          if (this->bodyLeft == 0) this->state_ = State::DONE;
+          return body;
+        }
+        case State::DONE:
+        case State::ERROR:
+          return std::string_view();
+      }
+    }
+    return std::string_view();
+  }
+
+  /// Signals the peer closed the connection, which ends bodies without framing
+  auto finish() noexcept -> void {
+    if (this->state_ == State::BODY && !this->contentLength_) {
+      this->state_ = State::DONE;
+    } else if (this->state_ != State::DONE) {
+      this->state_ = State::ERROR;
+    }
+  }
+
+  auto state() const noexcept -> State { return this->state_; }
+  auto headersDone() const noexcept -> bool { return this->state_ != State::STATUS_LINE && this->state_ != State::HEADERS; }
+  auto status() const noexcept -> int { return this->status_; }
+  auto contentLength() const noexcept -> std::optional<size_t> { return this->contentLength_; }
+  auto chunked() const noexcept -> bool { return this->chunked_; }
+  /// If the body is compressed (`Content-Encoding` gzip or deflate), framing lengths are of the compressed body
+  auto encoded() const noexcept -> bool { return this->encoded_; }
+  auto headers() noexcept -> std::unordered_map<std::string, std::string> & { return this->headers_; }
+
+  /// Connection may be reused after the message, as the server will keep it open and the body end is known
+  auto reusable() const noexcept -> bool {
+    return this->state_ == State::DONE && this->persistent_ && (this->contentLength_ || this->chunked_ || !this->hasBody || this->status_ == 204 || this->status_ == 304);
+  }
+};
+
+/// Incremental HTTP/1.x request parser, the server side of `ResponseParser`. Memory is bounded by the limits given,
+/// anything past them is an error.
+///
+/// Pipelined requests are parsed one at a time, once it's `DONE` the next one starts after `reset`.
+class RequestParser {
+public:
+  enum class State { REQUEST_LINE, HEADERS, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILERS, DONE, ERROR };
+  /// Why the request was refused, as an HTTP status code
+  enum class Error { NONE = 0, BAD_REQUEST = 400, TOO_LARGE = 413, URI_TOO_LONG = 414, HEADERS_TOO_LARGE = 431, NOT_IMPLEMENTED = 501 };
+
+private:
+  LineReader lines;
+  size_t maxHeadersSize;
+  size_t maxBodySize;
+  State state_;
+  Error error_;
+  std::string method_;
+  std::string target_;
+  std::string headers_;
+  uint8_t version_;
+  bool persistent_;
+  bool chunked_;
+  bool expectContinue_;
+  std::optional<size_t> contentLength_;
+  size_t bodySize;
+  size_t bodyLeft;
+
+  auto fail(const Error error) noexcept -> void {
+    this->state_ = State::ERROR;
+    this->error_ = error;
+  }
+
+  auto nextLine(std::string_view &input) noexcept -> std::optional<std::string_view> {
+    auto overflow = false;
+    const auto line = this->lines.next(input, overflow);
+    if (!overflow) return line;
+
+    if (this->state_ == State::REQUEST_LINE) {
+      this->fail(Error::URI_TOO_LONG);
+    } else if (this->state_ == State::HEADERS) {
+      this->fail(Error::HEADERS_TOO_LARGE);
+    } else {
+      this->fail(Error::BAD_REQUEST);
+    }
+    return line;
+  }
+
+  auto parseRequestLine(const std::string_view line) noexcept -> void {
+    // METHOD SP target SP HTTP/1.x
+    const auto methodEnd = line.find(' ');
+    const auto targetEnd = line.find(' ', methodEnd + 1);
+    if (methodEnd == 0 || methodEnd == line.npos || targetEnd == line.npos || targetEnd == methodEnd + 1) {
+      this->fail(Error::BAD_REQUEST);
+      return;
+    }
+
+    const auto method = line.substr(0, methodEnd);
+    const auto version = line.substr(targetEnd + 1);
+    const auto isToken = std::all_of(method.begin(), method.end(), [](const char c) { return c >= 'A' && c <= 'Z'; });
+    if (!isToken || version.length() != 8 || version.substr(0, 7) != "HTTP/1." || (version[7] != '0' && version[7] != '1')) {
+      this->fail(Error::BAD_REQUEST);
+      return;
+    }
+
+    this->method_.assign(method.data(), method.length());
+    this->target_.assign(line.data() + methodEnd + 1, targetEnd - methodEnd - 1);
+    // HTTP/1.1 connections are persistent by default, HTTP/1.0 ones need "Connection: keep-alive"
+    this->version_ = static_cast<uint8_t>(version[7] - '0');
+    this->persistent_ = this->version_ == 1;
+    this->state_ = State::HEADERS;
+  }
+
+  auto parseHeader(const std::string_view line) noexcept -> void {
+    if (line.length() == 0) {
+      this->endHeaders();
+      return;
+    }
+
+    if (this->headers_.length() + line.length() + 2 > this->maxHeadersSize) {
+      this->fail(Error::HEADERS_TOO_LARGE);
+      return;
+    }
+    // Obsolete line folding and lines without a name are refused (RFC 7230 3.2.4)
+    const auto colon = line.find(':');
+    if (line.front() == ' ' || line.front() == '\t' || colon == 0 || colon == line.npos) {
+      this->fail(Error::BAD_REQUEST);
+      return;
+    }
+
+    if (const auto value = headerValue(line, "Content-Length")) {
+      size_t length = 0;
+      const auto result = std::from_chars(value->data(), value->data() + value->length(), length);
+      if (value->length() == 0 || result.ec != std::errc() || result.ptr != value->data() + value->length() || (this->contentLength_ && *this->contentLength_ != length)) {
+        this->fail(Error::BAD_REQUEST);
+        return;
+      }
+      this->contentLength_ = length;
+    } else if (const auto value = headerValue(line, "Transfer-Encoding")) {
+      // Chunked is the only coding we understand, and it must be the last one (RFC 7230 3.3.3)
+      if (!headerEquals(*value, "chunked")) {
+        this->fail(Error::NOT_IMPLEMENTED);
+        return;
+      }
+      this->chunked_ = true;
+    } else if (const auto value = headerValue(line, "Connection")) {
+      if (headerEquals(*value, "close")) {
+        this->persistent_ = false;
+      } else if (headerEquals(*value, "keep-alive")) {
+        this->persistent_ = true;
+      }
+    } else if (const auto value = headerValue(line, "Expect")) {
+      this->expectContinue_ = headerEquals(*value, "100-continue");
+    }
+    this->headers_.append(line).append("\r\n");
+  }
+
+  auto endHeaders() noexcept -> void {
+    // Ambiguous framing is how requests are smuggled, so it's refused instead of preferring Transfer-Encoding
+    if (this->chunked_ && this->contentLength_) {
+      this->fail(Error::BAD_REQUEST);
+      return;
+    }
+
+    if (this->chunked_) {
+      this->state_ = State::CHUNK_SIZE;
+      return;
+    }
+
+    // Requests without framing have no body (RFC 7230 3.3.3)
+    this->bodyLeft = this->contentLength_.value_or(0);
+    if (this->bodyLeft > this->maxBodySize) {
+      this->fail(Error::TOO_LARGE);
+      return;
+    }
+    this->state_ = this->bodyLeft == 0 ? State::DONE : State::BODY;
+  }
+
+  auto parseChunkSize(std::string_view line) noexcept -> void {
+    // Chunk extensions are allowed, but we don't care about them
+    const auto extension = line.find(';');
+    if (extension != line.npos) line = line.substr(0, extension);
+    while (line.length() > 0 && (line.back() == ' ' || line.back() == '\t')) line = line.substr(0, line.length() - 1);
+
+    size_t size = 0;
+    const auto result = std::from_chars(line.data(), line.data() + line.length(), size, 16);
+    if (line.length() == 0 || result.ec != std::errc() || result.ptr != line.data() + line.length()) {
+      this->fail(Error::BAD_REQUEST);
+      return;
+    }
+    if (size > this->maxBodySize - this->bodySize) {
+      this->fail(Error::TOO_LARGE);
+      return;
+    }
+
+    this->bodySize += size;
+    this->bodyLeft = size;
+    this->state_ = size == 0 ? State::TRAILERS : State::CHUNK_DATA;
+  }
+
+  auto consumeBody(std::string_view &input, const State next) noexcept -> std::string_view {
+    const auto body = input.substr(0, this->bodyLeft);
+    input = input.substr(body.length());
+    this->bodyLeft -= body.length();
+    if (this->bodyLeft == 0) this->state_ = next;
+    return body;
+  }
+
+public:
+  RequestParser(const size_t maxLineLength, const size_t maxHeadersSize, const size_t maxBodySize) noexcept:
+    lines(maxLineLength), maxHeadersSize(maxHeadersSize), maxBodySize(maxBodySize), state_(State::REQUEST_LINE), error_(Error::NONE),
+    method_(), target_(), headers_(), version_(1), persistent_(false), chunked_(false), expectContinue_(false), contentLength_(std::nullopt),
+    bodySize(0), bodyLeft(0) {}
+
+  /// Prepares for the next request on the connection, keeping the buffers around
+  auto reset() noexcept -> void {
+    this->lines.clear();
+    this->state_ = State::REQUEST_LINE;
+    this->error_ = Error::NONE;
+    this->method_.clear();
+    this->target_.clear();
+    this->headers_.clear();
+    this->version_ = 1;
+    this->persistent_ = false;
+    this->chunked_ = false;
+    this->expectContinue_ = false;
+    this->contentLength_.reset();
+    this->bodySize = 0;
+    this->bodyLeft = 0;
+  }
+
+  /// Consumes `input` until a piece of the body is found, or until it runs out, returning an empty view.
+  ///
+  /// It also returns an empty view once the headers end and once the request is done, the data after it belongs
+  /// to the next request and is left in `input`.
+  ///
+  /// The returned body references `input`'s data, it's not copied.
+  auto parse(std::string_view &input) noexcept -> std::string_view {
+    while (input.length() > 0) {
+      switch (this->state_) {
+        case State::REQUEST_LINE:
+        case State::HEADERS:
+        case State::CHUNK_SIZE:
+        case State::CHUNK_END:
+        case State::TRAILERS: {
+          const auto line = this->nextLine(input);
+          if (!line) break;
+
+          switch (this->state_) {
+            case State::REQUEST_LINE:
+              // Tolerates empty lines before the request line (RFC 7230 3.5)
+              if (line->length() > 0) this->parseRequestLine(*line);
+              break;
+            case State::HEADERS:
+              this->parseHeader(*line);
+              if (this->headersDone()) {
+                this->lines.clear();
+                return std::string_view();
+              }
+              break;
+            case State::CHUNK_SIZE:
+              this->parseChunkSize(*line);
+              break;
+            case State::CHUNK_END:
+              if (line->length() == 0) {
+                this->state_ = State::CHUNK_SIZE;
+              } else {
+                this->fail(Error::BAD_REQUEST);
+              }
+              break;
+            case State::TRAILERS:
+              // Trailer fields are discarded, the empty line ends the request
+              if (line->length() == 0) this->state_ = State::DONE;
+              break;
+            default:
+              break;
+          }
+          this->lines.clear();
+          break;
+        }
+        case State::CHUNK_DATA:
+          return this->consumeBody(input, State::CHUNK_END);
+        case State::BODY:
+          return this->consumeBody(input, State::DONE);
+        case State::DONE:
+        case State::ERROR:
+          return std::string_view();
+      }
+    }
+    return std::string_view();
+  }
+
+  auto state() const noexcept -> State { return this->state_; }
+  auto error() const noexcept -> Error { return this->error_; }
+  auto headersDone() const noexcept -> bool { return this->state_ != State::REQUEST_LINE && this->state_ != State::HEADERS && this->state_ != State::ERROR; }
+  auto method() const noexcept -> const std::string & { return this->method_; }
+  auto target() const noexcept -> const std::string & { return this->target_; }
+  /// Minor version of HTTP/1.x
+  auto version() const noexcept -> uint8_t { return this->version_; }
+  /// Header lines, each ended by a line break
+  auto headers() const noexcept -> const std::string & { return this->headers_; }
+  /// The client waits for "100 Continue" before sending the body
+  auto expectContinue() const noexcept -> bool { return this->expectContinue_; }
+  /// Connection may be reused after the response, as the client wants it kept open
+  auto persistent() const noexcept -> bool { return this->persistent_; }
+};
+} // namespace iop_hal
+
+#endif
@@ -38,7 +38,44 @@
 #ifndef IOP_CPP17_MD5_HEADER
 #define IOP_CPP17_MD5_HEADER
 
-#ifndef HAVE_OPENSSL
+#ifdef HAVE_OPENSSL
+
+/*
+ * OpenSSL's EVP digests use its assembly MD5 kernels where available, this
+ * keeps the same API as the portable implementation below
+ */
+#include "iop-hal/panic.hpp"
+#include <openssl/evp.h>
+
+/* Owns the EVP context, so contexts initialized again or never finalized don't leak */
+struct MD5_CTX {
+	EVP_MD_CTX *evp = NULL;
+
+	MD5_CTX() = default;
+	MD5_CTX(const MD5_CTX &) = delete;
+	MD5_CTX &operator=(const MD5_CTX &) = delete;
+	~MD5_CTX() { EVP_MD_CTX_free(evp); }
+};
+
+static void MD5_Init(MD5_CTX *ctx)
+{
+	if (ctx->evp == NULL)
+		ctx->evp = EVP_MD_CTX_new();
+	iop_assert(ctx->evp != NULL, IOP_STR("Unable to allocate MD5 context"));
+	iop_assert(EVP_DigestInit_ex(ctx->evp, EVP_md5(), NULL) == 1, IOP_STR("Unable to initialize MD5"));
+}
+
+static void MD5_Update(MD5_CTX *ctx, const void *data, unsigned long size)
+{
+	iop_assert(EVP_DigestUpdate(ctx->evp, data, size) == 1, IOP_STR("Unable to update MD5"));
+}
+
+static void MD5_Final(unsigned char *result, MD5_CTX *ctx)
+{
+	iop_assert(EVP_DigestFinal_ex(ctx->evp, result, NULL) == 1, IOP_STR("Unable to finalize MD5"));
+}
+
+#else
 
 #include <string.h>
 
@@ -52,28 +89,35 @@ typedef struct {
 	MD5_u32plus block[16];
 } MD5_CTX;
 
-extern void MD5_Init(MD5_CTX *ctx);
-extern void MD5_Update(MD5_CTX *ctx, const void *data, unsigned long size);
-extern void MD5_Final(unsigned char *result, MD5_CTX *ctx);
+// Static, as every translation unit that needs it includes this header
+static void MD5_Init(MD5_CTX *ctx);
+static void MD5_Update(MD5_CTX *ctx, const void *data, unsigned long size);
+static void MD5_Final(unsigned char *result, MD5_CTX *ctx);
 
 /*
  * The basic MD5 functions.
  *
- * F and G are optimized compared to their RFC 1321 definitions for
- * architectures that lack an AND-NOT instruction, just like in Colin Plumb's
- * implementation.
+ * F is optimized compared to its RFC 1321 definition for architectures that
+ * lack an AND-NOT instruction, just like in Colin Plumb's implementation.
+ *
+ * G's halves have no bits in common, so it's a sum instead of an OR, and the
+ * half that doesn't depend on the previous step's result can be added early.
  */
 #define F(x, y, z)			((z) ^ ((x) & ((y) ^ (z))))
-#define G(x, y, z)			((y) ^ ((z) & ((x) ^ (y))))
+#define G(x, y, z)			(((x) & (z)) + ((y) & ~(z)))
 #define H(x, y, z)			(((x) ^ (y)) ^ (z))
 #define H2(x, y, z)			((x) ^ ((y) ^ (z)))
 #define I(x, y, z)			((y) ^ ((x) | ~(z)))
 
 /*
  * The MD5 transformation for all four rounds.
+ *
+ * The message word and constant are added first, as they don't depend on the
+ * previous step, shortening the dependency chain that bounds MD5's speed.
  */
 #define STEP(f, a, b, c, d, x, t, s) \
-	(a) += f((b), (c), (d)) + (x) + (t); \
+	(a) += (x) + (t); \
+	(a) += f((b), (c), (d)); \
 	(a) = (((a) << (s)) | (((a) & 0xffffffff) >> (32 - (s)))); \
 	(a) += (b);
 
@@ -92,7 +136,8 @@ extern void MD5_Final(unsigned char *result, MD5_CTX *ctx);
  * link-time optimizations.  For the time being, keeping these MD5 routines in
  * their own translation unit avoids the problem.
  */
-#if defined(__i386__) || defined(__x86_64__) || defined(__vax__)
+#if defined(__i386__) || defined(__x86_64__) || defined(__vax__) || \
+	(defined(__aarch64__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
 #define SET(n) \
 	(*(MD5_u32plus *)&ptr[(n) * 4])
 #define GET(n) \
@@ -219,7 +264,7 @@ static const void *body(MD5_CTX *ctx, const void *data, unsigned long size)
 	return ptr;
 }
 
-void MD5_Init(MD5_CTX *ctx)
+static void MD5_Init(MD5_CTX *ctx)
 {
 	ctx->a = 0x67452301;
 	ctx->b = 0xefcdab89;
@@ -230,7 +275,7 @@ void MD5_Init(MD5_CTX *ctx)
 	ctx->hi = 0;
 }
 
-void MD5_Update(MD5_CTX *ctx, const void *data, unsigned long size)
+static void MD5_Update(MD5_CTX *ctx, const void *data, unsigned long size)
 {
 	MD5_u32plus saved_lo;
 	unsigned long used, available;
@@ -270,7 +315,7 @@ void MD5_Update(MD5_CTX *ctx, const void *data, unsigned long size)
 	(dst)[2] = (unsigned char)((src) >> 16); \
 	(dst)[3] = (unsigned char)((src) >> 24);
 
-void MD5_Final(unsigned char *result, MD5_CTX *ctx)
+static void MD5_Final(unsigned char *result, MD5_CTX *ctx)
 {
 	unsigned long used, available;
 
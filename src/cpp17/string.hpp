@@ -3,4 +3,5 @@
 namespace iop {
 auto StaticString::toString() const noexcept -> std::string { return this->asCharPtr(); }
 auto StaticString::length() const noexcept -> size_t { return strlen(this->asCharPtr()); }
+auto StaticString::copy(char *destination, const size_t size) const noexcept -> void { memcpy(destination, this->asCharPtr(), size); }
 }
\ No newline at end of file
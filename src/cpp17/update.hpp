@@ -1,68 +1,388 @@
 #include "iop-hal/update.hpp"
 #include "iop-hal/network.hpp"
 #include "cpp17/runtime_metadata.hpp"
+#include "cpp17/md5.hpp"
+#include "cpp17/delta.hpp"
+#include "iop-hal/device.hpp"
 
-#include <cstdlib>
-#include <fstream>
 #include <filesystem>
+#include <algorithm>
+#include <optional>
+#include <charconv>
+#include <fstream>
+#include <array>
+#include <strings.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 namespace iop_hal {
-auto Update::run(iop::Network &network, const iop::StaticString path, const std::string_view authorization_header) noexcept -> iop_hal::UpdateStatus {
-    auto response = network.httpGet(path, authorization_header, "");
-    const auto status = response.status();
-    if (status && *status == iop::NetworkStatus::OK) {
-        const auto binary = response.await().payload;
-        if (binary.size() == 0) {
-            network.logger().errorln(IOP_STR("Update failed, no firmware returned"));
-            return iop_hal::UpdateStatus::BROKEN_SERVER;
-        }
+constexpr size_t maxFirmwareSize = 64 * 1024 * 1024;
+// How often the download progress is persisted, each checkpoint costs a fdatasync
+constexpr size_t checkpointInterval = 256 * 1024;
+// Deltas that fail to apply aren't requested again until the process restarts, so the server sends the full image
+static bool deltaFailed = false;
 
-        // Possible race here, but it's the best cross platform solution
-        const std::string tmpFile = std::tmpnam(nullptr);
-        network.logger().info(IOP_STR("Upgrading binary file: "));
-        network.logger().infoln(tmpFile);
+/// Persisted progress of an interrupted download, the partial file is only valid for the same firmware version and kind
+struct Progress {
+    iop::MD5Hash version;
+    size_t offset;
+    // Downloading a delta from the current firmware instead of the full image
+    bool delta;
+};
 
-        std::ofstream file(tmpFile);
-        if (!file.is_open()) {
-            network.logger().errorln(IOP_STR("Unable to open firmware file"));
-            return iop_hal::UpdateStatus::IO_ERROR;
-        }
+static auto loadProgress(const std::string &path) noexcept -> std::optional<Progress> {
+    std::ifstream file(path);
+    if (!file.is_open()) return std::nullopt;
 
-        file.write(reinterpret_cast<const char*>(&binary.front()), static_cast<std::streamsize>(binary.size()));
-        if (file.fail()) {
-            network.logger().errorln(IOP_STR("Unable to write to firmware file"));
-            return iop_hal::UpdateStatus::IO_ERROR;
-        }
+    auto version = std::string();
+    auto kind = std::string();
+    auto progress = Progress();
+    file >> version >> progress.offset >> kind;
+    if (file.fail() || version.length() != progress.version.size() || (kind != "delta" && kind != "full")) return std::nullopt;
+    std::copy(version.begin(), version.end(), progress.version.begin());
+    progress.delta = kind == "delta";
+    return progress;
+}
 
+/// Replaces the progress file atomically, so a crash never leaves it half written
+static auto saveProgress(const std::string &path, const Progress &progress) noexcept -> bool {
+    const auto tmpPath = std::string(path).append(".tmp");
+    {
+        std::ofstream file(tmpPath, std::ios::trunc);
+        if (!file.is_open()) return false;
+        file << iop::to_view(progress.version) << ' ' << progress.offset << ' ' << (progress.delta ? "delta" : "full") << '\n';
         file.close();
-        if (file.fail()) {
-            network.logger().errorln(IOP_STR("Unable to close firmware file"));
-            return iop_hal::UpdateStatus::IO_ERROR;
+        if (file.fail()) return false;
+    }
+    return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+static auto writeAll(const int fd, std::string_view data) noexcept -> bool {
+    while (data.length() > 0) {
+        const auto written = write(fd, data.data(), data.length());
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data = data.substr(static_cast<size_t>(written));
+    }
+    return true;
+}
+
+/// The MD5 must cover the full image, so what was downloaded before the interruption is hashed again
+static auto hashPrefix(const int fd, MD5_CTX &md5, const size_t size) noexcept -> bool {
+    std::array<char, 4096> buffer;
+    size_t offset = 0;
+    while (offset < size) {
+        const auto length = std::min(buffer.size(), size - offset);
+        const auto signedSize = pread(fd, buffer.data(), length, static_cast<off_t>(offset));
+        if (signedSize < 0 && errno == EINTR) continue;
+        if (signedSize <= 0) return false;
+        MD5_Update(&md5, buffer.data(), static_cast<unsigned long>(signedSize));
+        offset += static_cast<size_t>(signedSize);
+    }
+    return true;
+}
+
+/// Extracts the first byte of `bytes <start>-<end>/<size>`
+static auto rangeStart(const std::string_view contentRange) noexcept -> std::optional<size_t> {
+    if (contentRange.substr(0, 6) != "bytes ") return std::nullopt;
+    const auto range = contentRange.substr(6);
+    size_t start = 0;
+    const auto result = std::from_chars(range.data(), range.data() + range.length(), start);
+    if (result.ec != std::errc() || result.ptr == range.data() + range.length() || *result.ptr != '-') return std::nullopt;
+    return start;
+}
+
+static auto hexDigest(MD5_CTX &md5) noexcept -> iop::MD5Hash {
+    std::array<uint8_t, 16> digest;
+    MD5_Final(digest.data(), &md5);
+    iop::MD5Hash hash;
+    constexpr char hex[] = "0123456789ABCDEF";
+    for (uint8_t i = 0; i < 16; i++){
+        hash[i * 2] = hex[digest[i] >> 4];
+        hash[i * 2 + 1] = hex[digest[i] & 0xF];
+    }
+    return hash;
+}
+
+static auto isDelta(const iop_hal::Response &response) noexcept -> bool {
+    const auto contentType = response.header(IOP_STR("Content-Type"));
+    return contentType && isDeltaContentType(*contentType);
+}
+
+static auto sameVersion(const std::optional<std::string> &header, const iop::MD5Hash &version) noexcept -> bool {
+    return header && header->length() == version.size() && strncasecmp(header->c_str(), version.data(), version.size()) == 0;
+}
+
+/// State of the download, shared by the callbacks `Network::httpStream` calls
+class Download {
+public:
+    int fd;
+    const std::string &progressPath;
+    MD5_CTX md5;
+    Progress progress;
+    size_t checkpointed;
+    int writeError;
+
+    Download(const int fd, const std::string &progressPath, const Progress progress) noexcept:
+        fd(fd), progressPath(progressPath), md5(), progress(progress), checkpointed(progress.offset), writeError(0) {}
+
+    /// Starts from scratch, the server sent the whole body or a different version
+    auto restart(const iop::MD5Hash &version, const bool delta) noexcept -> bool {
+        this->progress.version = version;
+        this->progress.delta = delta;
+        this->progress.offset = 0;
+        this->checkpointed = 0;
+        MD5_Init(&this->md5);
+        unlink(this->progressPath.c_str());
+        return ftruncate(this->fd, 0) == 0 && lseek(this->fd, 0, SEEK_SET) == 0;
+    }
+
+    /// The written data must reach the disk before the progress file references it
+    auto checkpoint() noexcept -> void {
+        if (this->checkpointed == this->progress.offset) return;
+        if (fdatasync(this->fd) < 0 || !saveProgress(this->progressPath, this->progress)) return;
+        this->checkpointed = this->progress.offset;
+    }
+
+    auto write(const std::string_view chunk) noexcept -> bool {
+        if (!writeAll(this->fd, chunk)) {
+            this->writeError = errno;
+            return false;
         }
+        MD5_Update(&this->md5, chunk.data(), static_cast<unsigned long>(chunk.length()));
+        this->progress.offset += chunk.length();
+        if (this->progress.offset - this->checkpointed >= checkpointInterval) this->checkpoint();
+        return true;
+    }
 
-        std::error_code code;
-        // TODO: improve this perm
-        std::filesystem::permissions(tmpFile, std::filesystem::perms::owner_all | std::filesystem::perms::others_exec | std::filesystem::perms::others_read | std::filesystem::perms::group_exec | std::filesystem::perms::group_read, code);
-        if (code) {
-            network.logger().error(IOP_STR("Unable to set file as executable: "));
-            network.logger().errorln(code.value());
-            return iop_hal::UpdateStatus::IO_ERROR;
+    /// Decides if the body continues the partial file, starts it over, or must be refused
+    auto inspect(const iop_hal::Response &response) noexcept -> bool {
+        const auto header = response.header(IOP_STR("LATEST_VERSION"));
+        auto version = iop::MD5Hash();
+        version.fill('0');
+        if (header && header->length() == version.size()) std::copy(header->begin(), header->end(), version.begin());
+
+        const auto delta = isDelta(response);
+        if (response.code() != 206) return this->restart(version, delta);
+
+        // A range of a different body can't be appended, the next attempt starts from scratch
+        const auto contentRange = response.header(IOP_STR("Content-Range"));
+        const auto start = contentRange ? rangeStart(*contentRange) : std::nullopt;
+        if (!sameVersion(header, this->progress.version) || delta != this->progress.delta || start != this->progress.offset) {
+            this->restart(version, delta);
+            return false;
         }
+        return true;
+    }
+};
 
-        // TODO FIXME: Race here
-        const auto filename = std::filesystem::current_path().append(iop_hal::execution_path());
-        const auto renamedBinary = std::filesystem::current_path().append(std::string(iop_hal::execution_path()).append(std::string_view(".old")));
-        std::filesystem::rename(filename, renamedBinary);
-        std::filesystem::rename(tmpFile, filename);
-        std::filesystem::remove(renamedBinary);
+/// Reconstructs the new firmware from the current one and the downloaded delta, returns the MD5 of the result
+static auto applyDelta(iop::Network &network, const int deltaFd, const size_t deltaSize, const std::filesystem::path &filename, const std::string &patchedPath) noexcept -> std::optional<iop::MD5Hash> {
+    const auto sourceFd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (sourceFd < 0 || fstat(sourceFd, &info) < 0) {
+        network.logger().error(IOP_STR("Unable to open current firmware: "));
+        network.logger().errorln(std::string_view(strerror(errno)));
+        if (sourceFd >= 0) close(sourceFd);
+        return std::nullopt;
+    }
 
-        network.logger().infoln(IOP_STR("Upgrading runtime"));
-        exit(system(filename.string().c_str()));
-    } else {
+    const auto targetFd = open(patchedPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    if (targetFd < 0 || fchmod(targetFd, 0755) < 0) {
+        network.logger().error(IOP_STR("Unable to open patched firmware file: "));
+        network.logger().errorln(std::string_view(strerror(errno)));
+        if (targetFd >= 0) close(targetFd);
+        close(sourceFd);
+        return std::nullopt;
+    }
+
+    MD5_CTX md5;
+    MD5_Init(&md5);
+    const auto source = [sourceFd](const size_t offset, uint8_t *buffer, const size_t length) {
+        size_t done = 0;
+        while (done < length) {
+            const auto signedSize = pread(sourceFd, buffer + done, length - done, static_cast<off_t>(offset + done));
+            if (signedSize < 0 && errno == EINTR) continue;
+            if (signedSize <= 0) return false;
+            done += static_cast<size_t>(signedSize);
+        }
+        return true;
+    };
+    const auto target = [targetFd, &md5](const std::string_view data) {
+        if (!writeAll(targetFd, data)) return false;
+        MD5_Update(&md5, data.data(), static_cast<unsigned long>(data.length()));
+        return true;
+    };
+    auto applier = DeltaApplier(source, target, static_cast<size_t>(info.st_size), iop_hal::device.firmwareMD5());
+
+    std::array<char, 4096> buffer;
+    size_t offset = 0;
+    auto ok = true;
+    while (ok && offset < deltaSize) {
+        const auto signedSize = pread(deltaFd, buffer.data(), std::min(buffer.size(), deltaSize - offset), static_cast<off_t>(offset));
+        if (signedSize < 0 && errno == EINTR) continue;
+        ok = signedSize > 0 && applier.feed(std::string_view(buffer.data(), static_cast<size_t>(signedSize)));
+        offset += static_cast<size_t>(std::max(signedSize, static_cast<ssize_t>(0)));
+    }
+    close(sourceFd);
+
+    const auto hash = hexDigest(md5);
+    if (!ok || applier.state() != DeltaApplier::State::DONE || !sameVersion(std::string(iop::to_view(applier.targetMD5())), hash)) {
+        network.logger().errorln(IOP_STR("Unable to apply firmware delta"));
+        close(targetFd);
+        return std::nullopt;
+    }
+
+    if (fsync(targetFd) < 0) {
+        network.logger().error(IOP_STR("Unable to persist patched firmware: "));
+        network.logger().errorln(std::string_view(strerror(errno)));
+        close(targetFd);
+        return std::nullopt;
+    }
+    close(targetFd);
+    return hash;
+}
+
+static auto discardDownload(const int fd, const std::string &partPath, const std::string &progressPath) noexcept -> void {
+    close(fd);
+    unlink(partPath.c_str());
+    unlink(progressPath.c_str());
+}
+
+auto Update::run(iop::Network &network, const iop::StaticString path, const std::string_view authorization_header) noexcept -> iop_hal::UpdateStatus {
+    const auto filename = std::filesystem::current_path().append(iop_hal::execution_path());
+    // Kept next to the binary so the final rename is atomic, and across runs so interrupted downloads can be resumed
+    const auto partPath = filename.string().append(".update");
+    const auto progressPath = partPath + ".progress";
+
+    auto fd = open(partPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0755);
+    // The mode is only applied on creation and is subject to umask, but it will replace the binary
+    if (fd >= 0 && fchmod(fd, 0755) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        network.logger().error(IOP_STR("Unable to open firmware file: "));
+        network.logger().errorln(std::string_view(strerror(errno)));
+        return iop_hal::UpdateStatus::IO_ERROR;
+    }
+
+    // Only data that reached the disk before the progress was saved is trusted
+    auto progress = loadProgress(progressPath);
+    struct stat info;
+    if (progress && (fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) < progress->offset)) progress.reset();
+
+    auto download = Download(fd, progressPath, progress.value_or(Progress()));
+    MD5_Init(&download.md5);
+    if (!progress || ftruncate(fd, static_cast<off_t>(progress->offset)) < 0 || !hashPrefix(fd, download.md5, progress->offset)
+        || lseek(fd, static_cast<off_t>(progress->offset), SEEK_SET) < 0) {
+        progress.reset();
+        download.restart(download.progress.version, false);
+    }
+
+    if (progress) {
+        network.logger().info(IOP_STR("Resuming firmware download from: "));
+        network.logger().infoln(static_cast<uint64_t>(progress->offset));
+    }
+
+    const auto handler = [&download](const std::string_view chunk) { return download.write(chunk); };
+    const auto inspect = [&download](const iop_hal::Response &response) { return download.inspect(response); };
+    auto options = iop::StreamOptions();
+    options.offset = download.progress.offset;
+    options.accept = deltaFailed ? "application/octet-stream" : firmwareAccept;
+    options.inspect = inspect;
+    const auto response = network.httpStream(iop::HttpMethod::GET, authorization_header, path, std::string_view(), maxFirmwareSize, handler, options);
+
+    const auto status = response.status();
+    if (download.writeError != 0) {
+        network.logger().error(IOP_STR("Unable to write to firmware file: "));
+        network.logger().errorln(std::string_view(strerror(download.writeError)));
+        discardDownload(fd, partPath, progressPath);
+        return iop_hal::UpdateStatus::IO_ERROR;
+    } else if (response.code() == 416) {
+        // Range Not Satisfiable, the progress doesn't make sense to the server anymore
+        network.logger().warnln(IOP_STR("Server refused to resume the firmware download"));
+        discardDownload(fd, partPath, progressPath);
+        return iop_hal::UpdateStatus::BROKEN_SERVER;
+    } else if (!status || *status != iop::NetworkStatus::OK) {
         network.logger().error(IOP_STR("Invalid status returned by the server on update: "));
         network.logger().errorln(response.code());
+        // Interrupted downloads continue from here on the next try
+        download.checkpoint();
+        close(fd);
+        return status == iop::NetworkStatus::IO_ERROR ? iop_hal::UpdateStatus::IO_ERROR : iop_hal::UpdateStatus::BROKEN_SERVER;
+    } else if (download.progress.offset == 0) {
+        network.logger().errorln(IOP_STR("Update failed, no firmware returned"));
+        discardDownload(fd, partPath, progressPath);
+        return iop_hal::UpdateStatus::BROKEN_SERVER;
+    }
+
+    auto hash = hexDigest(download.md5);
+    auto installPath = partPath;
+    if (download.progress.delta) {
+        // The downloaded MD5 is the delta's, the image is verified after being reconstructed
+        const auto patchedPath = filename.string().append(".patched");
+        const auto patched = applyDelta(network, fd, download.progress.offset, filename, patchedPath);
+        discardDownload(fd, partPath, progressPath);
+        if (!patched) {
+            deltaFailed = true;
+            unlink(patchedPath.c_str());
+            return iop_hal::UpdateStatus::BROKEN_SERVER;
+        }
+        hash = *patched;
+        installPath = patchedPath;
+    } else {
+        // Ensures we never rename a partially written binary over the current one
+        if (fsync(fd) < 0) {
+            network.logger().error(IOP_STR("Unable to persist firmware file: "));
+            network.logger().errorln(std::string_view(strerror(errno)));
+            discardDownload(fd, partPath, progressPath);
+            return iop_hal::UpdateStatus::IO_ERROR;
+        }
+        close(fd);
+        unlink(progressPath.c_str());
+    }
+
+    // The server reports the latest firmware's MD5 in every response
+    const auto expected = response.header(IOP_STR("LATEST_VERSION"));
+    if (!expected) {
+        // Unverified images are never installed
+        network.logger().errorln(IOP_STR("Server didn't send the firmware MD5, unable to verify it"));
+        unlink(installPath.c_str());
+        return iop_hal::UpdateStatus::BROKEN_SERVER;
+    } else if (!sameVersion(expected, hash)) {
+        network.logger().error(IOP_STR("Firmware MD5 doesn't match: "));
+        network.logger().errorln(iop::to_view(hash));
+        unlink(installPath.c_str());
+        return iop_hal::UpdateStatus::BROKEN_SERVER;
+    }
+
+    network.logger().info(IOP_STR("Upgrading binary file: "));
+    network.logger().infoln(filename.string());
+
+    // Atomically replaces the binary, the running process keeps the old inode
+    if (rename(installPath.c_str(), filename.c_str()) < 0) {
+        network.logger().error(IOP_STR("Unable to replace binary: "));
+        network.logger().errorln(std::string_view(strerror(errno)));
+        unlink(installPath.c_str());
+        return iop_hal::UpdateStatus::IO_ERROR;
     }
 
-    return iop_hal::UpdateStatus::BROKEN_SERVER;
+    const auto dir = open(filename.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+
+    network.logger().infoln(IOP_STR("Upgrading runtime"));
+    const auto binary = filename.string();
+    char *const argv[] = { const_cast<char*>(binary.c_str()), nullptr };
+    execv(binary.c_str(), argv);
+
+    network.logger().error(IOP_STR("Unable to execute new binary: "));
+    network.logger().errorln(std::string_view(strerror(errno)));
+    return iop_hal::UpdateStatus::IO_ERROR;
 }
-} // namespace iop_hal
\ No newline at end of file
+} // namespace iop_hal
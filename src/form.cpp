@@ -0,0 +1,353 @@
+#include "iop-hal/form.hpp"
+#include "cpp17/http_parser.hpp"
+
+#include <strings.h>
+#include <algorithm>
+
+static auto hexValue(const char c) noexcept -> int {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static auto isSpace(const char c) noexcept -> bool {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/// Decodes percent escapes and pluses in place, returning the new length
+static auto urlDecode(char *data, const size_t length) noexcept -> std::optional<size_t> {
+  size_t out = 0;
+  for (size_t in = 0; in < length; ++in) {
+    if (data[in] == '+') {
+      data[out++] = ' ';
+    } else if (data[in] == '%') {
+      if (in + 2 >= length) return std::nullopt;
+      const auto high = hexValue(data[in + 1]);
+      const auto low = hexValue(data[in + 2]);
+      if (high < 0 || low < 0) return std::nullopt;
+      data[out++] = static_cast<char>((high << 4) | low);
+      in += 2;
+    } else {
+      data[out++] = data[in];
+    }
+  }
+  return out;
+}
+
+static auto parseHex4(const char *data) noexcept -> std::optional<uint32_t> {
+  uint32_t value = 0;
+  for (size_t index = 0; index < 4; ++index) {
+    const auto digit = hexValue(data[index]);
+    if (digit < 0) return std::nullopt;
+    value = (value << 4) | static_cast<uint32_t>(digit);
+  }
+  return value;
+}
+
+/// Decodes the escapes of a JSON string in place, returning the new length. UTF-8 is never longer than the escape
+static auto jsonUnescape(char *data, const size_t length) noexcept -> std::optional<size_t> {
+  size_t out = 0;
+  for (size_t in = 0; in < length; ++in) {
+    if (data[in] != '\\') {
+      data[out++] = data[in];
+      continue;
+    }
+    if (++in >= length) return std::nullopt;
+
+    switch (data[in]) {
+      case '"':
+      case '\\':
+      case '/':
+        data[out++] = data[in];
+        break;
+      case 'b':
+        data[out++] = '\b';
+        break;
+      case 'f':
+        data[out++] = '\f';
+        break;
+      case 'n':
+        data[out++] = '\n';
+        break;
+      case 'r':
+        data[out++] = '\r';
+        break;
+      case 't':
+        data[out++] = '\t';
+        break;
+      case 'u': {
+        if (in + 4 >= length) return std::nullopt;
+        auto code = parseHex4(data + in + 1);
+        if (!code || (*code >= 0xDC00 && *code <= 0xDFFF)) return std::nullopt;
+        in += 4;
+
+        // Characters outside the BMP are escaped as surrogate pairs
+        if (*code >= 0xD800 && *code <= 0xDBFF) {
+          if (in + 6 >= length || data[in + 1] != '\\' || data[in + 2] != 'u') return std::nullopt;
+          const auto low = parseHex4(data + in + 3);
+          if (!low || *low < 0xDC00 || *low > 0xDFFF) return std::nullopt;
+          code = 0x10000 + ((*code - 0xD800) << 10) + (*low - 0xDC00);
+          in += 6;
+        }
+
+        if (*code < 0x80) {
+          data[out++] = static_cast<char>(*code);
+        } else if (*code < 0x800) {
+          data[out++] = static_cast<char>(0xC0 | (*code >> 6));
+          data[out++] = static_cast<char>(0x80 | (*code & 0x3F));
+        } else if (*code < 0x10000) {
+          data[out++] = static_cast<char>(0xE0 | (*code >> 12));
+          data[out++] = static_cast<char>(0x80 | ((*code >> 6) & 0x3F));
+          data[out++] = static_cast<char>(0x80 | (*code & 0x3F));
+        } else {
+          data[out++] = static_cast<char>(0xF0 | (*code >> 18));
+          data[out++] = static_cast<char>(0x80 | ((*code >> 12) & 0x3F));
+          data[out++] = static_cast<char>(0x80 | ((*code >> 6) & 0x3F));
+          data[out++] = static_cast<char>(0x80 | (*code & 0x3F));
+        }
+        break;
+      }
+      default:
+        return std::nullopt;
+    }
+  }
+  return out;
+}
+
+/// Index of the closing quote of the JSON string that starts at `start`
+static auto jsonStringEnd(const std::string_view json, size_t start) noexcept -> size_t {
+  for (++start; start < json.length(); ++start) {
+    if (json[start] == '\\') {
+      ++start;
+    } else if (json[start] == '"') {
+      return start;
+    }
+  }
+  return json.npos;
+}
+
+/// Index right after the JSON object or array that starts at `start`
+static auto jsonNestedEnd(const std::string_view json, size_t start) noexcept -> size_t {
+  size_t depth = 0;
+  for (; start < json.length(); ++start) {
+    const auto c = json[start];
+    if (c == '"') {
+      start = jsonStringEnd(json, start);
+      if (start == json.npos) return json.npos;
+    } else if (c == '{' || c == '[') {
+      ++depth;
+    } else if ((c == '}' || c == ']') && --depth == 0) {
+      return start + 1;
+    }
+  }
+  return json.npos;
+}
+
+/// Index of the `--boundary` delimiter at or after `start`. It must be a whole line, besides the close delimiter's `--`
+static auto findDelimiter(const std::string_view body, const std::string_view boundary, const size_t start) noexcept -> size_t {
+  auto position = start;
+  while ((position = body.find(boundary, position)) != body.npos) {
+    const auto delimiter = position - 2;
+    const auto lineStart = position >= start + 2 && (delimiter == 0 || (delimiter >= start + 2 && body.substr(delimiter - 2, 2) == "\r\n"));
+
+    auto end = position + boundary.length();
+    while (end < body.length() && (body[end] == ' ' || body[end] == '\t')) ++end;
+    const auto lineEnd = body.substr(end, 2) == "\r\n" || body.substr(position + boundary.length(), 2) == "--";
+    if (lineStart && lineEnd && body.substr(delimiter, 2) == "--") return delimiter;
+    ++position;
+  }
+  return body.npos;
+}
+
+/// The `name` parameter of a `Content-Disposition: form-data` header
+static auto dispositionName(std::string_view value) noexcept -> std::optional<std::string_view> {
+  while (value.length() > 0) {
+    const auto end = value.find(';');
+    auto param = value.substr(0, end);
+    value = end == value.npos ? std::string_view() : value.substr(end + 1);
+
+    while (param.length() > 0 && isSpace(param.front())) param = param.substr(1);
+    if (param.length() < 5 || strncasecmp(param.data(), "name=", 5) != 0) continue;
+
+    param = param.substr(5);
+    if (param.length() >= 2 && param.front() == '"' && param.back() == '"') param = param.substr(1, param.length() - 2);
+    return param;
+  }
+  return std::nullopt;
+}
+
+namespace iop_hal {
+auto FormIndex::urlEncoded(char *data, const size_t length) noexcept -> bool {
+  const auto input = std::string_view(data, length);
+  size_t start = 0;
+  while (start < length) {
+    const auto end = std::min(input.find('&', start), length);
+    const auto pair = input.substr(start, end - start);
+    const auto equals = std::min(pair.find('='), pair.length());
+    const auto valueStart = std::min(equals + 1, pair.length());
+
+    // Names are few and short, so they are decoded right away, to be compared
+    const auto name = urlDecode(data + start, equals);
+    if (pair.length() > 0 && name) {
+      this->fields.push_back(Field { std::string_view(data + start, *name), data + start + valueStart, pair.length() - valueStart, Encoding::URL });
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+auto FormIndex::multipart(char *data, const size_t length, const std::string_view boundary) noexcept -> bool {
+  const auto indexed = this->fields.size();
+  const auto valid = this->indexMultipart(data, length, boundary);
+  if (!valid) this->fields.resize(indexed);
+  return valid;
+}
+
+auto FormIndex::json(char *data, const size_t length) noexcept -> bool {
+  const auto indexed = this->fields.size();
+  const auto valid = this->indexJson(data, length);
+  if (!valid) this->fields.resize(indexed);
+  return valid;
+}
+
+auto FormIndex::indexMultipart(char *data, const size_t length, const std::string_view boundary) noexcept -> bool {
+  const auto body = std::string_view(data, length);
+  if (boundary.length() == 0) return false;
+
+  auto delimiter = findDelimiter(body, boundary, 0);
+  if (delimiter == body.npos) return false;
+  while (true) {
+    const auto position = delimiter + 2 + boundary.length();
+    // The close delimiter ends the body
+    if (body.substr(position, 2) == "--") return true;
+
+    const auto headersStart = body.find("\r\n", position);
+    if (headersStart == body.npos) return false;
+    const auto headersEnd = body.find("\r\n\r\n", headersStart);
+    if (headersEnd == body.npos) return false;
+    const auto contentStart = headersEnd + 4;
+    // The line break before the delimiter belongs to it
+    delimiter = findDelimiter(body, boundary, contentStart);
+    if (delimiter == body.npos) return false;
+    const auto contentEnd = delimiter - 2;
+
+    auto headers = body.substr(headersStart + 2, headersEnd - headersStart);
+    while (headers.length() > 0) {
+      const auto lineEnd = std::min(headers.find("\r\n"), headers.length());
+      const auto disposition = headerValue(headers.substr(0, lineEnd), "Content-Disposition");
+      headers = headers.substr(std::min(lineEnd + 2, headers.length()));
+      if (!disposition) continue;
+
+      if (const auto name = dispositionName(*disposition)) {
+        this->fields.push_back(Field { *name, data + contentStart, contentEnd - contentStart, Encoding::RAW });
+      }
+      break;
+    }
+  }
+}
+
+auto FormIndex::indexJson(char *data, const size_t length) noexcept -> bool {
+  const auto input = std::string_view(data, length);
+  size_t index = 0;
+  const auto skipSpaces = [&]() { while (index < length && isSpace(input[index])) ++index; };
+
+  skipSpaces();
+  if (index >= length || input[index] != '{') return false;
+  ++index;
+  skipSpaces();
+  if (index < length && input[index] == '}') {
+    ++index;
+    skipSpaces();
+    return index == length;
+  }
+
+  while (true) {
+    skipSpaces();
+    if (index >= length || input[index] != '"') return false;
+    const auto nameStart = index + 1;
+    const auto nameEnd = jsonStringEnd(input, index);
+    if (nameEnd == input.npos) return false;
+    index = nameEnd + 1;
+
+    skipSpaces();
+    if (index >= length || input[index] != ':') return false;
+    ++index;
+    skipSpaces();
+    if (index >= length) return false;
+
+    auto valueStart = index;
+    auto valueEnd = index;
+    auto encoding = Encoding::RAW;
+    if (input[index] == '"') {
+      valueStart = index + 1;
+      valueEnd = jsonStringEnd(input, index);
+      if (valueEnd == input.npos) return false;
+      index = valueEnd + 1;
+      encoding = Encoding::JSON;
+    } else if (input[index] == '{' || input[index] == '[') {
+      valueEnd = index = jsonNestedEnd(input, index);
+      if (index == input.npos) return false;
+    } else {
+      while (index < length && input[index] != ',' && input[index] != '}' && !isSpace(input[index])) ++index;
+      valueEnd = index;
+      if (valueEnd == valueStart) return false;
+    }
+
+    const auto name = jsonUnescape(data + nameStart, nameEnd - nameStart);
+    if (!name) return false;
+    const auto value = input.substr(valueStart, valueEnd - valueStart);
+    if (encoding != Encoding::RAW || value != "null") {
+      this->fields.push_back(Field { std::string_view(data + nameStart, *name), data + valueStart, value.length(), encoding });
+    }
+
+    skipSpaces();
+    if (index < length && input[index] == ',') {
+      ++index;
+    } else if (index < length && input[index] == '}') {
+      ++index;
+      skipSpaces();
+      return index == length;
+    } else {
+      return false;
+    }
+  }
+}
+
+auto FormIndex::body(char *data, const size_t length, std::string_view contentType) noexcept -> bool {
+  const auto paramsStart = std::min(contentType.find(';'), contentType.length());
+  auto params = contentType.substr(paramsStart);
+  auto mediaType = contentType.substr(0, paramsStart);
+  while (mediaType.length() > 0 && isSpace(mediaType.back())) mediaType = mediaType.substr(0, mediaType.length() - 1);
+
+  if (headerEquals(mediaType, "multipart/form-data")) {
+    const auto boundaryStart = params.find("boundary=");
+    if (boundaryStart == params.npos) return false;
+    auto boundary = params.substr(boundaryStart + 9);
+    boundary = boundary.substr(0, std::min(boundary.find(';'), boundary.length()));
+    if (boundary.length() >= 2 && boundary.front() == '"' && boundary.back() == '"') boundary = boundary.substr(1, boundary.length() - 2);
+    return this->multipart(data, length, boundary);
+  }
+
+  const auto json = std::string_view("json");
+  const auto isJson = headerEquals(mediaType, "application/json") ||
+    (mediaType.length() > json.length() + 1 && mediaType[mediaType.length() - json.length() - 1] == '+' && headerEquals(mediaType.substr(mediaType.length() - json.length()), json));
+  if (isJson) return this->json(data, length);
+  return this->urlEncoded(data, length);
+}
+
+auto FormIndex::get(const std::string_view name) noexcept -> std::optional<std::string_view> {
+  for (auto &field: this->fields) {
+    if (field.name != name) continue;
+
+    if (field.encoding != Encoding::RAW) {
+      const auto length = field.encoding == Encoding::URL ? urlDecode(field.value, field.length) : jsonUnescape(field.value, field.length);
+      if (!length) return std::nullopt;
+      field.length = *length;
+      field.encoding = Encoding::RAW;
+    }
+    return std::string_view(field.value, field.length);
+  }
+  return std::nullopt;
+}
+} // namespace iop_hal
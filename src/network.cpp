@@ -48,7 +48,7 @@ auto Network::httpGet(StaticString path, std::string_view token, std::string_vie
 }
 
 Network::Network(StaticString uri) noexcept
-  : logger_(IOP_STR("NETWORK")), uri_(uri) {
+  : logger_(IOP_STR("NETWORK")), uri_(uri), maxPayloadSize_(defaultMaxPayloadSize), requestEncoding_(std::nullopt), minCompressedSize_(defaultMinCompressedSize) {
   IOP_TRACE();
 }
 }
@@ -61,18 +61,122 @@ Network::Network(StaticString uri) noexcept
 #include "iop-hal/device.hpp"
 #include "iop-hal/client.hpp"
 #include "iop-hal/panic.hpp"
+#include "iop-hal/queue.hpp"
 #include "string.h"
 
+#include <charconv>
+#include <limits>
+#include <array>
+
 static iop_hal::HTTPClient http;
 
+static iop_hal::PersistentQueue queue;
+static bool coalesceQueue = false;
+static iop::time::milliseconds queueBackoff = 0;
+static iop::time::milliseconds nextDrain = 0;
+
 namespace iop {
 static auto methodToString(const HttpMethod &method) noexcept -> StaticString;
 
-auto prepareSession(Network  &network, iop_hal::Session &session, const std::optional<std::string_view> &token, const std::optional<std::string_view> &data) noexcept -> void {
+/// Appends without allocating, if the string has enough capacity
+static auto append(std::string &output, const StaticString str) noexcept -> void {
+  const auto length = str.length();
+  const auto start = output.length();
+  output.resize(start + length);
+  str.copy(&output[start], length);
+}
+
+static auto appendHeader(std::string &output, const StaticString key, const std::string_view value) noexcept -> void {
+  append(output, key);
+  output.append(": ").append(value).append("\r\n");
+}
+
+/// Headers that don't change while the firmware runs, serialized once
+static auto constantHeaders(const Network &network) noexcept -> std::string_view {
+  static std::string block;
+  static StaticString origin;
+  // Rebuilt if another network is used, reusing the buffer
+  if (block.length() > 0 && origin.get() == network.uri().get()) return block;
+  origin = network.uri();
+  block.clear();
+
+  // Authentication headers, identifies device and detects updates
+  const auto md5 = iop::to_view(iop_hal::device.firmwareMD5());
+  appendHeader(block, IOP_STR("VERSION"), md5);
+  appendHeader(block, IOP_STR("x-ESP8266-sketch-md5"), md5);
+  appendHeader(block, IOP_STR("MAC_ADDRESS"), iop::to_view(iop_hal::device.macAddress()));
+
+  append(block, IOP_STR("ORIGIN: "));
+  append(block, network.uri());
+  append(block, IOP_STR("\r\nDRIVER: "));
+  append(block, iop_hal::device.platform());
+  block.append("\r\n");
+  return block;
+}
+
+/// Serializes numeric headers into a fixed buffer, so measurements don't allocate for every request
+class NumericHeaders {
+  std::array<char, 512> buffer;
+  size_t length;
+
+public:
+  NumericHeaders() noexcept: buffer(), length(0) {}
+
+  /// Returns false, dropping the header, if it doesn't fit
+  auto add(const StaticString prefix, const std::string_view name, const uintmax_t value) noexcept -> bool {
+    const auto prefixLength = prefix.length();
+    // Separators plus the maximum number of digits of a `uintmax_t`
+    const auto maxLength = prefixLength + name.length() + 4 + std::numeric_limits<uintmax_t>::digits10 + 1;
+    if (this->length + maxLength > this->buffer.size()) return false;
+
+    auto *cursor = this->buffer.data() + this->length;
+    prefix.copy(cursor, prefixLength);
+    cursor = std::copy(name.begin(), name.end(), cursor + prefixLength);
+    *cursor++ = ':';
+    *cursor++ = ' ';
+    cursor = std::to_chars(cursor, this->buffer.end(), value).ptr;
+    *cursor++ = '\r';
+    *cursor++ = '\n';
+    this->length = static_cast<size_t>(cursor - this->buffer.data());
+    return true;
+  }
+
+  auto view() const noexcept -> std::string_view {
+    return std::string_view(this->buffer.data(), this->length);
+  }
+};
+
+/// Compresses the body if the network is set to, returns the encoding used. Bodies are sent as is if they are too small or don't shrink
+static auto compressBody(Network &network, const std::optional<std::string_view> &data, std::string &compressed) noexcept -> std::optional<iop_hal::ContentEncoding> {
+  const auto encoding = network.requestEncoding();
+  if (!encoding || !data || data->length() < network.minCompressedSize()) return std::nullopt;
+  if (!iop_hal::compress(*data, *encoding, compressed) || compressed.length() >= data->length()) {
+    network.logger().debugln(IOP_STR("Body didn't compress, sending it as is"));
+    return std::nullopt;
+  }
+
+  network.logger().debug(IOP_STR("Compressed body: "));
+  network.logger().debug(data->length());
+  network.logger().debug(IOP_STR(" -> "));
+  network.logger().debugln(compressed.length());
+  return encoding;
+}
+
+/// Only buffered requests accept compressed responses, the client decompresses them on Linux with `IOP_ZLIB`.
+/// Streams are ranged when resumed, but ranges of a compressed response count compressed bytes, and can't be decompressed alone
+static auto acceptCompressed(iop_hal::Session &session) noexcept -> void {
+#if (defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)) && defined(IOP_ZLIB)
+  session.addHeader(IOP_STR("Accept-Encoding"), IOP_STR("gzip, deflate"));
+#else
+  (void) session;
+#endif
+}
+
+auto prepareSession(Network  &network, iop_hal::Session &session, const std::optional<std::string_view> &token, const std::optional<std::string_view> &data, const std::optional<iop_hal::ContentEncoding> &encoding) noexcept -> void {
   network.logger().debugln(IOP_STR("Began HTTP connection"));
 
   if (token) {
-    session.setAuthorization(std::string(*token));
+    session.setAuthorization(*token);
   }
 
   // Currently only JSON is supported
@@ -80,34 +184,29 @@ auto prepareSession(Network  &network, iop_hal::Session &session, const std::opt
     session.addHeader(IOP_STR("Content-Type"), IOP_STR("application/json"));
   }
 
-  // Authentication headers, identifies device and detects updates, perf
-  // monitoring
-  {
-    auto str = iop::to_view(iop_hal::device.firmwareMD5());
-    session.addHeader(IOP_STR("VERSION"), str);
-    session.addHeader(IOP_STR("x-ESP8266-sketch-md5"), str);
-
-    str = iop::to_view(iop_hal::device.macAddress());
-    session.addHeader(IOP_STR("MAC_ADDRESS"), str);
+  if (encoding) {
+    session.addHeader(IOP_STR("Content-Encoding"), iop_hal::contentEncodingName(*encoding));
   }
 
-  {
-    // Could this cause memory fragmentation?
-    auto memory = iop_hal::thisThread.availableMemory();
+  session.addHeaders(constantHeaders(network));
 
-    session.addHeader(IOP_STR("FREE_STACK"), std::to_string(memory.availableStack));
+  // Perf monitoring
+  {
+    const auto memory = iop_hal::thisThread.availableMemory();
 
+    auto headers = NumericHeaders();
+    auto fits = headers.add(IOP_STR("FREE_STACK"), std::string_view(), memory.availableStack);
     for (const auto & item: memory.availableHeap) {
-      session.addHeader(IOP_STR("FREE_").toString().append(item.first), std::to_string(item.second));
+      fits = headers.add(IOP_STR("FREE_"), item.first, item.second) && fits;
     }
     for (const auto & item: memory.biggestHeapBlock) {
-      session.addHeader(IOP_STR("BIGGEST_BLOCK_").toString().append(item.first), std::to_string(item.second));
+      fits = headers.add(IOP_STR("BIGGEST_BLOCK_"), item.first, item.second) && fits;
     }
+    fits = headers.add(IOP_STR("VCC"), std::string_view(), iop_hal::device.vcc()) && fits;
+    fits = headers.add(IOP_STR("TIME_RUNNING"), std::string_view(), iop_hal::thisThread.timeRunning()) && fits;
+    if (!fits) network.logger().warnln(IOP_STR("Some monitoring headers were dropped, they don't fit the buffer"));
+    session.addHeaders(headers.view());
   }
-  session.addHeader(IOP_STR("VCC"), std::to_string(iop_hal::device.vcc()));
-  session.addHeader(IOP_STR("TIME_RUNNING"), std::to_string(iop_hal::thisThread.timeRunning()));
-  session.addHeader(IOP_STR("ORIGIN"), network.uri());
-  session.addHeader(IOP_STR("DRIVER"), iop_hal::device.platform());
 
   network.logger().debugln(IOP_STR("Making HTTP request"));
 }
@@ -136,10 +235,11 @@ auto beforeConnect(Network & network, StaticString path, const std::optional<std
   network.logger().debugln(IOP_STR("Begin"));
 }
 
-auto processResponse(Network & network, iop_hal::Response & response) noexcept -> iop_hal::Response {
+/// Logs the response and handles the update hook, returns false if there is nothing else to do with it
+auto inspectResponse(Network & network, iop_hal::Response & response) noexcept -> bool {
   const auto status = response.status();
   if (!status || *status == iop::NetworkStatus::IO_ERROR) {
-    return iop_hal::Response(response.code());
+    return false;
   }
 
   network.logger().debugln(IOP_STR("Made HTTP request"));
@@ -156,43 +256,65 @@ auto processResponse(Network & network, iop_hal::Response & response) noexcept -
   network.logger().debug(code);
   network.logger().debug(IOP_STR("): "));
   network.logger().debugln(static_cast<uint64_t>(*status));
+  return true;
+}
 
-  // TODO: this is broken because it's not lazy, it should be a HTTPClient setting that bails out if it's bigger, and encapsulated in the API
-  /*
-  constexpr const int32_t maxPayloadSizeAcceptable = 2048;
-  if (globalData.http().getSize() > maxPayloadSizeAcceptable) {
-    globalData.http().end();
-    const auto lengthStr = std::to_string(response.payload.length());
-    this->logger().error(IOP_STR("Payload from server was too big: "));
-    this->logger().errorln(lengthStr);
-    globalData.response() = iop_hal::Response(NetworkStatus::BROKEN_SERVER);
-    return globalData.response();
+auto processResponse(Network & network, iop_hal::Response & response) noexcept -> iop_hal::Response {
+  if (!inspectResponse(network, response)) {
+    return iop_hal::Response(response.code());
   }
-  */
 
+  const auto status = response.status();
   // We have to simplify the errors reported by this API (but they are logged)
   if (*status == iop::NetworkStatus::OK) {
-    // The payload is always downloaded, since we check for its size and the
-    // origin is trusted. If it's there it's supposed to be there.
-    const auto payload = std::move(response.await().payload);
+    // The payload is always downloaded, the origin is trusted. If it's there it's supposed to be there.
+    // But it's bounded, as a broken server could otherwise make us run out of memory
+    auto payload = response.await(network.maxPayloadSize());
+    if (!payload) {
+      network.logger().errorln(IOP_STR("Unable to download payload"));
+      return iop_hal::Response(iop::NetworkStatus::BROKEN_SERVER);
+    }
+
     network.logger().debug(IOP_STR("Payload ("));
-    network.logger().debug(payload.size());
+    network.logger().debug(payload->payload.size());
     network.logger().debug(IOP_STR("): "));
-    network.logger().debugln(iop::scapeNonPrintable(iop::to_view(payload).substr(0, payload.size() > 30 ? 30 : payload.size())));
-    return iop_hal::Response(iop_hal::Payload(payload), *status);
+    network.logger().debugln(iop::scapeNonPrintable(iop::to_view(payload->payload).substr(0, payload->payload.size() > 30 ? 30 : payload->payload.size())));
+    return iop_hal::Response(std::move(*payload), *status);
   }
   return iop_hal::Response(response.code());
 }
 
 auto generateRequestProcessor(Network * network, const std::optional<std::string_view> &token, const std::optional<std::string_view> &data, const StaticString method) noexcept -> std::function<iop_hal::Response (iop_hal::Session &)> {
   const auto func = [network, token, data, method](iop_hal::Session & session) {
-    prepareSession(*network, session, token, data);
-    auto response = session.sendRequest(method.toString(), data.value_or(std::string_view()));
+    std::string compressed;
+    const auto encoding = compressBody(*network, data, compressed);
+    prepareSession(*network, session, token, data, encoding);
+    acceptCompressed(session);
+    auto response = session.sendRequest(method.toString(), encoding ? compressed : data.value_or(std::string_view()));
     return processResponse(*network, response);
   };
   return func;
 }
 
+auto streamResponse(Network & network, iop_hal::Response & response, const size_t maxSize, const iop_hal::ChunkHandler &handler, const ResponseInspector &inspect) noexcept -> iop_hal::Response {
+  if (!inspectResponse(network, response) || *response.status() != iop::NetworkStatus::OK) {
+    return iop_hal::Response(response.code());
+  }
+
+  if (inspect && !inspect(response)) {
+    network.logger().debugln(IOP_STR("Payload refused"));
+    return iop_hal::Response(iop::NetworkStatus::BROKEN_CLIENT);
+  }
+
+  const auto status = response.stream(maxSize, handler);
+  if (status != iop::NetworkStatus::OK) {
+    network.logger().errorln(IOP_STR("Unable to stream payload"));
+    return iop_hal::Response(status);
+  }
+  response.detach();
+  return std::move(response);
+}
+
 // Returns Response if it can understand what the server sent
 auto Network::httpRequest(const HttpMethod method_,
                           const std::optional<std::string_view> &token, StaticString path,
@@ -205,13 +327,300 @@ auto Network::httpRequest(const HttpMethod method_,
   return http.begin(this->endpoint(path), func);
 }
 
+auto Network::httpRequestAsync(const HttpMethod method_,
+                               const std::optional<std::string_view> &token, StaticString path,
+                               const std::optional<std::string_view> &data) noexcept
+    -> iop_hal::AsyncRequest {
+  IOP_TRACE();
+  const auto method = methodToString(method_);
+  beforeConnect(*this, path, token, data, method);
+  // The client copies the body right away
+  std::string compressed;
+  const auto encoding = compressBody(*this, data, compressed);
+  // Sessions may be prepared after this returns, so they can't reference the arguments
+  const auto ownedToken = token ? std::make_optional(std::string(*token)) : std::nullopt;
+  const auto hasData = data.has_value();
+  const auto prepare = [this, ownedToken, hasData, encoding](iop_hal::Session & session) {
+    const auto token = ownedToken ? std::make_optional(std::string_view(*ownedToken)) : std::nullopt;
+    prepareSession(*this, session, token, hasData ? std::make_optional(std::string_view()) : std::nullopt, encoding);
+    acceptCompressed(session);
+  };
+  const auto process = [this](iop_hal::Response & response) {
+    return processResponse(*this, response);
+  };
+  return http.beginAsync(this->endpoint(path), method.toString(), encoding ? compressed : data.value_or(std::string_view()), this->maxPayloadSize(), prepare, process);
+}
+
+auto Network::httpStream(const HttpMethod method_,
+                         const std::optional<std::string_view> &token, StaticString path,
+                         const std::optional<std::string_view> &data, const size_t maxSize,
+                         const iop_hal::ChunkHandler &handler, const StreamOptions &options) noexcept
+    -> iop_hal::Response {
+  IOP_TRACE();
+  const auto method = methodToString(method_);
+  beforeConnect(*this, path, token, data, method);
+  const auto func = [this, &token, &data, method, maxSize, &handler, &options](iop_hal::Session & session) {
+    std::string compressed;
+    const auto encoding = compressBody(*this, data, compressed);
+    prepareSession(*this, session, token, data, encoding);
+    // See `acceptCompressed`, a missing Accept-Encoding would accept any coding
+    session.addHeader(IOP_STR("Accept-Encoding"), IOP_STR("identity"));
+    if (options.offset > 0) {
+      session.addHeader(IOP_STR("Range"), std::string("bytes=").append(std::to_string(options.offset)).append("-"));
+    }
+    if (options.accept.length() > 0) {
+      session.addHeader(IOP_STR("Accept"), options.accept);
+    }
+    auto response = session.sendRequest(method.toString(), encoding ? compressed : data.value_or(std::string_view()));
+    return streamResponse(*this, response, maxSize, handler, options.inspect);
+  };
+  return http.begin(this->endpoint(path), func);
+}
+
+/// Hands every item its response
+static auto demultiplex(const Batch &batch, std::vector<iop_hal::Response> &responses) noexcept -> void {
+  for (size_t index = 0; index < batch.size(); ++index) {
+    const auto &callback = batch.items()[index].callback;
+    if (callback) callback(responses[index]);
+  }
+}
+
+auto Network::httpBatch(const std::optional<std::string_view> &token, const Batch &batch) noexcept -> std::vector<iop_hal::Response> {
+  IOP_TRACE();
+  Network::setup();
+  this->logger().debug(IOP_STR("Pipelining requests: "));
+  this->logger().debugln(batch.size());
+
+  // Targets are relative to the origin, so they keep the uri's path, like `endpoint` does
+  const auto uri = this->uri().toString();
+  const auto scheme = uri.find("://");
+  const auto pathStart = uri.find('/', scheme == uri.npos ? 0 : scheme + 3);
+  const auto basePath = pathStart == uri.npos ? std::string_view() : std::string_view(uri).substr(pathStart);
+
+  // Items with data are JSON, as in `prepareSession`
+  constexpr static char jsonContentType[] = "Content-Type: application/json\r\n";
+
+  // Copied out of flash, the requests reference them
+  std::vector<std::string> methods, paths;
+  std::vector<iop_hal::PipelinedRequest> requests;
+  methods.reserve(batch.size());
+  paths.reserve(batch.size());
+  requests.reserve(batch.size());
+  for (const auto &item : batch.items()) {
+    methods.push_back(methodToString(item.method).toString());
+    paths.push_back(std::string(basePath).append(item.path.toString()));
+    const auto headers = item.data.length() > 0 ? std::string_view(jsonContentType) : std::string_view();
+    requests.push_back(iop_hal::PipelinedRequest { methods.back(), paths.back(), item.data, headers });
+  }
+
+  std::vector<iop_hal::Response> responses;
+  if (!batch.isEmpty()) {
+    http.begin(uri, [this, &token, &requests, &responses](iop_hal::Session &session) {
+      const auto prepare = [this, &token](iop_hal::Session &session) {
+        prepareSession(*this, session, token, std::nullopt, std::nullopt);
+        acceptCompressed(session);
+      };
+      responses = session.sendRequests(requests, this->maxPayloadSize(), prepare);
+      return iop_hal::Response(iop::NetworkStatus::OK);
+    });
+  }
+
+  // The connection may have failed before the requests were sent
+  while (responses.size() < batch.size()) responses.emplace_back(iop::NetworkStatus::IO_ERROR);
+  for (auto &response : responses) response = processResponse(*this, response);
+  demultiplex(batch, responses);
+  return responses;
+}
+
+/// Splits the next `<code> <length>\n<body>` frame of a merged response
+static auto nextFrame(std::string_view &input) noexcept -> std::optional<iop_hal::Response> {
+  const auto end = input.find('\n');
+  if (end == input.npos) return std::nullopt;
+  const auto line = input.substr(0, end);
+  const auto separator = line.find(' ');
+  if (separator == line.npos) return std::nullopt;
+
+  int code = 0;
+  size_t length = 0;
+  const auto codeEnd = line.data() + separator;
+  if (std::from_chars(line.data(), codeEnd, code).ptr != codeEnd) return std::nullopt;
+  if (std::from_chars(codeEnd + 1, line.end(), length).ptr != line.end()) return std::nullopt;
+  if (input.length() - end - 1 < length) return std::nullopt;
+
+  const auto body = input.substr(end + 1, length);
+  input.remove_prefix(end + 1 + length);
+  return iop_hal::Response({}, iop_hal::Payload(std::vector<uint8_t>(body.begin(), body.end())), code);
+}
+
+auto Network::httpBatchMerged(const std::optional<std::string_view> &token, const StaticString path, const Batch &batch) noexcept -> std::vector<iop_hal::Response> {
+  IOP_TRACE();
+  std::string body;
+  std::array<char, 20> length;
+  for (const auto &item : batch.items()) {
+    append(body, methodToString(item.method));
+    body.push_back(' ');
+    append(body, item.path);
+    body.push_back(' ');
+    body.append(length.data(), static_cast<size_t>(std::to_chars(length.begin(), length.end(), item.data.length()).ptr - length.data()));
+    body.push_back('\n');
+    body.append(item.data);
+  }
+
+  const auto maxSize = this->maxPayloadSize() * batch.size();
+  beforeConnect(*this, path, token, body, IOP_STR("POST"));
+  auto merged = http.begin(this->endpoint(path), [this, &token, &body, maxSize](iop_hal::Session &session) {
+    std::string compressed;
+    const auto encoding = compressBody(*this, body, compressed);
+    prepareSession(*this, session, token, std::nullopt, encoding);
+    session.addHeader(IOP_STR("Content-Type"), IOP_STR("application/x-iop-batch"));
+    acceptCompressed(session);
+    auto response = session.sendRequest("POST", encoding ? compressed : body);
+    if (!inspectResponse(*this, response) || *response.status() != iop::NetworkStatus::OK) return iop_hal::Response(response.code());
+
+    auto payload = response.await(maxSize);
+    if (!payload) {
+      this->logger().errorln(IOP_STR("Unable to download merged payload"));
+      return iop_hal::Response(iop::NetworkStatus::BROKEN_SERVER);
+    }
+    return iop_hal::Response(std::move(*payload), iop::NetworkStatus::OK);
+  });
+
+  std::vector<iop_hal::Response> responses;
+  responses.reserve(batch.size());
+  if (merged.status() == iop::NetworkStatus::OK) {
+    const auto payload = merged.await(maxSize).value_or(iop_hal::Payload());
+    auto input = iop::to_view(payload.payload);
+    while (responses.size() < batch.size()) {
+      auto response = nextFrame(input);
+      if (!response) {
+        this->logger().errorln(IOP_STR("Invalid merged response, missing frames"));
+        break;
+      }
+      responses.push_back(std::move(*response));
+    }
+  }
+
+  // Items without a frame share the fate of the merged request
+  const auto code = merged.status() == iop::NetworkStatus::OK ? static_cast<int>(iop::NetworkStatus::BROKEN_SERVER) : merged.code();
+  while (responses.size() < batch.size()) responses.emplace_back(code);
+  demultiplex(batch, responses);
+  return responses;
+}
+
+/// Failures that may go away by themselves, or with a new token
+static auto isTransient(const int code) noexcept -> bool {
+  if (code <= 0 || code >= 500) return true;
+  return code == 401 || code == 408 || code == 429;
+}
+
+static auto backOff(Network &network) noexcept -> void {
+  queueBackoff = std::min(std::max(queueBackoff * 2, Network::initialBackoff), Network::maxBackoff);
+  nextDrain = iop_hal::thisThread.timeRunning() + queueBackoff;
+  network.logger().warn(IOP_STR("Delivery failed, backing off for ms: "));
+  network.logger().warnln(queueBackoff);
+}
+
+static auto canDeliver() noexcept -> bool {
+  return Network::isConnected() && iop_hal::thisThread.timeRunning() >= nextDrain;
+}
+
+auto Network::setupQueue(const uintmax_t address, const size_t size, const bool coalesce) noexcept -> bool {
+  IOP_TRACE();
+  coalesceQueue = coalesce;
+  return queue.setup(address, size);
+}
+
+auto Network::flushQueue() noexcept -> bool {
+  IOP_TRACE();
+  return queue.flush();
+}
+
+/// Delivers queued records like `Network::drainQueue`, `last` is left with the response of the last delivery
+static auto drain(Network &network, const std::string_view token, iop_hal::Response &last) noexcept -> bool {
+  if (queue.isEmpty()) return true;
+  if (!canDeliver()) return false;
+
+  std::vector<iop_hal::QueuedRecord> records;
+  std::string body;
+  size_t delivered = 0;
+  while (!queue.isEmpty() && delivered < Network::maxBatchRecords) {
+    queue.front(records, coalesceQueue ? Network::maxBatchRecords - delivered : 1, Network::maxBatchSize);
+    const auto path = std::string_view(records.front().path);
+    const auto end = std::find_if(records.begin(), records.end(), [path](const iop_hal::QueuedRecord &record) { return record.path != path; });
+    records.erase(end, records.end());
+
+    auto data = std::string_view(records.front().data);
+    if (records.size() > 1) {
+      body.assign("[");
+      for (const auto &record : records) {
+        if (body.length() > 1) body.push_back(',');
+        body.append(record.data);
+      }
+      body.push_back(']');
+      data = body;
+    }
+
+    Network::setup();
+    network.logger().debug(IOP_STR("Delivering queued records ("));
+    network.logger().debug(records.size());
+    network.logger().debug(IOP_STR(") to "));
+    network.logger().debugln(path);
+    const auto func = generateRequestProcessor(&network, token, data, IOP_STR("POST"));
+    last = http.begin(network.uri().toString().append(path), func);
+    const auto code = last.code();
+    if (isTransient(code)) {
+      backOff(network);
+      queue.commit();
+      return false;
+    }
+    if (code < 200 || code >= 300) {
+      network.logger().error(IOP_STR("Queued records were refused, dropping them: "));
+      network.logger().errorln(code);
+    }
+
+    queueBackoff = 0;
+    queue.pop(records.size());
+    delivered += records.size();
+  }
+  return queue.isEmpty();
+}
+
+auto Network::httpPostQueued(const std::string_view token, const StaticString path, const std::string_view data) noexcept -> iop_hal::Response {
+  IOP_TRACE();
+  auto response = iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+  // Records queued before this one must be delivered first
+  if (queue.isEmpty() && canDeliver()) {
+    response = this->httpPost(token, path, data);
+    if (!isTransient(response.code())) {
+      queueBackoff = 0;
+      return response;
+    }
+    backOff(*this);
+  }
+
+  if (!queue.push(path.toString(), data)) {
+    this->logger().errorln(IOP_STR("Unable to queue record, it was lost"));
+    return response;
+  }
+  // The record is the last one queued, so if the queue drains the last delivery carried it
+  auto delivery = iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+  if (drain(*this, token, delivery)) return delivery;
+  return response;
+}
+
+auto Network::drainQueue(const std::string_view token) noexcept -> bool {
+  IOP_TRACE();
+  auto delivery = iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+  return drain(*this, token, delivery);
+}
+
 auto Network::setup() noexcept -> void {
   IOP_TRACE();
   static bool initialized = false;
   if (initialized) return;
   initialized = true;
 
-  http.headersToCollect({"LATEST_VERSION"});
+  http.headersToCollect({"LATEST_VERSION", "Content-Range", "Content-Type"});
 
   iop::wifi.setup();
 }
@@ -35,12 +35,32 @@ void Session::addHeader(iop::StaticString key, iop::StaticString value) noexcept
 void Session::addHeader(iop::StaticString key, std::string_view value) noexcept { (void) key; (void) value; }
 void Session::addHeader(std::string_view key, iop::StaticString value) noexcept { (void) key; (void) value; }
 void Session::addHeader(std::string_view key, std::string_view value) noexcept { (void) key; (void) value; }
-void Session::setAuthorization(std::string auth) noexcept { (void) auth; }
+void Session::addHeaders(std::string_view block) noexcept { (void) block; }
+void Session::setAuthorization(std::string_view auth) noexcept { (void) auth; }
 auto Session::sendRequest(const std::string method, const std::string_view data) noexcept -> Response { (void) method; (void) data; return Response(500); }
+auto Session::sendRequests(const std::vector<PipelinedRequest> &requests, const size_t maxSize, const std::function<void(Session &)> &prepare) noexcept -> std::vector<Response> {
+  (void) maxSize;
+  (void) prepare;
+  std::vector<Response> responses;
+  for (size_t index = 0; index < requests.size(); ++index) responses.emplace_back(500);
+  return responses;
+}
 
 auto HTTPClient::setup() noexcept -> void {}
 HTTPClient::HTTPClient() noexcept {}
 HTTPClient::~HTTPClient() noexcept {}
 
 auto HTTPClient::begin(std::string_view uri, std::function<Response(Session &)> func) noexcept -> Response { (void) uri; (void) func; return Response(iop::NetworkStatus::OK); }
+
+class AsyncContext {
+public:
+  auto done() const noexcept -> bool { return true; }
+  auto take() noexcept -> Response { return Response(iop::NetworkStatus::OK); }
+  auto poll() noexcept -> bool { return true; }
+};
+auto HTTPClient::beginAsync(std::string_view uri, std::string_view method, std::string_view data, size_t maxSize, std::function<void(Session &)> prepare, std::function<Response(Response &)> process) noexcept -> AsyncRequest {
+  (void) uri; (void) method; (void) data; (void) maxSize; (void) prepare; (void) process;
+  return AsyncRequest(std::unique_ptr<AsyncContext>(new (std::nothrow) AsyncContext()));
+}
+static void waitForRequests(const std::vector<AsyncContext *> &requests, const iop::time::milliseconds timeout) noexcept { (void) requests; (void) timeout; }
 }
\ No newline at end of file
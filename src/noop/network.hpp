@@ -15,4 +15,58 @@ auto Network::httpRequest(const HttpMethod method_,
   IOP_TRACE();
   return iop_hal::Response(NetworkStatus::OK);
 }
+auto Network::httpStream(const HttpMethod method_,
+                         const std::optional<std::string_view> &token, StaticString path,
+                         const std::optional<std::string_view> &data, const size_t maxSize,
+                         const iop_hal::ChunkHandler &handler, const StreamOptions &options) noexcept
+    -> iop_hal::Response {
+  (void)token;
+  (void)method_;
+  (void)path;
+  (void)data;
+  (void)maxSize;
+  (void)handler;
+  (void)options;
+  IOP_TRACE();
+  return iop_hal::Response(NetworkStatus::OK);
+}
+auto Network::httpRequestAsync(const HttpMethod method_,
+                               const std::optional<std::string_view> &token, StaticString path,
+                               const std::optional<std::string_view> &data) noexcept
+    -> iop_hal::AsyncRequest {
+  (void) method_;
+  (void) token;
+  IOP_TRACE();
+  return iop_hal::HTTPClient().beginAsync(this->endpoint(path), std::string_view(), data.value_or(std::string_view()), 0, nullptr, nullptr);
+}
+auto Network::setupQueue(const uintmax_t address, const size_t size, const bool coalesce) noexcept -> bool {
+  (void) address;
+  (void) size;
+  (void) coalesce;
+  IOP_TRACE();
+  return true;
+}
+auto Network::flushQueue() noexcept -> bool {
+  IOP_TRACE();
+  return true;
+}
+auto Network::httpPostQueued(const std::string_view token, const StaticString path, const std::string_view data) noexcept -> iop_hal::Response {
+  return this->httpRequest(HttpMethod::POST, token, path, data);
+}
+auto Network::drainQueue(const std::string_view token) noexcept -> bool {
+  (void) token;
+  IOP_TRACE();
+  return true;
+}
+auto Network::httpBatch(const std::optional<std::string_view> &token, const Batch &batch) noexcept -> std::vector<iop_hal::Response> {
+  (void) token;
+  IOP_TRACE();
+  std::vector<iop_hal::Response> responses;
+  for (size_t index = 0; index < batch.size(); ++index) responses.emplace_back(NetworkStatus::OK);
+  return responses;
+}
+auto Network::httpBatchMerged(const std::optional<std::string_view> &token, StaticString path, const Batch &batch) noexcept -> std::vector<iop_hal::Response> {
+  (void) path;
+  return this->httpBatch(token, batch);
+}
 }
\ No newline at end of file
@@ -0,0 +1,17 @@
+#include "iop-hal/queue.hpp"
+
+#include <cstring>
+
+namespace iop_hal {
+auto PersistentQueue::load() noexcept -> bool {
+  this->region.assign(this->capacity, 0);
+  return true;
+}
+auto PersistentQueue::readBytes(const size_t offset, uint8_t *output, const size_t length) const noexcept -> void {
+  memcpy(output, this->region.data() + offset, length);
+}
+auto PersistentQueue::writeBytes(const size_t offset, const uint8_t *input, const size_t length) noexcept -> void {
+  memcpy(this->region.data() + offset, input, length);
+}
+auto PersistentQueue::persist() noexcept -> bool { return true; }
+}
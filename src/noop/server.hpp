@@ -7,6 +7,12 @@ void HttpConnection::sendHeader(iop::StaticString name, iop::StaticString value)
 void HttpConnection::send(uint16_t code, iop::StaticString type, iop::StaticString data) const noexcept { (void) code; (void) type, (void) data; }
 void HttpConnection::sendData(iop::StaticString data) const noexcept { (void) data; }
 void HttpConnection::setContentLength(size_t length) noexcept { (void) length; }
+void HttpConnection::beginResponse(uint16_t code, iop::StaticString type) noexcept { (void) code; (void) type; }
+auto HttpConnection::write(std::string_view data) noexcept -> bool { (void) data; return false; }
+auto HttpConnection::write(iop::StaticString data) noexcept -> bool { (void) data; return false; }
+void HttpConnection::endResponse() noexcept {}
+void HttpConnection::onWritable(Writer writer) noexcept { (void) writer; }
+void HttpConnection::sendAsset(const StaticAsset &asset) noexcept { (void) asset; }
 void HttpConnection::reset() noexcept {}
 HttpServer::HttpServer(uint32_t port) noexcept { (void) port; }
 void HttpServer::begin() noexcept {}
@@ -4,4 +4,5 @@ namespace iop {
 // StaticString needs platform specific API, so we just noop it
 auto StaticString::toString() const noexcept -> std::string { return ""; }
 auto StaticString::length() const noexcept -> size_t { return 0; }
+auto StaticString::copy(char *destination, const size_t size) const noexcept -> void { (void) destination; (void) size; }
 }
\ No newline at end of file
@@ -2,6 +2,12 @@
 #include "iop-hal/network.hpp"
 #include "iop-hal/panic.hpp"
 #include "iop-hal/wifi.hpp"
+#include "iop-hal/thread.hpp"
+#include "cpp17/http_parser.hpp"
+#include "posix/resolver.hpp"
+#ifdef IOP_ZLIB
+#include "posix/inflate.hpp"
+#endif
 
 #include <system_error>
 #include <vector>
@@ -9,20 +15,25 @@
 #include <unordered_map>
 #include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <array>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 
 // LINUX
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netdb.h>
-#include <filesystem>
+#include <fcntl.h>
+#include <poll.h>
+#include <climits>
 
 #ifdef IOP_SSL
 #include <openssl/ssl.h>
-
-#include <fstream>
+#include <openssl/pem.h>
 
 #include "openssl/generated/certificates.hpp"
 
@@ -32,18 +43,17 @@ class BIO;
 #endif
 
 constexpr size_t bufferSize = 8192;
+constexpr size_t maxPooledConnections = 4;
+// Unread bodies up to this size are discarded to reuse the connection, bigger ones close it
+constexpr size_t maxDrainSize = 16 * 1024;
+constexpr iop::time::milliseconds connectionIdleTimeout = 30000;
+// Maximum TLS plaintext record size
+constexpr size_t maxRecordSize = 16 * 1024;
+// Async requests are aborted if they take longer than this, from the connection to the end of the body
+constexpr iop::time::milliseconds asyncRequestTimeout = 60000;
 
 static iop::Log clientDriverLogger(IOP_STR("HTTP Client"));
 
-auto shiftChars(char* ptr, const size_t start, const size_t end) noexcept {
-  //clientDriverLogger.debug(std::string_view(ptr).substr(start, end));
-  //clientDriverLogger.debug(static_cast<uint64_t>(start));
-  //clientDriverLogger.debug(IOP_STR(" "));
-  //clientDriverLogger.debugln(static_cast<uint64_t>(end));
-  memmove(ptr, ptr + start, end);
-  memset(ptr + end, '\0', bufferSize - end);
-}
-
 namespace iop {
 auto Network::codeToString(const int code) const noexcept -> std::string {
   IOP_TRACE();
@@ -63,12 +73,23 @@ namespace iop_hal {
 class SessionContext {
 public:
   int fd;
-  std::vector<std::string> headersToCollect;
-  std::unordered_map<std::string, std::string> headers;
+  const std::vector<std::string> &headersToCollect;
+  // Serialized request headers, the buffer is owned by the client and reused by every request
+  std::string &headers;
   std::string_view uri;
   BIO *bio;
-
-  SessionContext(int fd, std::vector<std::string> headersToCollect, std::string_view uri, BIO *bio) noexcept: fd(fd), headersToCollect(headersToCollect), headers({}), uri(uri), bio(bio) {}
+  std::string_view authority;
+  // Set by `Session::sendRequest` if the connection was closed before any response arrived
+  bool stale;
+  // The body is read lazily, so the parser and the unconsumed part of the buffer outlive `Session::sendRequest`
+  std::unique_ptr<char[]> buffer;
+  std::optional<ResponseParser> parser;
+  std::string_view input;
+
+  SessionContext(int fd, const std::vector<std::string> &headersToCollect, std::string &headers, std::string_view uri, BIO *bio, std::string_view authority) noexcept:
+    fd(fd), headersToCollect(headersToCollect), headers(headers), uri(uri), bio(bio), authority(authority), stale(false), buffer(), parser(), input() {
+    this->headers.clear();
+  }
 
   SessionContext(SessionContext &&other) noexcept = delete;
   SessionContext(const SessionContext &other) noexcept = delete;
@@ -81,6 +102,8 @@ auto networkStatus(const int code) noexcept -> std::optional<iop::NetworkStatus>
   IOP_TRACE();
   switch (code) {
   case 200:
+  // Partial Content, the requested range of the body
+  case 206:
     return iop::NetworkStatus::OK;
   case 500:
     return iop::NetworkStatus::BROKEN_SERVER;
@@ -89,17 +112,48 @@ auto networkStatus(const int code) noexcept -> std::optional<iop::NetworkStatus>
   }
   return std::nullopt;
 }
-HTTPClient::HTTPClient() noexcept: headersToCollect_() {}
+HTTPClient::HTTPClient() noexcept: headersToCollect_(), requestHeaders_() {}
 HTTPClient::~HTTPClient() noexcept {}
 
-static ssize_t send(const SessionContext &ctx, const char * msg, const size_t len) noexcept {
-  if (clientDriverLogger.isTracing()) iop::Log::print(msg, iop::LogLevel::TRACE, iop::LogType::STARTEND);
+/// Writes all buffers, retrying partial writes. Plain sockets take them in a single `writev`
+static auto send(const SessionContext &ctx, iovec *iov, size_t count) noexcept -> bool {
   #ifdef IOP_SSL
   if (ctx.bio) {
-    return BIO_write(ctx.bio, msg, len);
+    for (; count > 0; ++iov, --count) {
+      const auto *data = static_cast<const char*>(iov->iov_base);
+      auto left = iov->iov_len;
+      while (left > 0) {
+        const auto sent = BIO_write(ctx.bio, data, static_cast<int>(left));
+        if (sent <= 0) return false;
+        data += sent;
+        left -= static_cast<size_t>(sent);
+      }
+    }
+    return true;
   }
   #endif
-  return write(ctx.fd, msg, len);
+
+  while (true) {
+    while (count > 0 && iov->iov_len == 0) {
+      ++iov;
+      --count;
+    }
+    if (count == 0) return true;
+
+    const auto sent = writev(ctx.fd, iov, static_cast<int>(count));
+    if (sent < 0 && errno == EINTR) continue;
+    if (sent <= 0) return false;
+
+    auto left = static_cast<size_t>(sent);
+    while (left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++iov;
+      --count;
+      if (count == 0) return true;
+    }
+    iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+    iov->iov_len -= left;
+  }
 }
 static ssize_t recv(const SessionContext &ctx, char *buffer, const size_t len) noexcept {
   #ifdef IOP_SSL
@@ -110,6 +164,126 @@ static ssize_t recv(const SessionContext &ctx, char *buffer, const size_t len) n
   return read(ctx.fd, buffer, len);
 }
 
+static auto logReadError(const ssize_t signedSize) noexcept -> void {
+  clientDriverLogger.error(IOP_STR("Error reading from socket ("));
+  clientDriverLogger.error(static_cast<int64_t>(signedSize));
+  clientDriverLogger.error(IOP_STR("): "));
+  clientDriverLogger.error(static_cast<uint64_t>(errno));
+  clientDriverLogger.error(IOP_STR(" - "));
+  clientDriverLogger.errorln(std::string_view(strerror(errno)));
+}
+
+/// Feeds the rest of the body to `handler`, starting with what's left in the buffer from previous reads.
+///
+/// Compressed bodies are decompressed as they arrive, `maxSize` bounds both their compressed and decompressed sizes
+static auto readBody(SessionContext &ctx, const size_t maxSize, const ChunkHandler &handler) noexcept -> iop::NetworkStatus {
+  if (!ctx.parser) return iop::NetworkStatus::IO_ERROR;
+  auto &parser = *ctx.parser;
+
+  if (parser.contentLength() && *parser.contentLength() > maxSize) {
+    clientDriverLogger.error(IOP_STR("Payload from server was too big: "));
+    clientDriverLogger.errorln(static_cast<uint64_t>(*parser.contentLength()));
+    return iop::NetworkStatus::BROKEN_SERVER;
+  }
+
+  size_t size = 0;
+  auto status = iop::NetworkStatus::OK;
+  const ChunkHandler emit = [&size, &status, maxSize, &handler](const std::string_view piece) {
+    size += piece.length();
+    if (size > maxSize) {
+      clientDriverLogger.error(IOP_STR("Payload from server was too big, aborted after: "));
+      clientDriverLogger.errorln(static_cast<uint64_t>(size));
+      status = iop::NetworkStatus::BROKEN_SERVER;
+      return false;
+    }
+    if (!handler(piece)) {
+      status = iop::NetworkStatus::BROKEN_CLIENT;
+      return false;
+    }
+    return true;
+  };
+
+#ifdef IOP_ZLIB
+  std::optional<Inflater> inflater;
+  if (parser.encoded()) inflater.emplace();
+#endif
+
+  while (true) {
+    while (ctx.input.length() > 0 && parser.state() != ResponseParser::State::DONE && parser.state() != ResponseParser::State::ERROR) {
+      const auto body = parser.parse(ctx.input);
+      if (body.length() == 0) continue;
+
+#ifdef IOP_ZLIB
+      if (inflater) {
+        if (inflater->feed(body, emit)) continue;
+        if (status == iop::NetworkStatus::OK) {
+          clientDriverLogger.errorln(IOP_STR("Invalid compressed payload"));
+          status = iop::NetworkStatus::BROKEN_SERVER;
+        }
+        return status;
+      }
+#endif
+      if (!emit(body)) return status;
+    }
+
+    if (parser.state() == ResponseParser::State::DONE) {
+#ifdef IOP_ZLIB
+      if (inflater && !inflater->complete()) {
+        clientDriverLogger.errorln(IOP_STR("Compressed payload was truncated"));
+        return iop::NetworkStatus::BROKEN_SERVER;
+      }
+#endif
+      clientDriverLogger.debug(IOP_STR("Payload length: "));
+      clientDriverLogger.debugln(static_cast<uint64_t>(size));
+      return iop::NetworkStatus::OK;
+    }
+    if (parser.state() == ResponseParser::State::ERROR) {
+      clientDriverLogger.errorln(IOP_STR("Invalid response body"));
+      return iop::NetworkStatus::BROKEN_SERVER;
+    }
+
+    const auto signedSize = recv(ctx, ctx.buffer.get(), bufferSize);
+    if (signedSize < 0) {
+      logReadError(signedSize);
+      return iop::NetworkStatus::IO_ERROR;
+    }
+    if (signedSize == 0) {
+      clientDriverLogger.debugln(IOP_STR("EOF"));
+      parser.finish();
+      if (parser.state() != ResponseParser::State::DONE) return iop::NetworkStatus::IO_ERROR;
+      continue;
+    }
+
+    clientDriverLogger.debug(IOP_STR("Len: "));
+    clientDriverLogger.debugln(static_cast<uint64_t>(signedSize));
+    ctx.input = std::string_view(ctx.buffer.get(), static_cast<size_t>(signedSize));
+  }
+}
+
+#ifdef IOP_ZLIB
+/// Decompresses a body that was downloaded whole, bounded by `maxSize`
+static auto inflateBody(const std::vector<uint8_t> &body, const size_t maxSize, std::vector<uint8_t> &output) noexcept -> iop::NetworkStatus {
+  auto status = iop::NetworkStatus::OK;
+  Inflater inflater;
+  const auto fed = inflater.feed(iop::to_view(body), [&output, &status, maxSize](const std::string_view piece) {
+    if (output.size() + piece.length() > maxSize) {
+      clientDriverLogger.error(IOP_STR("Payload from server was too big, aborted after: "));
+      clientDriverLogger.errorln(static_cast<uint64_t>(output.size() + piece.length()));
+      status = iop::NetworkStatus::BROKEN_SERVER;
+      return false;
+    }
+    output.insert(output.end(), piece.begin(), piece.end());
+    return true;
+  });
+  if (status != iop::NetworkStatus::OK) return status;
+  if (!fed || !inflater.complete()) {
+    clientDriverLogger.errorln(IOP_STR("Invalid compressed payload"));
+    return iop::NetworkStatus::BROKEN_SERVER;
+  }
+  return iop::NetworkStatus::OK;
+}
+#endif
+
 void HTTPClient::headersToCollect(std::vector<std::string> headers) noexcept {
   for (auto & key: headers) {
     // Headers can't be UTF8 so we cool
@@ -125,20 +299,100 @@ auto Response::header(iop::StaticString key) const noexcept -> std::optional<std
   return this->headers_.at(keyString);
 }
 void Session::addHeader(iop::StaticString key, iop::StaticString value) noexcept  {
-  this->ctx.headers.emplace(key.toString(), value.toString());
+  this->addHeader(std::string_view(key.asCharPtr()), std::string_view(value.asCharPtr()));
 }
 void Session::addHeader(iop::StaticString key, std::string_view value) noexcept  {
-  this->ctx.headers.emplace(key.toString(), std::string(value));
+  this->addHeader(std::string_view(key.asCharPtr()), value);
 }
 void Session::addHeader(std::string_view key, iop::StaticString value) noexcept  {
-  this->ctx.headers.emplace(std::string(key), value.toString());
+  this->addHeader(key, std::string_view(value.asCharPtr()));
 }
 void Session::addHeader(std::string_view key, std::string_view value) noexcept  {
-  this->ctx.headers.emplace(std::string(key), std::string(value));
+  this->ctx.headers.append(key).append(": ").append(value).append("\r\n");
 }
-void Session::setAuthorization(std::string auth) noexcept  {
+void Session::addHeaders(std::string_view block) noexcept  {
+  this->ctx.headers.append(block);
+}
+void Session::setAuthorization(std::string_view auth) noexcept  {
   if (auth.length() == 0) return;
-  this->ctx.headers.emplace(std::string("Authorization"), std::string("Basic ") + auth);
+  this->ctx.headers.append("Authorization: Basic ").append(auth).append("\r\n");
+}
+
+/// Reads the head of the response to the request sent, starting by what's left in the buffer from previous responses on the connection.
+///
+/// Resets the context's parser if it fails, the body is read lazily by the response
+static auto receiveResponse(SessionContext &ctx) noexcept -> Response {
+  auto &parser = *ctx.parser;
+  if (!ctx.buffer) {
+    ctx.buffer = std::unique_ptr<char[]>(new (std::nothrow) char[bufferSize]);
+    iop_assert(ctx.buffer, IOP_STR("OOM"));
+  }
+
+  auto received = ctx.input.length() > 0;
+  while (ctx.input.length() > 0 && !parser.headersDone()) parser.parse(ctx.input);
+  while (!parser.headersDone()) {
+    const auto signedSize = recv(ctx, ctx.buffer.get(), bufferSize);
+    if (signedSize <= 0) {
+      if (signedSize == 0 && !received) {
+        clientDriverLogger.warn(IOP_STR("Empty response: "));
+        clientDriverLogger.warnln(static_cast<uint64_t>(ctx.fd));
+      } else {
+        logReadError(signedSize);
+      }
+      ctx.stale = !received;
+      ctx.parser.reset();
+      return Response(iop::NetworkStatus::IO_ERROR);
+    }
+    received = true;
+
+    clientDriverLogger.debug(IOP_STR("Len: "));
+    clientDriverLogger.debugln(static_cast<uint64_t>(signedSize));
+
+    ctx.input = std::string_view(ctx.buffer.get(), static_cast<size_t>(signedSize));
+    while (ctx.input.length() > 0 && !parser.headersDone()) parser.parse(ctx.input);
+  }
+
+  if (parser.state() == ResponseParser::State::ERROR) {
+    clientDriverLogger.error(IOP_STR("Invalid response, status: "));
+    clientDriverLogger.errorln(static_cast<uint64_t>(parser.status()));
+    ctx.parser.reset();
+    return Response(iop::NetworkStatus::IO_ERROR);
+  }
+
+  clientDriverLogger.debug(IOP_STR("Status: "));
+  clientDriverLogger.debugln(static_cast<uint64_t>(parser.status()));
+
+  auto *context = &ctx;
+  const auto reader = [context](const size_t maxSize, const ChunkHandler &handler) {
+    return readBody(*context, maxSize, handler);
+  };
+#ifdef IOP_ZLIB
+  // The decompressed length is only known after the download
+  const auto contentLength = parser.encoded() ? std::nullopt : parser.contentLength();
+#else
+  const auto contentLength = parser.contentLength();
+#endif
+  return Response(std::move(parser.headers()), reader, contentLength, parser.status());
+}
+
+/// Serializes the request head after the session's headers, in the same reused buffer, and rotates it into place
+static void serializeHead(std::string &head, const std::string_view method, const std::string_view uri, const std::string_view authority, const size_t contentLength) noexcept {
+  const auto hostIndex = uri.find("://");
+  const auto pathIndex = std::string_view(uri.begin() + (hostIndex == uri.npos ? 0 : hostIndex + 3)).find("/");
+  const auto path = pathIndex == uri.npos ? std::string_view("/") : std::string_view(uri.begin() + pathIndex);
+  clientDriverLogger.debug(IOP_STR("Send request to "));
+  clientDriverLogger.debugln(path);
+
+  const auto headersLength = head.length();
+  std::array<char, 20> dataLength;
+  const auto dataLengthEnd = std::to_chars(dataLength.begin(), dataLength.end(), contentLength).ptr;
+  head.append(method).append(" ").append(path).append(" HTTP/1.1\r\nHost: ").append(authority);
+  head.append("\r\nContent-Length: ").append(dataLength.data(), static_cast<size_t>(dataLengthEnd - dataLength.begin())).append("\r\n");
+  std::rotate(head.begin(), head.begin() + static_cast<std::ptrdiff_t>(headersLength), head.end());
+  head.append("\r\n");
+
+  if (clientDriverLogger.isTracing())
+    iop::Log::print(head, iop::LogLevel::TRACE, iop::LogType::STARTEND);
 }
 
 auto Session::sendRequest(const std::string method, const std::string_view data) noexcept -> Response {
@@ -147,247 +401,334 @@ auto Session::sendRequest(const std::string method, const std::string_view data)
   if (iop::wifi.status() != iop_hal::StationStatus::GOT_IP)
     return Response(iop::NetworkStatus::IO_ERROR);
 
-  auto responseHeaders = std::unordered_map<std::string, std::string>();
-  auto responsePayload = std::vector<uint8_t>();
-  auto status = std::make_optional(1000);
-
-  responseHeaders.reserve(this->ctx.headersToCollect.size());
+  this->ctx.parser.emplace(this->ctx.headersToCollect, method != "HEAD");
 
   {
-    const auto hostIndex = this->ctx.uri.find("://");
-    const auto pathIndex = std::string_view(this->ctx.uri.begin() + (hostIndex == this->ctx.uri.npos ? 0 : hostIndex + 3)).find("/");
-    const auto path = pathIndex == this->ctx.uri.npos ? std::string_view("/") : std::string_view(this->ctx.uri.begin() + pathIndex);
-    clientDriverLogger.debug(IOP_STR("Send request to "));
-    clientDriverLogger.debugln(path);
-
     const auto fd = this->ctx.fd;
     iop_assert(fd != -1 || this->ctx.bio, IOP_STR("Invalid file descriptor or ctx.bio"));
 
-    if (clientDriverLogger.isTracing())
-      iop::Log::print(IOP_STR(""), iop::LogLevel::TRACE, iop::LogType::START);
-    send(this->ctx, method.c_str(), method.length());
-    send(this->ctx, " ", 1);
-    send(this->ctx, path.begin(), path.length());
-    send(this->ctx, " HTTP/1.0\r\n", 11);
-    send(this->ctx, "Content-Length: ", 16);
-    const auto dataLengthStr = std::to_string(len);
-    send(this->ctx, dataLengthStr.c_str(), dataLengthStr.length());
-    send(this->ctx, "\r\n", 2);
-    for (const auto& [key, value]: this->ctx.headers) {
-      send(this->ctx, key.c_str(), key.length());
-      send(this->ctx, ": ", 2);
-      send(this->ctx, value.c_str(), value.length());
-      send(this->ctx, "\r\n", 2);
-    }
-    send(this->ctx, "\r\n", 2);
-    send(this->ctx, data.begin(), len);
-    if (clientDriverLogger.isTracing())
-      iop::Log::print(IOP_STR("\n"), iop::LogLevel::TRACE, iop::LogType::END);
+    auto &head = this->ctx.headers;
+    serializeHead(head, method, this->ctx.uri, this->ctx.authority, len);
+
+    // Every TLS write is at least one record, so bodies that fit in the same record as the head are copied after it
+    const auto coalesce = this->ctx.bio && head.length() + len <= maxRecordSize;
+    if (coalesce) head.append(data);
+    std::array<iovec, 2> iov = {{
+      { head.data(), head.length() },
+      { const_cast<char*>(data.data()), coalesce ? 0 : len },
+    }};
+    if (!send(this->ctx, iov.data(), iov.size())) {
+      clientDriverLogger.error(IOP_STR("Unable to send request: "));
+      clientDriverLogger.errorln(std::string_view(strerror(errno)));
+      // Nothing was received, so pooled connections closed by the server are retried
+      this->ctx.stale = true;
+      this->ctx.parser.reset();
+      return Response(iop::NetworkStatus::IO_ERROR);
+    }
     clientDriverLogger.debug(IOP_STR("Sent data: "));
     clientDriverLogger.debugln(data);
+  }
 
-    auto buffer = std::unique_ptr<char[]>(new (std::nothrow) char[bufferSize]);
-    iop_assert(buffer, IOP_STR("OOM"));
-    memset(buffer.get(), '\0', bufferSize);
+  return receiveResponse(this->ctx);
+}
 
-    ssize_t signedSize = 0;
-    size_t size = 0;
-    auto firstLine = true;
-    auto isPayload = false;
+auto Session::sendRequests(const std::vector<PipelinedRequest> &requests, const size_t maxSize, const std::function<void(Session &)> &prepare) noexcept -> std::vector<Response> {
+  std::vector<Response> responses;
+  responses.reserve(requests.size());
+
+  if (iop::wifi.status() == iop_hal::StationStatus::GOT_IP) {
+    if (prepare) prepare(*this);
+    // Every request repeats the session's headers
+    const auto common = this->ctx.headers;
+    std::string pipeline;
+    for (const auto &request : requests) {
+      auto &head = this->ctx.headers;
+      head.assign(common).append(request.headers);
+      serializeHead(head, request.method, request.path, this->ctx.authority, request.data.length());
+      pipeline.append(head).append(request.data);
+    }
 
-    std::string_view buff;
-    while (true) {
-      if (!isPayload) {
-        //clientDriverLogger.debug(IOP_STR("Try read: "));
-        //clientDriverLogger.debugln(buff);
+    iovec iov = { pipeline.data(), pipeline.length() };
+    if (!send(this->ctx, &iov, 1)) {
+      clientDriverLogger.error(IOP_STR("Unable to send pipeline: "));
+      clientDriverLogger.errorln(std::string_view(strerror(errno)));
+      this->ctx.stale = true;
+    } else {
+      for (const auto &request : requests) {
+        this->ctx.parser.emplace(this->ctx.headersToCollect, request.method != "HEAD");
+        auto response = receiveResponse(this->ctx);
+        // Only a connection closed before any response may be retried, or the requests answered would be sent again
+        if (responses.size() > 0) this->ctx.stale = false;
+        if (!this->ctx.parser) break;
+
+        // The next response comes after this body
+        if (!response.preload(maxSize)) {
+          responses.emplace_back(iop::NetworkStatus::BROKEN_SERVER);
+          break;
+        }
+        responses.push_back(std::move(response));
       }
+    }
+  }
 
-      if (size < bufferSize &&
-          (signedSize = recv(this->ctx, buffer.get() + size, bufferSize - size)) < 0) {
-        clientDriverLogger.error(IOP_STR("Error reading from socket ("));
-        clientDriverLogger.error(static_cast<uint64_t>(signedSize));
-        clientDriverLogger.error(IOP_STR("): "));
-        clientDriverLogger.error(static_cast<uint64_t>(errno));
-        clientDriverLogger.error(IOP_STR(" - "));
-        clientDriverLogger.errorln(std::string_view(strerror(errno)));
-        return Response(iop::NetworkStatus::IO_ERROR);
-      }
+  while (responses.size() < requests.size()) responses.emplace_back(iop::NetworkStatus::IO_ERROR);
+  return responses;
+}
 
-      size += static_cast<size_t>(signedSize);
+/// Live TCP connection (maybe wrapped in TLS), kept alive between requests to the same origin
+class Connection {
+public:
+  std::string origin;
+  int fd;
+  BIO *bio;
+  iop::time::milliseconds lastUsed;
+};
 
-      clientDriverLogger.debug(IOP_STR("Len: "));
-      clientDriverLogger.debugln(static_cast<uint64_t>(size));
-      if (firstLine && size == 0) {
-        clientDriverLogger.warn(IOP_STR("Empty response: "));
-        clientDriverLogger.warn(static_cast<uint64_t>(fd));
-        clientDriverLogger.warn(IOP_STR(" "));
-        clientDriverLogger.warnln(static_cast<uint64_t>(size));
-        return Response(status.value_or(500));
-      }
+// Idle connections kept open, to avoid doing the TCP + TLS handshake for every request to the same origin
+static std::vector<Connection> connectionPool;
 
-      if (size == 0) {
-        clientDriverLogger.debug(IOP_STR("EOF: "));
-        clientDriverLogger.debugln(static_cast<uint64_t>(isPayload));
-        break;
-      }
+#ifdef IOP_SSL
+// Built once by `HTTPClient::setup`, so the certificates bundle is only parsed once
+static SSL_CTX *sslContext = nullptr;
+// Last TLS session negotiated with each origin, new connections to it resume them instead of doing a full handshake
+static std::unordered_map<std::string, SSL_SESSION *> tlsSessions;
+#endif
+static HandshakeStats handshakeStats_ = { 0, 0 };
 
-      buff = std::string_view(buffer.get(), size);
+#ifdef IOP_SSL
+static void storeSession(const Connection &conn) noexcept {
+  SSL *ssl = nullptr;
+  BIO_get_ssl(conn.bio, &ssl);
+  if (!ssl) return;
+
+  SSL_SESSION *session = SSL_get1_session(ssl);
+  if (!session) return;
+  if (!SSL_SESSION_is_resumable(session)) {
+    SSL_SESSION_free(session);
+    return;
+  }
 
-      if (!firstLine && !isPayload && buff.find("\r\n") == 0) {
-          // TODO: move this logic to inside Response::await to be lazy-evaluated
-          clientDriverLogger.debugln(IOP_STR("Found Payload"));
-          isPayload = true;
+  const auto previous = tlsSessions.find(conn.origin);
+  if (previous != tlsSessions.end()) {
+    SSL_SESSION_free(previous->second);
+    previous->second = session;
+  } else {
+    tlsSessions.emplace(conn.origin, session);
+  }
+}
+#endif
 
-          clientDriverLogger.debugln(static_cast<uint64_t>(size));
-          size -= 2;
-          shiftChars(buffer.get(), 2, size);
-          buff = std::string_view(buffer.get(), size);
-      }
+static void closeConnection(Connection &conn) noexcept {
+  clientDriverLogger.debug(IOP_STR("Close connection: "));
+  clientDriverLogger.debugln(conn.origin);
+#ifdef IOP_SSL
+  if (conn.bio) BIO_free_all(conn.bio);
+#endif
+  if (conn.fd != -1) close(conn.fd);
+}
 
-      if (!isPayload) {
-        clientDriverLogger.debug(IOP_STR("Buffer ["));
-        clientDriverLogger.debug(static_cast<uint64_t>(size));
-        clientDriverLogger.debug(IOP_STR("]: "));
-        clientDriverLogger.debugln(buff.substr(0, buff.find("\r\n") == buff.npos ? (size > 30 ? 30 : size) : buff.find("\r\n")));
-      }
-      clientDriverLogger.debug(IOP_STR("Is Payload: "));
-      clientDriverLogger.debugln(isPayload);
+/// Idle connections may have expired, been closed by the server or received unsolicited data (like a TLS close notify)
+static auto isReusable(const Connection &conn) noexcept -> bool {
+  if (iop_hal::thisThread.timeRunning() - conn.lastUsed > connectionIdleTimeout) return false;
 
-      if (!isPayload && buff.find("\n") == buff.npos) {
-        iop_panic(IOP_STR("Header line used more than 4kb, currently we don't support this: ").toString() + buffer.get());
-      }
+  char byte;
+  const auto read = ::recv(conn.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
 
-      if (firstLine && size < 10) { // len("HTTP/1.1 ") = 9
-        clientDriverLogger.error(IOP_STR("Error reading first line: "));
-        clientDriverLogger.errorln(static_cast<uint64_t>(size));
-        return Response(iop::NetworkStatus::IO_ERROR);
-      }
+static auto takeConnection(const std::string_view origin) noexcept -> std::optional<Connection> {
+  for (auto it = connectionPool.begin(); it != connectionPool.end();) {
+    if (isReusable(*it)) {
+      ++it;
+    } else {
+      closeConnection(*it);
+      it = connectionPool.erase(it);
+    }
+  }
 
-      if (firstLine && size > 0) {
-        clientDriverLogger.debugln(IOP_STR("Found first line"));
-
-        const std::string_view statusStr(buffer.get() + 9); // len("HTTP/1.1 ") = 9
-        const auto codeEnd = statusStr.find(" ");
-        if (codeEnd == statusStr.npos) {
-          clientDriverLogger.error(IOP_STR("Bad server: "));
-          clientDriverLogger.error(statusStr);
-          clientDriverLogger.error(IOP_STR(" -- "));
-          clientDriverLogger.errorln(buff);
-          return Response(iop::NetworkStatus::IO_ERROR);
-        }
-        status = atoi(std::string(statusStr.begin(), 0, codeEnd).c_str());
-        clientDriverLogger.debug(IOP_STR("Status: "));
-        clientDriverLogger.debugln(static_cast<uint64_t>(status.value_or(500)));
-        firstLine = false;
-
-        const auto newlineIndex = buff.find("\n") + 1;
-        size -= newlineIndex;
-        shiftChars(buffer.get(), newlineIndex, size);
-        buff = std::string_view(buffer.get(), size);
-      }
-      if (status <= 0) {
-        clientDriverLogger.errorln(IOP_STR("No status"));
-        return Response(iop::NetworkStatus::IO_ERROR);
-      }
-      if (!isPayload) {
-        //clientDriverLogger.debug(IOP_STR("Buffer: "));
-        //clientDriverLogger.debugln(buff.substr(0, buff.find("\r\n")));
-        //if (!buff.contains(IOP_STR("\r\n"))) continue;
-        //clientDriverLogger.debug(IOP_STR("Headers + Payload: "));
-        //clientDriverLogger.debugln(buff.substr(0, buff.find("\r\n") == buff.npos ? size : buff.find("\r\n")));
-      }
+  // Most recently used connections are at the end
+  for (auto it = connectionPool.rbegin(); it != connectionPool.rend(); ++it) {
+    if (it->origin != origin) continue;
 
-      while (size > 0 && !isPayload) {
-        if (buff.find("\r\n") == 0) {
-          size -= 2;
-          shiftChars(buffer.get(), 2, size);
-          buff = std::string_view(buffer.get(), size);
-
-          clientDriverLogger.debug(IOP_STR("Found Payload ("));
-          clientDriverLogger.debug(static_cast<uint64_t>(buff.find("\r\n") == buff.npos ? size + 2 : buff.find("\r\n") + 2));
-          clientDriverLogger.debugln(IOP_STR(")"));
-          isPayload = true;
-        } else if (buff.find("\r\n") != buff.npos) {
-          clientDriverLogger.debug(IOP_STR("Found headers (buffer length: "));
-          clientDriverLogger.debug(static_cast<uint64_t>(size));
-          clientDriverLogger.debugln(IOP_STR(")"));
-          for (const auto &key: this->ctx.headersToCollect) {
-            if (size < key.length() + 2) continue; // "\r\n"
-            std::string headerKey(buff.substr(0, key.length()));
-            // Headers can't be UTF8 so we cool
-            std::transform(headerKey.begin(), headerKey.end(), headerKey.begin(),
-              [](unsigned char c){ return std::tolower(c); });
-
-            clientDriverLogger.debug(headerKey);
-            clientDriverLogger.debug(IOP_STR(" == "));
-            clientDriverLogger.debugln(key);
-            if (headerKey != key.c_str())
-              continue;
-
-            auto valueView = buff.substr(key.length());
-            if (*valueView.begin() == ':') valueView = valueView.substr(1);
-            while (*valueView.begin() == ' ') valueView = valueView.substr(1);
-
-            std::string value(valueView, 0, valueView.find("\r\n"));
-            clientDriverLogger.debug(IOP_STR("Found header "));
-            clientDriverLogger.debug(key);
-            clientDriverLogger.debug(IOP_STR(" = "));
-            clientDriverLogger.debugln(value);
-            responseHeaders.emplace(key.c_str(), value);
-          }
-          clientDriverLogger.debug(IOP_STR("Buffer: "));
-          clientDriverLogger.debugln(buff.substr(0, buff.find("\r\n") == buff.npos ? (size > 30 ? 30 : size) : buff.find("\r\n")));
-          clientDriverLogger.debug(IOP_STR("Skipping header ("));
-          clientDriverLogger.debug(static_cast<uint64_t>(buff.find("\r\n") == buff.npos ? size : buff.find("\r\n") + 2));
-          clientDriverLogger.debugln(IOP_STR(")"));
-          const auto startIndex = buff.find("\r\n") + 2;
-          size -= startIndex;
-          shiftChars(buffer.get(), startIndex, size);
-          buff = std::string_view(buffer.get(), size);
-        } else {
-          clientDriverLogger.debugln(IOP_STR("Header line too big"));
-          return Response(iop::NetworkStatus::IO_ERROR);
-        }
-      }
+    auto conn = std::move(*it);
+    connectionPool.erase(std::next(it).base());
+    clientDriverLogger.debug(IOP_STR("Reusing connection: "));
+    clientDriverLogger.debugln(conn.origin);
+    return conn;
+  }
+  return std::nullopt;
+}
 
-      if (isPayload && size > 0) {
-        clientDriverLogger.debug(IOP_STR("Appending payload: "));
-        clientDriverLogger.debug(static_cast<uint64_t>(size));
-        clientDriverLogger.debug(IOP_STR(" "));
-        clientDriverLogger.debugln(static_cast<uint64_t>(responsePayload.size()));
-        responsePayload.insert(responsePayload.end(), buffer.get(), buffer.get() + size);
-        memset(buffer.get(), '\0', bufferSize);
-        buff = "";
-        size = 0;
-      }
-    }
+static void releaseConnection(Connection conn) noexcept {
+  conn.lastUsed = iop_hal::thisThread.timeRunning();
+
+  if (connectionPool.size() >= maxPooledConnections) {
+    // Evicts least recently used connection
+    closeConnection(connectionPool.front());
+    connectionPool.erase(connectionPool.begin());
   }
+  connectionPool.push_back(std::move(conn));
+}
 
-  clientDriverLogger.debug(IOP_STR("Close client: "));
-  clientDriverLogger.debugln(static_cast<uint64_t>(this->ctx.fd));
-  clientDriverLogger.debug(IOP_STR("Status: "));
-  clientDriverLogger.debugln(static_cast<uint64_t>(status.value_or(500)));
-  iop_assert(status, IOP_STR("Status not available"));
+#ifdef IOP_SSL
+/// Drops the origin's cached session, as it may be why the handshake failed
+static void forgetSession(const std::string &origin) noexcept {
+  const auto session = tlsSessions.find(origin);
+  if (session == tlsSessions.end()) return;
+  SSL_SESSION_free(session->second);
+  tlsSessions.erase(session);
+}
+
+/// Wraps the connection's socket in TLS, resuming the origin's last session if there is one. The handshake is up to the caller
+static auto wrapTLS(Connection &conn, const std::string &host) noexcept -> bool {
+  iop_assert(sslContext, IOP_STR("SSL context not initialized, HTTPClient::setup must run first"));
+
+  conn.bio = BIO_new_ssl(sslContext, 1);
+  if (conn.bio == nullptr) {
+    clientDriverLogger.errorln(IOP_STR("Unable to BIO new ssl"));
+    return false;
+  }
+
+  // The socket is ours, so it's closed by `closeConnection`
+  BIO *socketBio = BIO_new_socket(conn.fd, BIO_NOCLOSE);
+  if (socketBio == nullptr) {
+    clientDriverLogger.errorln(IOP_STR("Unable to BIO new socket"));
+    return false;
+  }
+  BIO_push(conn.bio, socketBio);
+
+  SSL *ssl = nullptr;
+  BIO_get_ssl(conn.bio, &ssl);
+  if (!ssl) {
+    clientDriverLogger.errorln(IOP_STR("Unable to allocate SSL object: "));
+    return false;
+  }
+
+  if (SSL_set_tlsext_host_name(ssl, host.c_str()) == 0) {
+    clientDriverLogger.errorln(IOP_STR("Unable to set tlsext host name"));
+    return false;
+  }
 
-  return Response(responseHeaders, Payload(responsePayload), *status);
+  const auto session = tlsSessions.find(conn.origin);
+  if (session != tlsSessions.end() && SSL_set_session(ssl, session->second) == 0) {
+    clientDriverLogger.warnln(IOP_STR("Unable to set cached TLS session"));
+  }
+  return true;
 }
 
-auto HTTPClient::begin(std::string_view uri, std::function<Response(Session&)> func) noexcept -> Response {
-  if (iop::wifi.status() != iop_hal::StationStatus::GOT_IP)
-    return Response(iop::NetworkStatus::IO_ERROR);
+/// Checks the certificate the server presented in the finished handshake
+static auto verifyHandshake(const Connection &conn) noexcept -> bool {
+  SSL *ssl = nullptr;
+  BIO_get_ssl(conn.bio, &ssl);
+  if (!ssl) return false;
+
+  if (SSL_session_reused(ssl)) {
+    handshakeStats_.resumed++;
+    clientDriverLogger.debugln(IOP_STR("Resumed TLS session"));
+  } else {
+    handshakeStats_.full++;
+    clientDriverLogger.debugln(IOP_STR("Full TLS handshake"));
+  }
+
+  /* Step 1: verify a server certificate was presented during the negotiation */
+  X509* cert = SSL_get_peer_certificate(ssl);
+  if (cert) {
+    // Decreases reference count as it just increased unecessarily
+    X509_free(cert);
+  } else {
+    clientDriverLogger.errorln(IOP_STR("Unable to get peer cert"));
+    return false;
+  }
+
+  /* Step 2: verify the result of chain verification */
+  /* Verification performed according to RFC 4158    */
+  const auto verifyResult = SSL_get_verify_result(ssl);
+  if (verifyResult != X509_V_OK) {
+    clientDriverLogger.error(IOP_STR("Unable to verify cert: "));
+    clientDriverLogger.errorln(static_cast<uint64_t>(verifyResult));
+    return false;
+  }
+  return true;
+}
+#endif
+
+static Resolver resolver;
+
+// How often requests waiting for a lookup, or to start another connection attempt, are checked
+constexpr iop::time::milliseconds resolveCheckInterval = 10;
+
+static void setNonBlocking(const int fd, const bool enabled) noexcept {
+  const auto flags = fcntl(fd, F_GETFL, 0);
+  if (flags >= 0) fcntl(fd, F_SETFL, enabled ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+}
+
+static auto openConnection(const std::string &host, const uint16_t port, const bool useTLS, std::string origin) noexcept -> std::optional<Connection> {
+  std::vector<Address> addresses;
+  if (!resolver.resolveBlocking(host, port, addresses)) return std::nullopt;
+
+  Connector connector(std::move(addresses));
+  int fd = -1;
+  while ((fd = connector.poll()) < 0) {
+    if (connector.failed()) return std::nullopt;
+    connector.wait();
+  }
+  setNonBlocking(fd, false);
 
-  struct sockaddr_in serv_addr;
-  memset(&serv_addr, 0, sizeof(serv_addr));
+  Connection conn;
+  conn.origin = std::move(origin);
+  conn.fd = fd;
+  conn.bio = nullptr;
+  conn.lastUsed = iop_hal::thisThread.timeRunning();
 
-  auto fd = -1;
+#ifdef IOP_SSL
+  if (useTLS) {
+    if (!wrapTLS(conn, host)) {
+      closeConnection(conn);
+      return std::nullopt;
+    }
+
+    if (BIO_do_handshake(conn.bio) <= 0) {
+      clientDriverLogger.errorln(IOP_STR("Handshake failed"));
+      closeConnection(conn);
+      forgetSession(conn.origin);
+      return std::nullopt;
+    }
+
+    if (!verifyHandshake(conn)) {
+      closeConnection(conn);
+      return std::nullopt;
+    }
+  }
+#else
+  (void) useTLS;
+#endif
+
+  clientDriverLogger.debug(IOP_STR("Began connection: "));
+  clientDriverLogger.debugln(conn.origin);
+  return conn;
+}
+
+/// Where a request goes, parsed from its URI
+struct Target {
+  std::string host;
+  uint16_t port;
+  bool useTLS;
+  // Host header
+  std::string authority;
+  // Key of the pooled connections and TLS sessions
+  std::string origin;
+  // URI without the scheme
+  std::string_view uri;
+};
 
+static auto parseTarget(std::string_view uri) noexcept -> std::optional<Target> {
   const auto useTLS = uri.find("https://") == 0;
   if (useTLS) {
     #ifdef IOP_SSL
     uri = uri.substr(8);
     #else
     clientDriverLogger.errorln(IOP_STR("Tried o make TLS connection but IOP_SSL is not defined"));
-    return iop_hal::Response(iop::NetworkStatus::IO_ERROR);    
+    return std::nullopt;
     #endif
   } else if (uri.find("http://") == 0) {
     uri = uri.substr(7);
@@ -404,7 +745,7 @@ auto HTTPClient::begin(std::string_view uri, std::function<Response(Session&)> f
     if (port == 0) {
       clientDriverLogger.error(IOP_STR("Unable to parse port: "));
       clientDriverLogger.errorln(uri);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+      return std::nullopt;
     }
   }
   clientDriverLogger.debug(IOP_STR("Port: "));
@@ -414,176 +755,449 @@ auto HTTPClient::begin(std::string_view uri, std::function<Response(Session&)> f
   if (end == uri.npos) end = uri.find("/");
   if (end == uri.npos) end = uri.length();
 
-  const auto host = std::string(uri.begin(), 0, end);
+  Target target;
+  target.host = std::string(uri.begin(), 0, end);
+  target.port = port;
+  target.useTLS = useTLS;
+  target.authority = target.host;
+  if (portIndex != uri.npos) target.authority += ":" + std::to_string(port);
+  target.origin = std::string(useTLS ? "https://" : "http://") + target.host + ":" + std::to_string(port);
+  target.uri = uri;
+  return target;
+}
 
-  struct hostent *he = gethostbyname(host.c_str());
-  if (!he) {
-    clientDriverLogger.error(IOP_STR("Unable to obtain hostent from host string: "));
-    clientDriverLogger.errorln(host);
-    return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
-  }
+auto HTTPClient::begin(std::string_view uri, std::function<Response(Session&)> func) noexcept -> Response {
+  HTTPClient::setup();
 
-  serv_addr.sin_addr= *(struct in_addr *) he->h_addr_list[0];
-  serv_addr.sin_family = AF_INET;
-  serv_addr.sin_port = htons(port);
+  if (iop::wifi.status() != iop_hal::StationStatus::GOT_IP)
+    return Response(iop::NetworkStatus::IO_ERROR);
+
+  const auto target = parseTarget(uri);
+  if (!target) return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+
+  while (true) {
+    auto conn = takeConnection(target->origin);
+    const auto reused = conn.has_value();
+    if (!conn) conn = openConnection(target->host, target->port, target->useTLS, target->origin);
+    if (!conn) return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+
+    auto ctx = SessionContext(conn->fd, this->headersToCollect_, this->requestHeaders_, target->uri, conn->bio, target->authority);
+    auto session = Session(ctx);
+    auto result = func(session);
+    // Lazy bodies reference this connection, so they can't leave this scope
+    result.detach();
+    // Discards small unread bodies, so the connection can be reused
+    if (ctx.parser && ctx.parser->state() == ResponseParser::State::BODY && ctx.parser->contentLength() && *ctx.parser->contentLength() <= maxDrainSize)
+      readBody(ctx, maxDrainSize, [](const std::string_view) { return true; });
+    // Unexpected data after the response means we lost track of the stream
+    const auto keepAlive = ctx.parser && ctx.parser->reusable() && ctx.input.length() == 0;
 
 #ifdef IOP_SSL
-  SSL_CTX* context = nullptr;
-  SSL* ssl = nullptr;
-  BIO* bio = nullptr;
-  BIO* out = nullptr;
+    // TLS 1.3 tickets are only sent after the handshake, so we wait for the response before storing the session
+    if (conn->bio) storeSession(*conn);
+#endif
 
-  if (useTLS) {
-    const auto *method = TLS_client_method();
-    if (!method) {
-      clientDriverLogger.errorln(IOP_STR("Unable to allocate SSL method: "));
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+    if (keepAlive) {
+      releaseConnection(std::move(*conn));
+    } else {
+      closeConnection(*conn);
     }
 
-    context = SSL_CTX_new(method);
-    if (!context) {
-      clientDriverLogger.errorln(IOP_STR("Unable to allocate SSL context: "));
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+    // The server may close an idle connection right before we reuse it, so we retry with a fresh one
+    if (reused && ctx.stale) {
+      clientDriverLogger.debugln(IOP_STR("Pooled connection was stale, retrying"));
+      continue;
     }
+    return result;
+  }
+}
 
-    SSL_CTX_set_verify(context, SSL_VERIFY_PEER, verify_callback);
-    SSL_CTX_set_verify_depth(context, 4);
-    const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION;
-    SSL_CTX_set_options(context, flags);
+/// Request driven by `poll` instead of blocking calls. Its socket is non-blocking, so every step does what it can and returns.
+///
+/// Connections come from the same pool as the synchronous requests, they are blocking again when released.
+class AsyncContext {
+public:
+  enum class State { RESOLVE, CONNECT, HANDSHAKE, SEND, RECEIVE, DONE };
 
-    const auto certsPath = std::filesystem::temp_directory_path().append("iop-hal-linux-mock-certs-bundle.crt");
-    if (SSL_CTX_load_verify_locations(context, certsPath.c_str(), nullptr) == 0) {
-      clientDriverLogger.errorln(IOP_STR("Unable to load verify locations"));
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
-    }
+  State state;
+  std::string uri;
+  std::optional<Target> target;
+  std::optional<Connector> connector;
+  std::vector<std::string> headersToCollect;
+  // Serialized request, head and body
+  std::string request;
+  size_t sent;
+  std::optional<Connection> conn;
+  bool reused;
+  // Pooled connections that are closed before anything is received are retried with a fresh one
+  bool received;
+  std::unique_ptr<char[]> buffer;
+  std::optional<ResponseParser> parser;
+  bool hasBody;
+  std::vector<uint8_t> body;
+  size_t maxSize;
+  iop::time::milliseconds deadline;
+  std::function<Response(Response &)> process;
+  std::optional<Response> result;
+
+  AsyncContext(const std::string_view uri, std::vector<std::string> headersToCollect, const bool hasBody, const size_t maxSize, std::function<Response(Response &)> process) noexcept:
+    state(State::RESOLVE), uri(uri), target(), connector(), headersToCollect(std::move(headersToCollect)), request(), sent(0), conn(), reused(false), received(false),
+    buffer(), parser(), hasBody(hasBody), body(), maxSize(maxSize), deadline(iop_hal::thisThread.timeRunning() + asyncRequestTimeout),
+    process(std::move(process)), result() {
+    this->target = parseTarget(this->uri);
+  }
 
-    bio = BIO_new_ssl_connect(context);
-    if(bio == nullptr) {
-      clientDriverLogger.errorln(IOP_STR("Unable to BIO new ssl connect"));
-      BIO_free_all(bio);
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
-    }
+  AsyncContext(AsyncContext &&other) noexcept = delete;
+  AsyncContext(const AsyncContext &other) noexcept = delete;
+  auto operator=(AsyncContext &&other) noexcept -> AsyncContext & = delete;
+  auto operator=(const AsyncContext &other) noexcept -> AsyncContext & = delete;
+  ~AsyncContext() noexcept {
+    // Aborted while in flight
+    if (this->conn) closeConnection(*this->conn);
+  }
 
-    if (BIO_set_conn_hostname(bio, (host + ":" + std::to_string(port)).c_str()) == 0) {
-      clientDriverLogger.errorln(IOP_STR("Unable to set BIO conn hostname"));
-      BIO_free_all(bio);
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
-    }
+  auto done() const noexcept -> bool { return this->state == State::DONE; }
+  auto take() noexcept -> Response { return std::move(this->result).value_or(Response(iop::NetworkStatus::IO_ERROR)); }
 
-    BIO_get_ssl(bio, &ssl);
-    if (!ssl) {
-      clientDriverLogger.errorln(IOP_STR("Unable to allocate SSL object: "));
-      BIO_free_all(bio);
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+  /// Sockets that must become ready for the request to progress. There are none while resolving, it's checked on every poll
+  void fds(std::vector<pollfd> &fds) const noexcept {
+    if (this->state == State::CONNECT) {
+      this->connector->fds(fds);
+      return;
     }
+    if (!this->conn) return;
+
+    short events = POLLIN;
+    if (this->state == State::SEND) events = POLLOUT;
+#ifdef IOP_SSL
+    if (this->state == State::HANDSHAKE && this->conn->bio && BIO_should_write(this->conn->bio)) events = POLLOUT;
+#endif
+    fds.push_back(pollfd { this->conn->fd, events, 0 });
+  }
 
-    const char* const PREFERRED_CIPHERS = "HIGH:!aNULL:!kRSA:!PSK:!SRP:!MD5:!RC4";
-    if (SSL_set_cipher_list(ssl, PREFERRED_CIPHERS) == 0) {
-      clientDriverLogger.errorln(IOP_STR("Unable to set cipher list"));
-      BIO_free_all(bio);
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+  /// Takes a pooled connection, or starts resolving the host. Failures surface while progressing, so it can't fail
+  void start() noexcept {
+    this->sent = 0;
+    this->received = false;
+    this->body.clear();
+    this->parser.emplace(this->headersToCollect, this->hasBody);
+
+    this->conn = takeConnection(this->target->origin);
+    this->reused = this->conn.has_value();
+    if (this->conn) {
+      setNonBlocking(this->conn->fd, true);
+      this->state = State::SEND;
+      return;
     }
 
-    if (SSL_set_tlsext_host_name(ssl, host.c_str()) == 0) {
-      clientDriverLogger.errorln(IOP_STR("Unable to set tlsext host name"));
-      BIO_free_all(bio);
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+    this->state = State::RESOLVE;
+  }
+
+  /// Progresses until the socket would block, returns true once done
+  auto poll() noexcept -> bool {
+    while (this->state != State::DONE) {
+      if (iop_hal::thisThread.timeRunning() > this->deadline) {
+        clientDriverLogger.error(IOP_STR("Request timed out: "));
+        clientDriverLogger.errorln(this->uri);
+        this->fail(iop::NetworkStatus::IO_ERROR);
+        break;
+      }
+      if (!this->step()) break;
     }
+    return this->state == State::DONE;
+  }
+
+  void fail(const iop::NetworkStatus status) noexcept {
+    if (this->conn) closeConnection(*this->conn);
+    this->conn.reset();
+    this->connector.reset();
+    this->result.emplace(status);
+    this->state = State::DONE;
+  }
+
+private:
+  /// Returns false if it would block
+  auto step() noexcept -> bool {
+    switch (this->state) {
+      case State::RESOLVE: {
+        std::vector<Address> addresses;
+        switch (resolver.resolve(this->target->host, this->target->port, addresses)) {
+          case Resolution::PENDING:
+            return false;
+          case Resolution::FAILED:
+            this->fail(iop::NetworkStatus::IO_ERROR);
+            return false;
+          case Resolution::RESOLVED:
+            break;
+        }
+        this->connector.emplace(std::move(addresses));
+        this->state = State::CONNECT;
+        return true;
+      }
+      case State::CONNECT: {
+        const auto fd = this->connector->poll();
+        if (fd < 0) {
+          if (this->connector->failed()) this->fail(iop::NetworkStatus::IO_ERROR);
+          return false;
+        }
+        this->connector.reset();
+
+        this->conn.emplace();
+        this->conn->origin = this->target->origin;
+        this->conn->fd = fd;
+        this->conn->bio = nullptr;
+        this->conn->lastUsed = iop_hal::thisThread.timeRunning();
+#ifdef IOP_SSL
+        if (this->target->useTLS) {
+          if (!wrapTLS(*this->conn, this->target->host)) {
+            this->fail(iop::NetworkStatus::IO_ERROR);
+            return false;
+          }
+          this->state = State::HANDSHAKE;
+          return true;
+        }
+#endif
+        this->state = State::SEND;
+        return true;
+      }
+      case State::HANDSHAKE: {
+#ifdef IOP_SSL
+        if (BIO_do_handshake(this->conn->bio) <= 0) {
+          if (BIO_should_retry(this->conn->bio)) return false;
+          clientDriverLogger.errorln(IOP_STR("Handshake failed"));
+          forgetSession(this->conn->origin);
+          this->fail(iop::NetworkStatus::IO_ERROR);
+          return false;
+        }
+        if (!verifyHandshake(*this->conn)) {
+          this->fail(iop::NetworkStatus::IO_ERROR);
+          return false;
+        }
+#endif
+        this->state = State::SEND;
+        return true;
+      }
+      case State::SEND: {
+        const auto left = std::min(this->request.length() - this->sent, static_cast<size_t>(INT_MAX));
+        ssize_t sent = 0;
+#ifdef IOP_SSL
+        if (this->conn->bio) {
+          sent = BIO_write(this->conn->bio, this->request.data() + this->sent, static_cast<int>(left));
+          if (sent <= 0 && BIO_should_retry(this->conn->bio)) return false;
+        } else
+#endif
+        {
+          sent = write(this->conn->fd, this->request.data() + this->sent, left);
+          if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+          if (sent < 0 && errno == EINTR) return true;
+        }
+        if (sent <= 0) {
+          clientDriverLogger.error(IOP_STR("Unable to send request: "));
+          clientDriverLogger.errorln(std::string_view(strerror(errno)));
+          return this->retry();
+        }
+
+        this->sent += static_cast<size_t>(sent);
+        if (this->sent < this->request.length()) return true;
 
-    out = BIO_new_fp(stdout, BIO_NOCLOSE);
-    if(out == nullptr) {
-      clientDriverLogger.errorln(IOP_STR("Unable to set BIO fp"));
-      BIO_free(out);
-      BIO_free_all(bio);
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+        this->buffer = std::unique_ptr<char[]>(new (std::nothrow) char[bufferSize]);
+        iop_assert(this->buffer, IOP_STR("OOM"));
+        this->state = State::RECEIVE;
+        return true;
+      }
+      case State::RECEIVE:
+        return this->receive();
+      case State::DONE:
+        break;
     }
+    return false;
+  }
 
-    if (BIO_do_connect(bio) == 0) {
-      clientDriverLogger.errorln(IOP_STR("Unable to bio connect"));
-      BIO_free(out);
-      BIO_free_all(bio);
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+  auto receive() noexcept -> bool {
+    ssize_t size = 0;
+#ifdef IOP_SSL
+    if (this->conn->bio) {
+      size = BIO_read(this->conn->bio, this->buffer.get(), bufferSize);
+      if (size <= 0 && BIO_should_retry(this->conn->bio)) return false;
+    } else
+#endif
+    {
+      size = read(this->conn->fd, this->buffer.get(), bufferSize);
+      if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+      if (size < 0 && errno == EINTR) return true;
     }
 
-    if (BIO_do_handshake(bio) == 0) {
-      clientDriverLogger.errorln(IOP_STR("Handshake failed"));
-      BIO_free(out);
-      BIO_free_all(bio);
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+    auto &parser = *this->parser;
+    if (size < 0) {
+      logReadError(size);
+      return this->retry();
+    }
+    if (size == 0) {
+      clientDriverLogger.debugln(IOP_STR("EOF"));
+      if (!this->received) return this->retry();
+      parser.finish();
+      if (parser.state() != ResponseParser::State::DONE) {
+        this->fail(iop::NetworkStatus::IO_ERROR);
+        return false;
+      }
+      this->complete(std::string_view());
+      return false;
+    }
+    this->received = true;
+
+    auto input = std::string_view(this->buffer.get(), static_cast<size_t>(size));
+    while (input.length() > 0 && parser.state() != ResponseParser::State::DONE && parser.state() != ResponseParser::State::ERROR) {
+      const auto piece = parser.parse(input);
+      if (parser.headersDone() && parser.contentLength() && *parser.contentLength() > this->maxSize) {
+        clientDriverLogger.error(IOP_STR("Payload from server was too big: "));
+        clientDriverLogger.errorln(static_cast<uint64_t>(*parser.contentLength()));
+        this->fail(iop::NetworkStatus::BROKEN_SERVER);
+        return false;
+      }
+      if (this->body.size() + piece.length() > this->maxSize) {
+        clientDriverLogger.error(IOP_STR("Payload from server was too big, aborted after: "));
+        clientDriverLogger.errorln(static_cast<uint64_t>(this->body.size() + piece.length()));
+        this->fail(iop::NetworkStatus::BROKEN_SERVER);
+        return false;
+      }
+      this->body.insert(this->body.end(), piece.begin(), piece.end());
     }
 
-    /* Step 1: verify a server certificate was presented during the negotiation */
-    X509* cert = SSL_get_peer_certificate(ssl);
-    if (cert) {
-      // Decreases reference count as it just increased unecessarily
-      X509_free(cert);
-    } else {
-      clientDriverLogger.errorln(IOP_STR("Unable to get peer cert"));
-      BIO_free(out);
-      BIO_free_all(bio);
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+    if (parser.state() == ResponseParser::State::ERROR) {
+      clientDriverLogger.error(IOP_STR("Invalid response, status: "));
+      clientDriverLogger.errorln(static_cast<uint64_t>(parser.status()));
+      this->fail(parser.headersDone() ? iop::NetworkStatus::BROKEN_SERVER : iop::NetworkStatus::IO_ERROR);
+      return false;
     }
+    if (parser.state() == ResponseParser::State::DONE) {
+      this->complete(input);
+      return false;
+    }
+    return true;
+  }
 
-    /* Step 2: verify the result of chain verification */
-    /* Verification performed according to RFC 4158    */
-    const auto verifyResult = SSL_get_verify_result(ssl);
-    if (verifyResult != X509_V_OK) {
-      clientDriverLogger.error(IOP_STR("Unable to verify cert: "));
-      clientDriverLogger.errorln(static_cast<uint64_t>(verifyResult));
-      BIO_free(out);
-      BIO_free_all(bio);
-      SSL_CTX_free(context);
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+  /// The server may close an idle connection right before we reuse it, so we retry with a fresh one
+  auto retry() noexcept -> bool {
+    if (!this->reused || this->received) {
+      this->fail(iop::NetworkStatus::IO_ERROR);
+      return false;
     }
+
+    clientDriverLogger.debugln(IOP_STR("Pooled connection was stale, retrying"));
+    closeConnection(*this->conn);
+    this->conn.reset();
+    this->start();
+    return true;
   }
-#endif
 
-  if (!useTLS) {
-    fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) {
-      clientDriverLogger.errorln(IOP_STR("Unable to open socket"));
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+  void complete(const std::string_view unparsed) noexcept {
+    auto &parser = *this->parser;
+    clientDriverLogger.debug(IOP_STR("Status: "));
+    clientDriverLogger.debugln(static_cast<uint64_t>(parser.status()));
+
+#ifdef IOP_SSL
+    // TLS 1.3 tickets are only sent after the handshake, so we wait for the response before storing the session
+    if (this->conn->bio) storeSession(*this->conn);
+#endif
+    // Unexpected data after the response means we lost track of the stream
+    if (parser.reusable() && unparsed.length() == 0) {
+      setNonBlocking(this->conn->fd, false);
+      releaseConnection(std::move(*this->conn));
+    } else {
+      closeConnection(*this->conn);
     }
+    this->conn.reset();
+    this->buffer.reset();
+
+#ifdef IOP_ZLIB
+    if (parser.encoded() && this->body.size() > 0) {
+      std::vector<uint8_t> decoded;
+      const auto status = inflateBody(this->body, this->maxSize, decoded);
+      if (status != iop::NetworkStatus::OK) {
+        this->fail(status);
+        return;
+      }
+      this->body = std::move(decoded);
+    }
+#endif
 
-    auto connection = connect(fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
-    if (connection < 0) {
-      clientDriverLogger.error(IOP_STR("Unable to connect: "));
-      clientDriverLogger.errorln(static_cast<int64_t>(connection));
-      return iop_hal::Response(iop::NetworkStatus::IO_ERROR);
+    auto response = Response(std::move(parser.headers()), Payload(std::move(this->body)), parser.status());
+    if (this->process) {
+      this->result.emplace(this->process(response));
+    } else {
+      this->result.emplace(std::move(response));
     }
+    this->state = State::DONE;
   }
+};
 
-  clientDriverLogger.debug(IOP_STR("Began connection: "));
-  clientDriverLogger.debugln(host);
-  auto ctx = SessionContext(fd, this->headersToCollect_, uri, bio);
-  auto session = Session(ctx);
-  auto result = func(session);
+auto HTTPClient::beginAsync(const std::string_view uri, const std::string_view method, const std::string_view data, const size_t maxSize, std::function<void(Session &)> prepare, std::function<Response(Response &)> process) noexcept -> AsyncRequest {
+  HTTPClient::setup();
 
-#ifdef IOP_SSL
-  if (useTLS) {
-    BIO_free(out);
-    BIO_free_all(bio);
-    SSL_CTX_free(context);
+  auto ctx = std::unique_ptr<AsyncContext>(new (std::nothrow) AsyncContext(uri, this->headersToCollect_, method != "HEAD", maxSize, std::move(process)));
+  iop_assert(ctx, IOP_STR("OOM"));
+  if (!ctx->target || iop::wifi.status() != iop_hal::StationStatus::GOT_IP) {
+    ctx->fail(iop::NetworkStatus::IO_ERROR);
+    return AsyncRequest(std::move(ctx));
   }
-#endif
-  if (!useTLS) {
-    close(fd);
+
+  // Headers are serialized right away, so `prepare` doesn't outlive this call
+  {
+    auto sessionCtx = SessionContext(-1, this->headersToCollect_, ctx->request, ctx->target->uri, nullptr, ctx->target->authority);
+    auto session = Session(sessionCtx);
+    if (prepare) prepare(session);
   }
-  return result;
+  serializeHead(ctx->request, method, ctx->target->uri, ctx->target->authority, data.length());
+  ctx->request.append(data);
+
+  ctx->start();
+  ctx->poll();
+  return AsyncRequest(std::move(ctx));
 }
-HTTPClient::HTTPClient(HTTPClient &&other) noexcept: headersToCollect_(std::move(other.headersToCollect_)) {}
+
+/// Waits for the sockets of the requests in flight, progressing them as they become ready
+static void waitForRequests(const std::vector<AsyncContext *> &requests, const iop::time::milliseconds timeout) noexcept {
+  const auto deadline = iop_hal::thisThread.timeRunning() + timeout;
+  std::vector<pollfd> fds;
+  std::vector<AsyncContext *> waiting;
+  while (true) {
+    const auto now = iop_hal::thisThread.timeRunning();
+    if (now >= deadline) return;
+
+    fds.clear();
+    waiting.clear();
+    bool resolving = false;
+    for (auto *ctx : requests) {
+      if (ctx->done()) continue;
+      resolving = resolving || ctx->state == AsyncContext::State::RESOLVE || ctx->state == AsyncContext::State::CONNECT;
+      ctx->fds(fds);
+      waiting.resize(fds.size(), ctx);
+    }
+
+    // Without sockets to wait for this just sleeps. Lookups and connection attempt delays have no socket, so they are checked every slice
+    const auto wait = resolving ? std::min(deadline - now, resolveCheckInterval) : deadline - now;
+    const auto ready = ::poll(fds.data(), fds.size(), static_cast<int>(wait));
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready < 0) return;
+    for (size_t index = 0; index < fds.size(); ++index) {
+      if (fds[index].revents != 0) waiting[index]->poll();
+    }
+    if (resolving) {
+      for (auto *ctx : requests) {
+        if (ctx->state == AsyncContext::State::RESOLVE || ctx->state == AsyncContext::State::CONNECT) ctx->poll();
+      }
+    } else if (ready == 0) {
+      return;
+    }
+    // The owner gets to handle the response right away
+    if (std::any_of(requests.begin(), requests.end(), [](const AsyncContext *ctx) { return ctx->done(); })) return;
+  }
+}
+
+HTTPClient::HTTPClient(HTTPClient &&other) noexcept: headersToCollect_(std::move(other.headersToCollect_)), requestHeaders_(std::move(other.requestHeaders_)) {}
 auto HTTPClient::operator==(HTTPClient &&other) noexcept -> HTTPClient & {
   this->headersToCollect_ = std::move(other.headersToCollect_);
+  this->requestHeaders_ = std::move(other.requestHeaders_);
   return *this;
 }
 auto HTTPClient::setup() noexcept -> void {
@@ -591,22 +1205,52 @@ auto HTTPClient::setup() noexcept -> void {
   if (initialized) return;
   initialized = true;
 
+  // Writing to a connection the server closed while it was pooled must fail with EPIPE, not kill the process
+  signal(SIGPIPE, SIG_IGN);
+
 #ifdef IOP_SSL
   SSL_library_init();
   SSL_load_error_strings();
 
-  const auto path = std::filesystem::temp_directory_path().append("iop-hal-linux-mock-certs-bundle.crt");
-  std::ofstream file(path);
-  iop_assert(file.is_open(), std::string("Unable to create certs bundle file: ") + path.c_str());
+  const auto *method = TLS_client_method();
+  iop_assert(method, IOP_STR("Unable to allocate SSL method"));
+
+  sslContext = SSL_CTX_new(method);
+  iop_assert(sslContext, IOP_STR("Unable to allocate SSL context"));
+
+  SSL_CTX_set_verify(sslContext, SSL_VERIFY_PEER, verify_callback);
+  SSL_CTX_set_verify_depth(sslContext, 4);
+  const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION;
+  SSL_CTX_set_options(sslContext, flags);
+
+  const char* const PREFERRED_CIPHERS = "HIGH:!aNULL:!kRSA:!PSK:!SRP:!MD5:!RC4";
+  iop_assert(SSL_CTX_set_cipher_list(sslContext, PREFERRED_CIPHERS) != 0, IOP_STR("Unable to set cipher list"));
+
+  // We keep the sessions ourselves, per origin, OpenSSL's internal store is only used by servers
+  SSL_CTX_set_session_cache_mode(sslContext, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
 
   iop_assert(generated::certs_bundle, IOP_STR("Cert Bundle is null, but SSL is enabled"));
-  file.write((char*) generated::certs_bundle, static_cast<std::streamsize>(sizeof(generated::certs_bundle)));
-  iop_assert(!file.fail(), "Unable to write to certs bundle file");
+  BIO *bundle = BIO_new_mem_buf(generated::certs_bundle, static_cast<int>(sizeof(generated::certs_bundle) - 1));
+  iop_assert(bundle, IOP_STR("Unable to allocate certs bundle BIO"));
+
+  auto *store = SSL_CTX_get_cert_store(sslContext);
+  STACK_OF(X509_INFO) *certs = PEM_X509_INFO_read_bio(bundle, nullptr, nullptr, nullptr);
+  BIO_free(bundle);
+  if (!certs) {
+    clientDriverLogger.errorln(IOP_STR("Unable to parse certs bundle"));
+    return;
+  }
 
-  file.close();
-  iop_assert(!file.fail(), "Unable to close certs bundle file");
+  for (int index = 0; index < sk_X509_INFO_num(certs); ++index) {
+    const auto *info = sk_X509_INFO_value(certs, index);
+    if (info->x509) X509_STORE_add_cert(store, info->x509);
+  }
+  sk_X509_INFO_pop_free(certs, X509_INFO_free);
 #endif
 }
+auto HTTPClient::handshakeStats() noexcept -> HandshakeStats {
+  return handshakeStats_;
+}
 }
 
 #ifdef IOP_SSL
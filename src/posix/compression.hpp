@@ -0,0 +1,24 @@
+#include "iop-hal/compression.hpp"
+
+#include <cstring>
+#include <zlib.h>
+
+namespace iop_hal {
+auto compress(const std::string_view data, const ContentEncoding encoding, std::string &output) noexcept -> bool {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // 15 bits is the full 32KB window, adding 16 makes zlib write the gzip wrapper instead of its own
+  const auto windowBits = encoding == ContentEncoding::GZIP ? 15 + 16 : 15;
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+
+  output.resize(deflateBound(&stream, static_cast<uLong>(data.length())));
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.length());
+  stream.next_out = reinterpret_cast<Bytef *>(&output[0]);
+  stream.avail_out = static_cast<uInt>(output.length());
+  const auto result = deflate(&stream, Z_FINISH);
+  output.resize(stream.total_out);
+  deflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+}
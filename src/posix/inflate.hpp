@@ -0,0 +1,66 @@
+#ifndef IOP_POSIX_INFLATE_HPP
+#define IOP_POSIX_INFLATE_HPP
+
+#include "iop-hal/response.hpp"
+#include "iop-hal/panic.hpp"
+
+#include <memory>
+#include <cstring>
+#include <zlib.h>
+
+namespace iop_hal {
+/// Decompresses gzip or zlib wrapped bodies as they arrive, through a fixed output buffer
+class Inflater {
+  z_stream stream;
+  std::unique_ptr<char[]> output;
+  bool ready;
+  bool ended;
+
+public:
+  static constexpr size_t outputSize = 4096;
+
+  Inflater() noexcept: stream(), output(new (std::nothrow) char[outputSize]), ready(false), ended(false) {
+    iop_assert(this->output, IOP_STR("OOM"));
+    memset(&this->stream, 0, sizeof(this->stream));
+    // Full window, adding 32 detects the gzip or zlib wrapper from the header
+    this->ready = inflateInit2(&this->stream, 15 + 32) == Z_OK;
+  }
+  Inflater(Inflater &&other) noexcept = delete;
+  Inflater(const Inflater &other) noexcept = delete;
+  auto operator=(Inflater &&other) noexcept -> Inflater & = delete;
+  auto operator=(const Inflater &other) noexcept -> Inflater & = delete;
+  ~Inflater() noexcept {
+    if (this->ready) inflateEnd(&this->stream);
+  }
+
+  /// True once the compressed stream ended, or if nothing was fed (bodiless responses)
+  auto complete() const noexcept -> bool { return this->ended || this->stream.total_in == 0; }
+
+  /// Decompresses `input`, feeding the output to `handler`. Returns false if the input is invalid or if `handler` refuses it
+  auto feed(const std::string_view input, const ChunkHandler &handler) noexcept -> bool {
+    if (!this->ready) return false;
+    // Data after the end of the stream is ignored
+    if (this->ended) return true;
+
+    this->stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    this->stream.avail_in = static_cast<uInt>(input.length());
+    do {
+      this->stream.next_out = reinterpret_cast<Bytef *>(this->output.get());
+      this->stream.avail_out = outputSize;
+      const auto result = inflate(&this->stream, Z_NO_FLUSH);
+      if (result == Z_STREAM_END) {
+        this->ended = true;
+      } else if (result != Z_OK && result != Z_BUF_ERROR) {
+        return false;
+      }
+
+      const auto produced = outputSize - this->stream.avail_out;
+      if (produced > 0 && !handler(std::string_view(this->output.get(), produced))) return false;
+      // The output buffer was filled, so there may be more to decompress
+    } while (!this->ended && this->stream.avail_out == 0);
+    return true;
+  }
+};
+}
+
+#endif
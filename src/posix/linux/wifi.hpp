@@ -4,10 +4,21 @@
 #include "iop-hal/client.hpp"
 
 #include <cstdlib>
+#include <cstring>
 
+#include <algorithm>
 #include <thread>
 #include <memory>
 #include <atomic>
+#include <mutex>
+
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <unistd.h>
+#include <net/if.h>
 
 /*
 #include <cstdio>
@@ -31,27 +42,102 @@ std::string exec(const char* cmd) {
 }
 */
 
-#include <iostream>
-
 namespace iop_hal {
+static iop::Log wifiLogger(IOP_STR("WIFI"));
+
+// Kept up-to-date by the connectivity monitor, so checking it is free
+static std::atomic<StationStatus> stationStatus(StationStatus::GOT_IP);
+static std::once_flag monitorStarted;
+
+/// Connected means a running non-loopback interface with a routable address, a link without one is still connecting
+static auto currentStatus() noexcept -> StationStatus {
+  ifaddrs *interfaces = nullptr;
+  if (getifaddrs(&interfaces) < 0) return StationStatus::GOT_IP;
+
+  auto status = StationStatus::IDLE;
+  for (auto *interface = interfaces; interface; interface = interface->ifa_next) {
+    const auto flags = interface->ifa_flags;
+    if ((flags & IFF_LOOPBACK) || !(flags & IFF_UP) || !(flags & IFF_RUNNING)) continue;
+    status = StationStatus::CONNECTING;
+
+    const auto *address = interface->ifa_addr;
+    if (!address) continue;
+    // Link-local addresses are self-assigned, IPv4 ones (169.254.0.0/16) mean DHCP failed
+    if (address->sa_family == AF_INET6 && IN6_IS_ADDR_LINKLOCAL(&reinterpret_cast<const sockaddr_in6 *>(address)->sin6_addr)) continue;
+    if (address->sa_family == AF_INET && (ntohl(reinterpret_cast<const sockaddr_in *>(address)->sin_addr.s_addr) & 0xFFFF0000) == 0xA9FE0000) continue;
+    if (address->sa_family == AF_INET || address->sa_family == AF_INET6) {
+      status = StationStatus::GOT_IP;
+      break;
+    }
+  }
+  freeifaddrs(interfaces);
+  return status;
+}
+
+/// Watches netlink for link and address changes, from a thread, updating `stationStatus`.
+///
+/// Without netlink it's assumed to be connected, so requests are still attempted
+static void startMonitor() noexcept {
+  const auto fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    wifiLogger.errorln(IOP_STR("Unable to open netlink socket, connectivity won't be monitored"));
+    return;
+  }
+
+  sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+    wifiLogger.errorln(IOP_STR("Unable to bind netlink socket, connectivity won't be monitored"));
+    close(fd);
+    return;
+  }
+
+  // Subscribed before the first check, so no change is missed
+  stationStatus.store(currentStatus());
+
+  std::thread([fd]() {
+    alignas(nlmsghdr) char buffer[8192];
+    while (true) {
+      const auto size = recv(fd, buffer, sizeof(buffer), 0);
+      // ENOBUFS means events were dropped, the state is checked again anyway
+      if (size < 0 && errno != ENOBUFS) {
+        if (errno == EINTR) continue;
+        wifiLogger.errorln(IOP_STR("Netlink socket failed, connectivity won't be monitored"));
+        stationStatus.store(StationStatus::GOT_IP);
+        close(fd);
+        return;
+      }
+
+      auto changed = size < 0;
+      auto length = static_cast<size_t>(std::max(size, static_cast<ssize_t>(0)));
+      for (auto *message = reinterpret_cast<nlmsghdr *>(buffer); NLMSG_OK(message, length); message = NLMSG_NEXT(message, length)) {
+        const auto type = message->nlmsg_type;
+        changed = changed || type == RTM_NEWLINK || type == RTM_DELLINK || type == RTM_NEWADDR || type == RTM_DELADDR;
+      }
+      if (!changed) continue;
+
+      const auto status = currentStatus();
+      if (stationStatus.exchange(status) != status) {
+        wifiLogger.info(IOP_STR("Connection changed: "));
+        wifiLogger.infoln(statusToString(status));
+      }
+    }
+  }).detach();
+}
+
 Wifi::Wifi() noexcept {}
 Wifi::~Wifi() noexcept {}
 
 void Wifi::setup() noexcept {
   HTTPClient::setup();
+  std::call_once(monitorStarted, startMonitor);
 }
 
 StationStatus Wifi::status() const noexcept {
-  static auto running = false;
-  if (running) return StationStatus::GOT_IP;
-  running = true;
-
-  iop_hal::HTTPClient http;
-  const auto code = http.begin("https://google.com", [](iop_hal::Session & session) {
-    return session.sendRequest("GET", "");
-  }).code();
-  if (code <= 0) std::cout << code << std::endl;
-  return code > 0 ? StationStatus::GOT_IP : StationStatus::CONNECT_FAIL;
+  std::call_once(monitorStarted, startMonitor);
+  return stationStatus.load(std::memory_order_relaxed);
 }
 
 bool Wifi::connectToAccessPoint(std::string_view ssid, std::string_view psk) const noexcept {
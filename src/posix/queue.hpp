@@ -0,0 +1,56 @@
+#include "iop-hal/queue.hpp"
+
+#include <cstring>
+#include <string>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace iop_hal {
+static const char *queuePath = "queue.dat";
+
+auto PersistentQueue::load() noexcept -> bool {
+  this->region.assign(this->capacity, 0);
+
+  const auto fd = open(queuePath, O_RDONLY | O_CLOEXEC);
+  // A missing queue is created empty
+  if (fd < 0) return errno == ENOENT;
+
+  size_t offset = 0;
+  while (offset < this->capacity) {
+    const auto size = read(fd, this->region.data() + offset, this->capacity - offset);
+    if (size < 0 && errno == EINTR) continue;
+    if (size <= 0) break;
+    offset += static_cast<size_t>(size);
+  }
+  close(fd);
+  return true;
+}
+
+auto PersistentQueue::readBytes(const size_t offset, uint8_t *output, const size_t length) const noexcept -> void {
+  memcpy(output, this->region.data() + offset, length);
+}
+
+auto PersistentQueue::writeBytes(const size_t offset, const uint8_t *input, const size_t length) noexcept -> void {
+  memcpy(this->region.data() + offset, input, length);
+}
+
+/// Written to a temporary file that replaces the queue, so it's never left half written
+auto PersistentQueue::persist() noexcept -> bool {
+  const auto temporary = std::string(queuePath) + ".tmp";
+  const auto fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+
+  size_t offset = 0;
+  while (offset < this->capacity) {
+    const auto size = write(fd, this->region.data() + offset, this->capacity - offset);
+    if (size < 0 && errno == EINTR) continue;
+    if (size <= 0) break;
+    offset += static_cast<size_t>(size);
+  }
+  const auto ok = offset == this->capacity && fsync(fd) == 0;
+  close(fd);
+  return ok && rename(temporary.c_str(), queuePath) == 0;
+}
+}
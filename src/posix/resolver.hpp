@@ -0,0 +1,287 @@
+#include "iop-hal/thread.hpp"
+#include "iop-hal/log.hpp"
+
+#include <condition_variable>
+#include <unordered_map>
+#include <algorithm>
+#include <optional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstring>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+
+namespace iop_hal {
+// Lookups are cached for this long, `getaddrinfo` doesn't tell the records' TTL
+constexpr iop::time::milliseconds dnsCacheTTL = 5 * 60 * 1000;
+// Failed lookups are cached too, so an unreachable DNS server isn't asked again for every request
+constexpr iop::time::milliseconds dnsFailureTTL = 10000;
+constexpr size_t maxCachedHosts = 16;
+// Happy Eyeballs' "Connection Attempt Delay" (RFC 8305), the next address is tried if the previous one didn't connect by then
+constexpr iop::time::milliseconds connectionAttemptDelay = 250;
+constexpr iop::time::milliseconds connectTimeout = 10000;
+
+static iop::Log resolverLogger(IOP_STR("DNS"));
+
+struct Address {
+  sockaddr_storage storage;
+  socklen_t length;
+};
+
+enum class Resolution { PENDING, RESOLVED, FAILED };
+
+/// Caches `getaddrinfo` results. Lookups may run in the background, so resolving never stalls the main loop
+class Resolver {
+  /// Shared with the thread running `getaddrinfo`, that may outlive the request that started it
+  struct Lookup {
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+    std::vector<Address> addresses;
+  };
+
+  struct Entry {
+    std::vector<Address> addresses;
+    iop::time::milliseconds expires;
+    std::shared_ptr<Lookup> pending;
+  };
+
+  std::unordered_map<std::string, Entry> cache;
+
+  /// Interleaves the families, starting by the preferred one, as RFC 8305 recommends. `getaddrinfo` already sorts them by RFC 6724
+  static auto lookup(const std::string &host, const int flags = AI_ADDRCONFIG) noexcept -> std::vector<Address> {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = flags;
+
+    addrinfo *result = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || !result) return {};
+
+    std::vector<Address> preferred, other;
+    const auto family = result->ai_family;
+    for (auto *info = result; info; info = info->ai_next) {
+      if ((info->ai_family != AF_INET && info->ai_family != AF_INET6) || info->ai_addrlen > sizeof(sockaddr_storage)) continue;
+      Address address;
+      memset(&address.storage, 0, sizeof(address.storage));
+      memcpy(&address.storage, info->ai_addr, info->ai_addrlen);
+      address.length = info->ai_addrlen;
+      (info->ai_family == family ? preferred : other).push_back(address);
+    }
+    freeaddrinfo(result);
+
+    std::vector<Address> addresses;
+    addresses.reserve(preferred.size() + other.size());
+    for (size_t index = 0; index < std::max(preferred.size(), other.size()); ++index) {
+      if (index < preferred.size()) addresses.push_back(preferred[index]);
+      if (index < other.size()) addresses.push_back(other[index]);
+    }
+    return addresses;
+  }
+
+  static auto withPort(std::vector<Address> addresses, const uint16_t port) noexcept -> std::vector<Address> {
+    for (auto &address : addresses) {
+      if (address.storage.ss_family == AF_INET6) {
+        reinterpret_cast<sockaddr_in6 *>(&address.storage)->sin6_port = htons(port);
+      } else {
+        reinterpret_cast<sockaddr_in *>(&address.storage)->sin_port = htons(port);
+      }
+    }
+    return addresses;
+  }
+
+  void store(const std::string &host, std::vector<Address> addresses) noexcept {
+    if (addresses.empty()) {
+      resolverLogger.error(IOP_STR("Unable to resolve: "));
+      resolverLogger.errorln(host);
+    }
+    const auto ttl = addresses.empty() ? dnsFailureTTL : dnsCacheTTL;
+    auto &entry = this->cache[host];
+    entry.addresses = std::move(addresses);
+    entry.expires = iop_hal::thisThread.timeRunning() + ttl;
+    entry.pending.reset();
+  }
+
+  /// Makes room for a new host, dropping expired entries first
+  void evict() noexcept {
+    if (this->cache.size() < maxCachedHosts) return;
+    const auto now = iop_hal::thisThread.timeRunning();
+    for (auto it = this->cache.begin(); it != this->cache.end();) {
+      if (!it->second.pending && it->second.expires <= now) {
+        it = this->cache.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (this->cache.size() < maxCachedHosts) return;
+    const auto victim = std::find_if(this->cache.begin(), this->cache.end(), [](const auto &entry) { return !entry.second.pending; });
+    if (victim != this->cache.end()) this->cache.erase(victim);
+  }
+
+public:
+  Resolver() noexcept: cache() {}
+
+  /// Never blocks, the lookup runs in a thread if the host isn't cached. Call again until it isn't PENDING
+  auto resolve(const std::string &host, const uint16_t port, std::vector<Address> &addresses) noexcept -> Resolution {
+    auto it = this->cache.find(host);
+    if (it != this->cache.end() && it->second.pending) {
+      auto lookup = it->second.pending;
+      {
+        std::unique_lock<std::mutex> lock(lookup->mutex);
+        if (!lookup->done) return Resolution::PENDING;
+      }
+      this->store(host, std::move(lookup->addresses));
+      it = this->cache.find(host);
+    }
+
+    if (it == this->cache.end() || it->second.expires <= iop_hal::thisThread.timeRunning()) {
+      this->evict();
+      // IP literals are parsed right away, they never reach the DNS server
+      auto numeric = Resolver::lookup(host, AI_NUMERICHOST);
+      if (!numeric.empty()) {
+        this->store(host, std::move(numeric));
+        return this->resolve(host, port, addresses);
+      }
+
+      auto lookup = std::make_shared<Lookup>();
+      this->cache[host].pending = lookup;
+      resolverLogger.debug(IOP_STR("Resolving: "));
+      resolverLogger.debugln(host);
+      std::thread([lookup, host]() {
+        auto addresses = Resolver::lookup(host);
+        std::unique_lock<std::mutex> lock(lookup->mutex);
+        lookup->addresses = std::move(addresses);
+        lookup->done = true;
+        lookup->finished.notify_all();
+      }).detach();
+      return Resolution::PENDING;
+    }
+
+    if (it->second.addresses.empty()) return Resolution::FAILED;
+    addresses = withPort(it->second.addresses, port);
+    return Resolution::RESOLVED;
+  }
+
+  /// Waits for the lookup, if the host isn't cached
+  auto resolveBlocking(const std::string &host, const uint16_t port, std::vector<Address> &addresses) noexcept -> bool {
+    const auto it = this->cache.find(host);
+    if (it != this->cache.end() && it->second.pending) {
+      auto lookup = it->second.pending;
+      std::unique_lock<std::mutex> lock(lookup->mutex);
+      lookup->finished.wait(lock, [&lookup]() { return lookup->done; });
+    } else if (it == this->cache.end() || it->second.expires <= iop_hal::thisThread.timeRunning()) {
+      this->evict();
+      this->store(host, Resolver::lookup(host));
+    }
+    return this->resolve(host, port, addresses) == Resolution::RESOLVED;
+  }
+};
+
+/// Races connections to the host's addresses, Happy Eyeballs style (RFC 8305): a new attempt starts every
+/// `connectionAttemptDelay`, or as soon as the previous one fails, and the first to connect wins
+class Connector {
+  std::vector<Address> addresses;
+  size_t next;
+  std::vector<int> attempts;
+  iop::time::milliseconds nextAttempt;
+  iop::time::milliseconds deadline;
+  bool failed_;
+
+  void attempt() noexcept {
+    const auto &address = this->addresses[this->next++];
+    const auto fd = socket(address.storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+      resolverLogger.errorln(IOP_STR("Unable to open socket"));
+      return;
+    }
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&address.storage), address.length) < 0 && errno != EINPROGRESS) {
+      resolverLogger.error(IOP_STR("Unable to connect: "));
+      resolverLogger.errorln(std::string_view(strerror(errno)));
+      close(fd);
+      return;
+    }
+    this->attempts.push_back(fd);
+  }
+
+public:
+  explicit Connector(std::vector<Address> addresses) noexcept:
+    addresses(std::move(addresses)), next(0), attempts(), nextAttempt(0), deadline(iop_hal::thisThread.timeRunning() + connectTimeout), failed_(false) {}
+
+  Connector(Connector &&other) noexcept = delete;
+  Connector(const Connector &other) noexcept = delete;
+  auto operator=(Connector &&other) noexcept -> Connector & = delete;
+  auto operator=(const Connector &other) noexcept -> Connector & = delete;
+  ~Connector() noexcept {
+    for (const auto fd : this->attempts) close(fd);
+  }
+
+  auto failed() const noexcept -> bool { return this->failed_; }
+
+  /// Never blocks. Returns the connected (non-blocking) socket, that becomes the caller's, or -1 while connecting
+  auto poll() noexcept -> int {
+    while (!this->failed_) {
+      const auto now = iop_hal::thisThread.timeRunning();
+      if (now > this->deadline) {
+        resolverLogger.errorln(IOP_STR("Connection timed out"));
+        this->failed_ = true;
+        break;
+      }
+
+      std::vector<pollfd> fds;
+      this->fds(fds);
+      if (fds.size() > 0 && ::poll(fds.data(), fds.size(), 0) > 0) {
+        for (const auto &fd : fds) {
+          if (fd.revents == 0) continue;
+
+          int error = 0;
+          socklen_t length = sizeof(error);
+          this->attempts.erase(std::find(this->attempts.begin(), this->attempts.end(), fd.fd));
+          if (getsockopt(fd.fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) return fd.fd;
+
+          resolverLogger.error(IOP_STR("Unable to connect: "));
+          resolverLogger.errorln(std::string_view(strerror(error)));
+          close(fd.fd);
+          // The next address doesn't need to wait, as this one failed
+          this->nextAttempt = now;
+        }
+        continue;
+      }
+
+      if (this->next < this->addresses.size() && (this->attempts.empty() || now >= this->nextAttempt)) {
+        this->attempt();
+        this->nextAttempt = now + connectionAttemptDelay;
+        continue;
+      }
+      if (this->attempts.empty()) {
+        resolverLogger.errorln(IOP_STR("Unable to connect to any address"));
+        this->failed_ = true;
+      }
+      break;
+    }
+    return -1;
+  }
+
+  /// Sockets to wait for, they are writable once connected
+  void fds(std::vector<pollfd> &fds) const noexcept {
+    for (const auto fd : this->attempts) fds.push_back(pollfd { fd, POLLOUT, 0 });
+  }
+
+  /// Blocks until an attempt finishes, or it's time to start another
+  void wait() const noexcept {
+    std::vector<pollfd> fds;
+    this->fds(fds);
+    const auto now = iop_hal::thisThread.timeRunning();
+    const auto until = std::min(this->deadline, this->next < this->addresses.size() ? this->nextAttempt : this->deadline);
+    ::poll(fds.data(), fds.size(), until > now ? static_cast<int>(until - now) : 0);
+  }
+};
+} // namespace iop_hal
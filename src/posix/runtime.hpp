@@ -1,6 +1,7 @@
 #include "iop-hal/runtime.hpp"
 #include "iop-hal/thread.hpp"
 #include "iop-hal/panic.hpp"
+#include "iop-hal/client.hpp"
 
 #include <sys/resource.h>
 
@@ -36,7 +37,8 @@ int main(int argc, char** argv) {
   iop_hal::setup();
   while (true) {
     iop_hal::loop();
-    iop_hal::thisThread.sleep(50);
+    // Sleeps, but progresses asynchronous requests as their sockets become ready
+    iop_hal::HTTPClient::poll(50);
   }
   return 0;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "iop-hal/log.hpp"
 #include "iop-hal/thread.hpp"
 #include "iop-hal/panic.hpp"
+#include "cpp17/http_parser.hpp"
 
 #include <memory>
 #include <functional>
@@ -10,13 +11,22 @@
 #include <optional>
 #include <errno.h>
 #include <thread>
-#include <chrono>
+#include <atomic>
+#include <vector>
 
 #include <unistd.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <charconv>
+#include <array>
 
 namespace iop_hal {
 iop::Log & logger() noexcept {
@@ -25,17 +35,65 @@ iop::Log & logger() noexcept {
 }
 }
 
-static ssize_t send(int fd, const char * msg, const size_t len) noexcept {
-  if (iop_hal::logger().isTracing()) iop::Log::print(msg, iop::LogLevel::TRACE, iop::LogType::CONTINUITY);
-  ssize_t sent = 0;
-  uint64_t count = 0;
-  while ((sent = write(fd, msg, len)) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-    iop_assert(count++ < 1000000, IOP_STR("Waited too long"));
-    using namespace std::chrono_literals;
-    std::this_thread::sleep_for(50ms);
+// Connections past this are refused, the device only serves a few phones at a time
+constexpr size_t maxClients = 16;
+// Clients that don't send nor receive anything for this long are dropped, so slow ones can't hold a slot forever
+constexpr iop::time::milliseconds clientTimeout = 10000;
+constexpr size_t maxRequestSize = 16 * 1024;
+constexpr size_t maxLineLength = 4096;
+constexpr size_t maxHeadersSize = 8 * 1024;
+// Pipelined requests wait while this much response data is queued, so clients that don't read can't make us buffer forever.
+// Streaming writers are told to stop past it
+constexpr size_t maxPendingOutput = 64 * 1024;
+// Streamed bodies are buffered up to this, then sent as a chunk
+constexpr size_t streamBufferSize = 4096;
+// Worker threads wake up this often, to notice the server was closed
+constexpr int workerPollInterval = 100;
+
+/// Writes as much as the socket takes without blocking, with a single `writev`. Whatever is left is queued in the
+/// connection, to be sent when the socket is writable. Data is always queued if some is already waiting
+static void send(const iop_hal::HttpConnection &conn, iovec *iov, size_t count) noexcept {
+  if (iop_hal::logger().isTracing()) {
+    for (size_t index = 0; index < count; ++index)
+      iop::Log::print(std::string_view(static_cast<const char*>(iov[index].iov_base), iov[index].iov_len), iop::LogLevel::TRACE, iop::LogType::CONTINUITY);
   }
-  iop_assert(sent > 0, std::string("Sent failed (") + std::to_string(sent) + ") [" + std::to_string(errno) + "] " +  strerror(errno) + ": " + msg);
-  return sent;
+
+  if (conn.currentOutput.length() == 0) {
+    ssize_t sent = 0;
+    while ((sent = writev(*conn.currentClient, iov, static_cast<int>(count))) < 0 && errno == EINTR) {}
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      // The server notices the connection is broken when polling it
+      iop_hal::logger().error(IOP_STR("Unable to send response: "));
+      iop_hal::logger().errorln(std::string_view(strerror(errno)));
+      return;
+    }
+
+    auto left = sent < 0 ? 0 : static_cast<size_t>(sent);
+    while (count > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
+
+  for (; count > 0; ++iov, --count)
+    conn.currentOutput.append(static_cast<const char*>(iov->iov_base), iov->iov_len);
+}
+
+/// Sends queued response data, returns false if the connection is broken
+static auto flush(const iop_hal::HttpConnection &conn) noexcept -> bool {
+  while (conn.currentOutput.length() > 0) {
+    const auto sent = write(*conn.currentClient, conn.currentOutput.data(), conn.currentOutput.length());
+    if (sent < 0 && errno == EINTR) continue;
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+    if (sent <= 0) return false;
+    conn.currentOutput.erase(0, static_cast<size_t>(sent));
+  }
+  return true;
 }
 
 static std::string httpCodeToString(const int code) {
@@ -43,20 +101,233 @@ static std::string httpCodeToString(const int code) {
     return "OK";
   } else if (code == 302) {
     return "Found";
+  } else if (code == 304) {
+    return "Not Modified";
+  } else if (code == 400) {
+    return "Bad Request";
   } else if (code == 404) {
     return "Not Found";
+  } else if (code == 413) {
+    return "Payload Too Large";
+  } else if (code == 414) {
+    return "URI Too Long";
+  } else if (code == 431) {
+    return "Request Header Fields Too Large";
+  } else if (code == 501) {
+    return "Not Implemented";
   } else {
     iop_panic(std::string("Http code not known: ") + std::to_string(code));
   }
 }
 
+/// Serializes the response head at once, so it's sent together with the start of the body
+static auto responseHead(const iop_hal::HttpConnection &conn, const uint16_t code, const iop::StaticString contentType, const std::optional<size_t> contentLength) noexcept -> std::string {
+  std::array<char, 20> number;
+  auto head = std::string();
+  head.reserve(128 + conn.currentHeaders.length());
+  head.append("HTTP/1.1 ");
+  head.append(number.data(), static_cast<size_t>(std::to_chars(number.begin(), number.end(), code).ptr - number.begin()));
+  head.append(" ").append(httpCodeToString(code)).append("\r\n");
+  head.append("Content-Type: ").append(contentType.asCharPtr()).append("; charset=ISO-8859-5\r\n");
+  head.append(conn.currentHeaders);
+  if (contentLength) {
+    head.append("Content-Length: ");
+    head.append(number.data(), static_cast<size_t>(std::to_chars(number.begin(), number.end(), *contentLength).ptr - number.begin()));
+    head.append("\r\n");
+  } else if (conn.chunked) {
+    head.append("Transfer-Encoding: chunked\r\n");
+  }
+  head.append(conn.keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+  head.append("\r\n");
+  return head;
+}
+
+/// Value of the current request's header named `name`
+static auto requestHeader(const iop_hal::HttpConnection &conn, const std::string_view name) noexcept -> std::optional<std::string_view> {
+  auto headers = std::string_view(conn.currentRequestHeaders);
+  while (headers.length() > 0) {
+    const auto lineEnd = std::min(headers.find("\r\n"), headers.length());
+    if (const auto value = iop_hal::headerValue(headers.substr(0, lineEnd), name)) return value;
+    headers = headers.substr(std::min(lineEnd + 2, headers.length()));
+  }
+  return std::nullopt;
+}
+
+/// Streaming writers should stop while the client is behind, they are resumed by `onWritable` as it catches up.
+/// Handlers run in the server's thread, so waiting for the client would stall every other connection
+static auto writable(const iop_hal::HttpConnection &conn) noexcept -> bool {
+  return !conn.broken && conn.currentOutput.length() <= maxPendingOutput;
+}
+
+/// Sends as much of the file as the socket takes. The file goes straight from the page cache to the socket, so it waits
+/// until nothing is queued before it. Returns false if the file can't be sent anymore
+static auto sendFileBody(iop_hal::HttpConnection &conn) noexcept -> bool {
+  while (conn.fileLeft > 0 && conn.currentOutput.length() == 0) {
+    auto offset = static_cast<off_t>(conn.fileOffset);
+    const auto sent = ::sendfile(*conn.currentClient, conn.currentFile, &offset, conn.fileLeft);
+    if (sent < 0 && errno == EINTR) continue;
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+    // The file shrunk, the promised length can't be honored anymore
+    if (sent <= 0) return false;
+    conn.fileOffset += static_cast<size_t>(sent);
+    conn.fileLeft -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+/// Sends the head, if still pending, and the buffered body followed by `data`, as a chunk if the length is unknown
+static auto flushStream(iop_hal::HttpConnection &conn, const std::string_view data, const bool last) noexcept -> bool {
+  // The head is at the start of the buffer until the first flush
+  const auto &stream = conn.currentStream;
+  const auto bodyStart = std::min(conn.streamHead, stream.length());
+  const auto bodyLength = stream.length() - bodyStart + data.length();
+
+  std::array<char, 20> size;
+  auto sizeLength = static_cast<size_t>(std::to_chars(size.begin(), size.end() - 2, bodyLength, 16).ptr - size.begin());
+  size[sizeLength++] = '\r';
+  size[sizeLength++] = '\n';
+  const auto chunk = conn.chunked && bodyLength > 0;
+  const auto end = std::string_view(chunk ? "\r\n" : "");
+  const auto terminator = std::string_view(conn.chunked && last ? "0\r\n\r\n" : "");
+
+  std::array<iovec, 6> iov = {{
+    { const_cast<char*>(stream.data()), bodyStart },
+    { size.data(), chunk ? sizeLength : 0 },
+    { const_cast<char*>(stream.data() + bodyStart), stream.length() - bodyStart },
+    { const_cast<char*>(data.data()), data.length() },
+    { const_cast<char*>(end.data()), end.length() },
+    { const_cast<char*>(terminator.data()), terminator.length() },
+  }};
+  ::send(conn, iov.data(), iov.size());
+  conn.currentStream.clear();
+  conn.streamHead = 0;
+  return writable(conn);
+}
+
 namespace iop_hal {
-HttpServer::HttpServer(const uint32_t port) noexcept: port(3000) {
+/// Accepts and serves the clients of one listening socket. Polled by `HttpServer::handleClient`, or by its own worker thread
+class HttpServerLoop {
+  /// The connection and the state of the requests read from it
+  struct Client {
+    HttpConnection conn;
+    RequestParser parser;
+    // Pipelined requests read while the responses before them are queued, handled once they are sent
+    std::string unparsed;
+    // The client stopped sending, it's closed once the requests received are answered
+    bool eof;
+    // The last response is queued, the connection is closed once it's sent
+    bool closing;
+    bool continued;
+    // The handler returned, but its response is still being sent by `sendFile` or `onWritable`
+    bool responding;
+    // Bytes the kernel hadn't sent yet at the last timeout check. The socket may not become writable for a while
+    // with a slow reader and a big send buffer, but it's still active while this goes down
+    int unsent;
+
+    Client() noexcept: conn(), parser(maxLineLength, maxHeadersSize, maxRequestSize), unparsed(), eof(false), closing(false), continued(false), responding(false), unsent(0) {}
+  };
+
+  HttpServer &server;
+  int listenFD;
+  int epollFD;
+  std::unordered_map<int, std::unique_ptr<Client>> clients;
+  std::thread thread;
+  std::atomic<bool> running;
+
+  void accept() noexcept;
+  void receive(Client &client) noexcept;
+  /// Handles every complete request in `input`, in order, keeping the incomplete one in the parser
+  void process(Client &client, std::string_view input) noexcept;
+  void respond(Client &client) noexcept;
+  /// Sends more of the response the handler left behind, once the socket takes it
+  void resume(Client &client) noexcept;
+  /// Prepares the connection for the next request, once the response is done
+  void finish(Client &client) noexcept;
+  void reject(Client &client, RequestParser::Error error) noexcept;
+  auto watch(const Client &client, int operation) noexcept -> bool;
+  void drop(int fd) noexcept;
+
+public:
+  HttpServerLoop(HttpServer &server, int listenFD, int epollFD) noexcept:
+    server(server), listenFD(listenFD), epollFD(epollFD), clients(), thread(), running(false) {}
+  HttpServerLoop(const HttpServerLoop &other) noexcept = delete;
+  HttpServerLoop(HttpServerLoop &&other) noexcept = delete;
+  auto operator=(const HttpServerLoop &other) noexcept -> HttpServerLoop & = delete;
+  auto operator=(HttpServerLoop &&other) noexcept -> HttpServerLoop & = delete;
+  ~HttpServerLoop() noexcept {
+    this->stop();
+    ::close(this->epollFD);
+    ::close(this->listenFD);
+  }
+
+  /// Binds a new listening socket. Workers share the port, and the kernel spreads the connections between them
+  static auto open(HttpServer &server, const sockaddr_in &addr, const bool shared) noexcept -> std::unique_ptr<HttpServerLoop> {
+    int fd = 0;
+    if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) <= 0) {
+      logger().errorln(IOP_STR("Unable to open socket"));
+      return nullptr;
+    }
+
+    const int reuse = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+      logger().errorln(IOP_STR("Unable to set SO_REUSEADDR to socket"));
+    }
+    if (shared && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+      logger().errorln(IOP_STR("Unable to set SO_REUSEPORT to socket"));
+      ::close(fd);
+      return nullptr;
+    }
+
+    // Is this UB? (posix depends on casting struct into another one, but that's technically not allowed in C++)
+    if (bind(fd, (struct sockaddr* )&addr, sizeof(addr)) < 0) {
+      iop_panic(std::string("Unable to bind socket (") + std::to_string(errno) + "): " + strerror(errno));
+    }
+    if (listen(fd, 100) < 0) {
+      logger().errorln(IOP_STR("Unable to listen socket"));
+      ::close(fd);
+      return nullptr;
+    }
+
+    const auto epollFD = epoll_create1(EPOLL_CLOEXEC);
+    iop_assert(epollFD >= 0, std::string("Unable to create epoll (") + std::to_string(errno) + "): " + strerror(errno));
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    iop_assert(epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &event) == 0, IOP_STR("Unable to watch server socket"));
+    return std::make_unique<HttpServerLoop>(server, fd, epollFD);
+  }
+
+  /// Handles everything that is ready, waiting up to `timeout` milliseconds for something to happen
+  void poll(int timeout) noexcept;
+
+  /// Polls from a new thread until stopped
+  void start() noexcept {
+    this->running = true;
+    this->thread = std::thread([this]() {
+      while (this->running) this->poll(workerPollInterval);
+    });
+  }
+
+  void stop() noexcept {
+    this->running = false;
+    if (this->thread.joinable()) this->thread.join();
+    while (this->clients.size() > 0) this->drop(this->clients.begin()->first);
+  }
+};
+
+HttpServer::HttpServer(const uint32_t port) noexcept: port(port), workers(0), address(nullptr), loops() {
   this->notFoundHandler = [](HttpConnection &conn, iop::Log const &logger) {
     conn.send(404, IOP_STR("text/plain"), IOP_STR("Not Found"));
     (void) logger;
   };
 }
+HttpServer::~HttpServer() noexcept {
+  this->close();
+}
+void HttpServer::setWorkers(const uint8_t count) noexcept {
+  this->workers = count;
+}
 // We keep the server open because linux doesn't deal well with reuse and we close the server between iop credentials tests because some platforms depend on it
 void HttpServer::begin() noexcept {
   IOP_TRACE();
@@ -69,41 +340,21 @@ void HttpServer::begin() noexcept {
   addr.sin_port = htons(static_cast<uint16_t>(this->port));
   memset(addr.sin_zero, '\0', sizeof(addr.sin_zero));
 
-  int fd = 0;
-  if (!this->maybeFD) {
-    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) <= 0) {
-      logger().errorln(IOP_STR("Unable to open socket"));
-      return;
-    }
-
-    const char reuse = 1;
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse)) < 0) {
-      logger().errorln(IOP_STR("Unable to set SO_REUSEPORT to socket"));
-      //return;
-    }
-
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags == -1) {
-      logger().error(IOP_STR("fnctl get failed: "));
-      logger().errorln(static_cast<uint64_t>(flags));
-      return;
-    }
-    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
-      logger().errorln(IOP_STR("fnctl set failed"));
-      return;
-    }
-    this->maybeFD = fd;
-    
-    // Is this UB? (posix depends on casting struct into another one, but that's technically not allowed in C++)
-    if (bind(fd, (struct sockaddr* )&addr, sizeof(addr)) < 0) {
-      iop_panic(std::string("Unable to bind socket (") + std::to_string(errno) + "): " + strerror(errno));
-      return;
-    }
-    if (listen(fd, 100) < 0) {
-      logger().errorln(IOP_STR("Unable to listen socket"));
-      return;
+  const size_t count = this->workers > 0 ? this->workers : 1;
+  if (this->loops.size() != count) {
+    this->loops.clear();
+    for (size_t index = 0; index < count; ++index) {
+      auto loop = HttpServerLoop::open(*this, addr, this->workers > 0);
+      if (!loop) {
+        this->loops.clear();
+        return;
+      }
+      this->loops.push_back(std::move(loop));
     }
   }
+  if (this->workers > 0) {
+    for (auto &loop: this->loops) loop->start();
+  }
 
   logger().info(IOP_STR("Listening to port "));
   logger().infoln(static_cast<uint64_t>(this->port));
@@ -112,162 +363,299 @@ void HttpServer::begin() noexcept {
   iop_assert(this->address, IOP_STR("OOM"));
 }
 
-void HttpServer::handleClient() noexcept {
-  IOP_TRACE();
-  if (!this->address)
-    return;
+void HttpServerLoop::accept() noexcept {
+  while (true) {
+    sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    const auto client = accept4(this->listenFD, (sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        logger().error(IOP_STR("Error accepting connection ("));
+        logger().error(static_cast<uint64_t>(errno));
+        logger().error(IOP_STR("): "));
+        logger().errorln(std::string_view(strerror(errno)));
+      }
+      return;
+    }
 
-  iop_assert(!this->isHandlingRequest, IOP_STR("Already handling a request"));
-  this->isHandlingRequest = true;
+    if (this->clients.size() >= maxClients) {
+      logger().warnln(IOP_STR("Too many clients, refusing connection"));
+      ::close(client);
+      continue;
+    }
+
+    logger().debug(IOP_STR("Accepted connection: "));
+    logger().debugln(static_cast<uint64_t>(client));
+
+    auto state = std::make_unique<Client>();
+    state->conn.currentClient = client;
+    state->conn.lastActivity = iop_hal::thisThread.timeRunning();
+    if (!this->watch(*state, EPOLL_CTL_ADD)) {
+      logger().errorln(IOP_STR("Unable to watch client socket"));
+      state->conn.reset();
+      continue;
+    }
+    this->clients.emplace(client, std::move(state));
+  }
+}
+
+/// Requests are read while we keep up with them, or to discard them once closing. The socket is only watched for
+/// writability while there is something to send, and not for reading after the client stopped sending, or it would
+/// wake up for nothing
+auto HttpServerLoop::watch(const Client &client, const int operation) noexcept -> bool {
+  const auto reading = !client.eof && (client.closing || client.unparsed.empty());
+  const auto writing = client.conn.currentOutput.length() > 0 || client.responding;
+  epoll_event event = {};
+  event.events = (reading ? static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP) : 0u) | (writing ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+  event.data.fd = *client.conn.currentClient;
+  return epoll_ctl(this->epollFD, operation, *client.conn.currentClient, &event) == 0;
+}
 
-  iop_assert(this->maybeFD, IOP_STR("FD not found"));
-  int fd = *this->maybeFD;
+void HttpServerLoop::drop(const int fd) noexcept {
+  logger().debugln(IOP_STR("Close connection"));
+  const auto client = this->clients.find(fd);
+  if (client == this->clients.end()) return;
+  epoll_ctl(this->epollFD, EPOLL_CTL_DEL, fd, nullptr);
+  client->second->conn.reset();
+  this->clients.erase(client);
+}
 
-  auto addr = *this->address;
-  socklen_t addr_len = sizeof(addr);
+void HttpServer::dispatch(HttpConnection &conn, const bool concurrent) noexcept {
+  logger().debug(IOP_STR("Route: "));
+  logger().debugln(conn.currentRoute);
+  // Buffering logs is global, so it's left alone while other workers may be logging
+  if (!concurrent) iop::Log::shouldFlush(false);
+  if (const auto *handler = this->router.find(conn.currentMethod, conn.currentRoute, conn.currentParams)) {
+    (*handler)(conn, logger());
+  } else {
+    logger().debugln(IOP_STR("Route not found"));
+    this->notFoundHandler(conn, logger());
+  }
+  if (!concurrent) iop::Log::shouldFlush(true);
+  logger().flush();
+}
 
-  HttpConnection conn;
-  auto client = 0;
-  if ((client = accept(fd, (sockaddr *)&addr, &addr_len)) <= 0) {
-    if (client == 0) {
-      logger().errorln(IOP_STR("Client fd is zero"));
-    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-      logger().error(IOP_STR("Error accepting connection ("));
+/// Reads everything available, handling the requests as they are complete
+void HttpServerLoop::receive(Client &client) noexcept {
+  const auto fd = *client.conn.currentClient;
+
+  auto buffer = HttpConnection::Buffer();
+  while (client.closing || client.unparsed.empty()) {
+    const auto signedLen = read(fd, buffer.data(), buffer.size());
+    if (signedLen < 0 && errno == EINTR) continue;
+    if (signedLen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (signedLen < 0) {
+      logger().error(IOP_STR("Error reading from socket ("));
       logger().error(static_cast<uint64_t>(errno));
-      logger().error(IOP_STR("): "));
+      logger().error(IOP_STR(") - "));
       logger().errorln(std::string_view(strerror(errno)));
+      this->drop(fd);
+      return;
+    }
+    // The client may only have stopped sending, the responses can still be written
+    if (signedLen == 0) {
+      client.eof = true;
+      break;
     }
-    this->isHandlingRequest = false;
-    return;
-  }
-  logger().debug(IOP_STR("Accepted connection: "));
-  logger().debugln(static_cast<uint64_t>(client));
-  conn.currentClient = client;
 
-  auto firstLine = true;
-  auto isPayload = false;
+    // Closing with unread data resets the connection, which may discard the response before the client reads it
+    if (client.closing) continue;
+    this->process(client, std::string_view(buffer.data(), static_cast<size_t>(signedLen)));
+  }
+}
 
-  auto buffer = HttpConnection::Buffer({0});
-  ssize_t signedLen = 0;
-  size_t len = 0;
-  while (true) {
-    logger().debug(IOP_STR("Try read: "));
-    logger().debugln(static_cast<uint64_t>(strnlen(buffer.begin(), buffer.max_size())));
-
-    if (len < buffer.max_size() &&
-        (signedLen = read(client, buffer.data() + len, buffer.max_size() - len)) < 0) {
-      logger().error(IOP_STR("Read error: "));
-      logger().errorln(static_cast<uint64_t>(len));
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        iop_hal::thisThread.sleep(50);
-        continue;
-      } else {
-        logger().error(IOP_STR("Error reading from socket ("));
-        logger().error(static_cast<uint64_t>(signedLen));
-        logger().error(IOP_STR("): "));
-        logger().error(static_cast<uint64_t>(errno));
-        logger().error(IOP_STR(" - "));
-        logger().errorln(std::string_view(strerror(errno)));
-        conn.reset();
-        this->isHandlingRequest = false;
-        return;
-      }
+void HttpServerLoop::process(Client &client, std::string_view input) noexcept {
+  auto &conn = client.conn;
+  auto &parser = client.parser;
+  while (!client.closing) {
+    // Responses are sent in order, so the next request waits while too much of them is queued
+    if (input.length() > 0 && (conn.currentOutput.length() > maxPendingOutput || client.responding)) {
+      client.unparsed.assign(input.data(), input.length());
+      return;
     }
-    len += static_cast<size_t>(signedLen);
-    logger().debug(IOP_STR("Len: "));
-    logger().debugln(static_cast<uint64_t>(len));
-
-    if (firstLine && len == 0) {
-      logger().errorln(IOP_STR("Empty request"));
-      conn.reset();
-      this->isHandlingRequest = false;
+
+    // The parser bounds the body size
+    const auto body = parser.parse(input);
+    conn.currentPayload.append(body.data(), body.length());
+
+    if (parser.state() == RequestParser::State::ERROR) {
+      this->reject(client, parser.error());
       return;
+    } else if (parser.state() == RequestParser::State::DONE) {
+      this->respond(client);
+    } else if (parser.headersDone() && parser.expectContinue() && !client.continued) {
+      client.continued = true;
+      auto iov = iovec { const_cast<char*>("HTTP/1.1 100 Continue\r\n\r\n"), 25 };
+      ::send(conn, &iov, 1);
     }
-    logger().debug(IOP_STR("Read: ("));
-    logger().debug(static_cast<uint64_t>(len));
-    logger().debugln(IOP_STR(")"));
 
-    if (len == 0) {
-      logger().debug(IOP_STR("EOF: "));
-      logger().debugln(isPayload);
-      break;
+    if (input.length() == 0) break;
+  }
+}
+
+void HttpServerLoop::respond(Client &client) noexcept {
+  auto &conn = client.conn;
+  auto &parser = client.parser;
+  logger().debug(parser.method());
+  logger().debug(IOP_STR(": "));
+  logger().debugln(parser.target());
+
+  conn.currentMethod.assign(parser.method());
+  conn.currentRoute.assign(parser.target());
+  conn.currentRequestHeaders.assign(parser.headers());
+  conn.currentVersion = parser.version();
+  conn.keepAlive = parser.persistent();
+  conn.responded = false;
+  this->server.dispatch(conn, this->thread.joinable());
+  client.responding = conn.currentFile >= 0 || (conn.streaming && conn.currentWriter && !conn.broken);
+  if (client.responding) return;
+  if (conn.streaming) conn.endResponse();
+  this->finish(client);
+}
+
+void HttpServerLoop::resume(Client &client) noexcept {
+  auto &conn = client.conn;
+  if (conn.currentFile >= 0) {
+    if (!sendFileBody(conn)) {
+      logger().warnln(IOP_STR("Unable to send file"));
+      conn.broken = true;
+    }
+    if (conn.fileLeft > 0 && !conn.broken) return;
+    ::close(conn.currentFile);
+    conn.currentFile = -1;
+  } else if (conn.currentWriter) {
+    // Called once per wake up, so other clients are served in between
+    if (!writable(conn)) {
+      if (!conn.broken) return;
+    } else if (conn.currentWriter(conn)) {
+      return;
     }
+    conn.currentWriter = nullptr;
+    if (conn.streaming) conn.endResponse();
+  }
+  client.responding = false;
+  this->finish(client);
+}
 
-    auto buff = std::string_view(buffer.begin(), len);
-    if (len > 0 && firstLine) {
-      if (buff.find("POST") != buff.npos) {
-        const auto space = buff.substr(5).find(" ");
-        conn.currentRoute = buff.substr(5, space);
-        logger().debug(IOP_STR("POST: "));
-        logger().debugln(conn.currentRoute);
-      } else if (buff.find("GET") != buff.npos) {
-        const auto space = buff.substr(4).find(" ");
-        conn.currentRoute = buff.substr(4, space);
-        logger().debug(IOP_STR("GET: "));
-        logger().debugln(conn.currentRoute);
-      } else if (buff.find("OPTIONS") != buff.npos) {
-        const auto space = buff.substr(8).find(" ");
-        conn.currentRoute = buff.substr(8, space);
-        logger().debug(IOP_STR("OPTIONS: "));
-        logger().debugln(conn.currentRoute);
-      } else {
-        logger().error(IOP_STR("HTTP Method not found: "));
-        logger().errorln(buff);
-        conn.reset();
-        this->isHandlingRequest = false;
-        return;
-      }
-      firstLine = false;
-
-      iop_assert(buff.find("\r\n") != buff.npos, IOP_STR("First: ").toString() + std::to_string(buff.length()) + IOP_STR(" bytes don't contain newline, the path is too long\n").toString());
-      logger().debugln(IOP_STR("Found first line"));
-      const auto newlineIndex = buff.find("\r\n");
-      len -= newlineIndex + 2;
-      memmove(buffer.data(), buffer.begin() + newlineIndex + 2, len);
-      buff = std::string_view(buffer.begin(), len);
+void HttpServerLoop::finish(Client &client) noexcept {
+  auto &conn = client.conn;
+  auto &parser = client.parser;
+  client.closing = client.closing || !conn.keepAlive || !conn.responded || conn.broken;
+
+  // The connection is reused by the next request
+  conn.currentHeaders.clear();
+  conn.currentPayload.clear();
+  conn.currentContentLength.reset();
+  conn.currentParams.clear();
+  conn.currentArgs.clear();
+  conn.currentArgsIndexed = false;
+  conn.currentStream.clear();
+  conn.streamHead = 0;
+  conn.currentWriter = nullptr;
+  conn.chunked = false;
+  conn.broken = false;
+  parser.reset();
+  client.continued = false;
+}
+
+void HttpServerLoop::reject(Client &client, const RequestParser::Error error) noexcept {
+  logger().error(IOP_STR("Invalid request: "));
+  logger().errorln(static_cast<uint64_t>(error));
+
+  auto &conn = client.conn;
+  conn.currentHeaders.clear();
+  conn.currentContentLength.reset();
+  conn.currentMethod.clear();
+  conn.keepAlive = false;
+  conn.send(static_cast<uint16_t>(error), IOP_STR("text/plain"), IOP_STR(""));
+  client.closing = true;
+}
+
+void HttpServerLoop::poll(const int timeout) noexcept {
+  // Polls again after accepting, so requests sent right after connecting are handled now, not in the next loop
+  std::array<epoll_event, 16> events;
+  auto now = iop_hal::thisThread.timeRunning();
+  for (uint8_t round = 0; round < 4; ++round) {
+    const auto count = epoll_wait(this->epollFD, events.data(), static_cast<int>(events.size()), round == 0 ? timeout : 0);
+    if (count < 0 && errno != EINTR) {
+      logger().error(IOP_STR("Unable to poll connections: "));
+      logger().errorln(std::string_view(strerror(errno)));
     }
-    logger().debug(IOP_STR("Headers + Payload: "));
-    logger().debugln(buff);
-
-    while (len > 0 && !isPayload) {
-      const auto newlineIndex = buff.find("\r\n");
-      // TODO: if empty line is split into two reads (because of buff len) we are screwed
-      if (newlineIndex == buff.npos) {
-        iop_panic(IOP_STR("Bad code"));
-      } else if (newlineIndex != buff.npos && newlineIndex == buff.find("\r\n\r\n")) {
-        isPayload = true;
-        len -= newlineIndex + 4;
-        memmove(buffer.data(), buffer.begin() + newlineIndex + 4, len);
-        buff = std::string_view(buffer.begin(), len);
-      } else {
-        len -= newlineIndex + 2;
-        memmove(buffer.data(), buffer.begin() + newlineIndex + 2, len);
-        buff = std::string_view(buffer.begin(), len);
+    if (count <= 0) break;
+
+    now = iop_hal::thisThread.timeRunning();
+    for (int index = 0; index < count; ++index) {
+      const auto fd = events[static_cast<size_t>(index)].data.fd;
+      const auto flags = events[static_cast<size_t>(index)].events;
+      if (fd == this->listenFD) {
+        this->accept();
+        continue;
       }
-    }
 
-    logger().debug(IOP_STR("Payload ("));
-    logger().debug(static_cast<uint64_t>(len));
-    logger().debugln(IOP_STR(")"));
+      const auto found = this->clients.find(fd);
+      if (found == this->clients.end()) continue;
+      auto &client = *found->second;
+      auto &conn = client.conn;
+      conn.lastActivity = now;
+
+      if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        this->receive(client);
+        // It may have been dropped
+        if (this->clients.count(fd) == 0) continue;
+      }
 
-    conn.currentPayload += buff;
+      auto broken = !flush(conn);
+      if (!broken && client.responding) {
+        this->resume(client);
+        broken = !flush(conn);
+      }
+      // Resumes the pipelined requests, now that the responses before them were sent
+      while (!broken && !client.responding && client.unparsed.length() > 0 && conn.currentOutput.length() <= maxPendingOutput) {
+        const auto unparsed = std::move(client.unparsed);
+        client.unparsed.clear();
+        this->process(client, unparsed);
+        broken = !flush(conn);
+      }
+      if (client.eof && client.unparsed.length() == 0) client.closing = true;
+
+      if (broken) {
+        this->drop(fd);
+      } else if (client.closing && !client.responding && conn.currentOutput.length() == 0) {
+        this->drop(fd);
+      } else if (!this->watch(client, EPOLL_CTL_MOD)) {
+        this->drop(fd);
+      }
+    }
+  }
 
-    logger().debug(IOP_STR("Route: "));
-    logger().debugln(conn.currentRoute);
-    iop::Log::shouldFlush(false);
-    if (this->router.count(conn.currentRoute) != 0) {
-      this->router.at(conn.currentRoute)(conn, logger());
+  // Clients accepted in the last round are more recent than `now`
+  for (auto client = this->clients.begin(); client != this->clients.end();) {
+    const auto fd = client->first;
+    auto &state = *client->second;
+    ++client;
+    if (state.conn.lastActivity + clientTimeout >= now) continue;
+
+    int unsent = 0;
+    if (ioctl(fd, SIOCOUTQ, &unsent) == 0 && unsent > 0 && unsent != state.unsent) {
+      state.unsent = unsent;
+      state.conn.lastActivity = now;
     } else {
-      logger().debugln(IOP_STR("Route not found"));
-      this->notFoundHandler(conn, logger());
+      logger().warnln(IOP_STR("Client timed out"));
+      this->drop(fd);
     }
-    iop::Log::shouldFlush(true);
-    logger().flush();
-    break;
   }
 
-  logger().debugln(IOP_STR("Close connection"));
-  conn.reset();
+}
+
+void HttpServer::handleClient() noexcept {
+  IOP_TRACE();
+  // Workers poll by themselves
+  if (!this->address || this->workers > 0 || this->loops.size() == 0)
+    return;
+
+  iop_assert(!this->isHandlingRequest, IOP_STR("Already handling a request"));
+  this->isHandlingRequest = true;
+  this->loops.front()->poll(0);
   this->isHandlingRequest = false;
 }
 void HttpServer::close() noexcept {
@@ -277,114 +665,84 @@ void HttpServer::close() noexcept {
     this->address = nullptr;
   }
 
+  for (auto &loop: this->loops) loop->stop();
+
   //if (this->maybeFD) ::close(*this->maybeFD);
   //this->maybeFD = std::nullopt;
 }
 
 void HttpServer::on(iop::StaticString uri, HttpServer::Callback handler) noexcept {
-  this->router.emplace(uri.toString(), handler);
+  const auto inserted = this->router.insert(uri.toString(), std::move(handler));
+  iop_assert(inserted, std::string("Invalid route: ") + uri.toString());
 }
 //called when handler is not assigned
 void HttpServer::onNotFound(HttpServer::Callback fn) noexcept {
   this->notFoundHandler = fn;
 }
 
-static auto percentDecode(const std::string_view input) noexcept -> std::optional<std::string> {
-  logger().debug(IOP_STR("Decode: "));
-  logger().debugln(input);
-  static const char tbl[256] = {
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    0, 1, 2, 3, 4, 5, 6, 7,  8, 9,-1,-1,-1,-1,-1,-1,
-    -1,10,11,12,13,14,15,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,10,11,12,13,14,15,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
-    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1
-  };
-  std::string out;
-  out.reserve(input.length());
-  char c = '\0';
-  const char *in = input.begin();
-  while((c = *in++) && static_cast<size_t>(in - input.begin()) <= input.length()) {
-    if(c == '%') {
-      const auto v1 = tbl[(unsigned char)*in++];
-      const auto v2 = tbl[(unsigned char)*in++];
-      if(v1 < 0 || v2 < 0)
-        return std::nullopt;
-      c = static_cast<char>((v1 << 4) | v2);
-    }
-    out.push_back(c);
-  }
-  return out;
-}
-
 void HttpConnection::reset() noexcept {
   this->currentHeaders = "";
   this->currentPayload = "";
+  this->currentOutput = "";
+  this->currentRequestHeaders = "";
+  this->currentParams.clear();
+  this->currentArgs.clear();
+  this->currentArgsIndexed = false;
+  this->currentStream = "";
+  this->streamHead = 0;
+  this->streaming = false;
+  this->currentWriter = nullptr;
+  if (this->currentFile >= 0) ::close(this->currentFile);
+  this->currentFile = -1;
+  this->fileOffset = 0;
+  this->fileLeft = 0;
+  this->chunked = false;
+  this->broken = false;
+  this->keepAlive = false;
+  this->responded = false;
   this->currentContentLength.reset();
   if (this->currentClient) ::close(*this->currentClient);
   this->currentClient = std::nullopt;
 }
 auto HttpConnection::arg(const iop::StaticString name) const noexcept -> std::optional<std::string> {
   IOP_TRACE();
-  std::string_view view(this->currentPayload);
-
-  auto argEncodingLen = 1 + name.length(); // len(name) + len('=')
-  auto index = view.find(name.toString() + "=");
-  if (index != 0) index = view.find(std::string("&") + name.asCharPtr() + "=");
-  if (index == view.npos) return std::nullopt;
-  if (index != 0) argEncodingLen++; // + len('&')
-  view = view.substr(index + argEncodingLen);
-
-  const auto end = view.find("&");
-
-  if (end == view.npos) {
-    const auto decoded = percentDecode(view);
-    logger().debugln(decoded.value_or("No value"));
-    return decoded;
+  if (!this->currentArgsIndexed) {
+    this->currentArgsIndexed = true;
+    // The index decodes the arguments in place, the request isn't used after its handler
+    auto &route = const_cast<std::string &>(this->currentRoute);
+    auto &payload = const_cast<std::string &>(this->currentPayload);
+    const auto query = route.find('?');
+    if (query != route.npos) this->currentArgs.urlEncoded(route.data() + query + 1, route.length() - query - 1);
+
+    const auto contentType = requestHeader(*this, "Content-Type").value_or("");
+    if (!this->currentArgs.body(payload.data(), payload.length(), contentType)) {
+      logger().warn(IOP_STR("Invalid request body: "));
+      logger().warnln(contentType);
+    }
   }
 
-  const auto msg = view.substr(0, end);
-  const auto decoded = percentDecode(msg);
-  logger().debugln(decoded.value_or("No value"));
-  return decoded;
+  const auto value = this->currentArgs.get(std::string_view(name.asCharPtr(), name.length()));
+  logger().debugln(value.value_or("No value"));
+  if (!value) return std::nullopt;
+  return std::string(*value);
 }
 
 void HttpConnection::send(uint16_t code, iop::StaticString contentType, iop::StaticString content) const noexcept {
   IOP_TRACE();
   iop_assert(this->currentClient, IOP_STR("No active client"));
-  const auto fd = *this->currentClient;
 
-  const auto codeStr = std::to_string(code);
-  const auto codeText = httpCodeToString(code);
+  // Like the ESP's WebServer, the content is the whole body unless told otherwise, so the connection can be reused
+  auto head = responseHead(*this, code, contentType, this->currentContentLength.value_or(content.length()));
+  this->responded = true;
+
   if (logger().isTracing())
     iop::Log::print(IOP_STR(""), iop::LogLevel::TRACE, iop::LogType::START);
-  ::send(fd, "HTTP/1.0 ", 9);
-  ::send(fd, codeStr.c_str(), codeStr.length());
-  ::send(fd, " ", 1);
-  ::send(fd, codeText.c_str(), codeText.length());
-  ::send(fd, "\r\n", 2);
-  ::send(fd, "Content-Type: ", 14);
-  ::send(fd, contentType.asCharPtr(), contentType.length());
-  ::send(fd, "; charset=ISO-8859-5\r\n", 22);
-  if (this->currentHeaders.length() > 0) ::send(fd, this->currentHeaders.c_str(), this->currentHeaders.length());
-  if (this->currentContentLength) {
-    const auto contentLength = std::to_string(*this->currentContentLength);
-    ::send(fd, "Content-Length: ", 16);
-    ::send(fd, contentLength.c_str(), contentLength.length());
-    ::send(fd, "\r\n", 2);
-  }
-  ::send(fd, "\r\n", 2);
-  if (content.length() > 0) ::send(fd, content.asCharPtr(), content.length());
+  // Responses to HEAD requests have no body
+  std::array<iovec, 2> iov = {{
+    { head.data(), head.length() },
+    { const_cast<char*>(content.asCharPtr()), this->currentMethod == "HEAD" ? 0 : content.length() },
+  }};
+  ::send(*this, iov.data(), iov.size());
 
   if (logger().isTracing()) iop::Log::print(IOP_STR(""), iop::LogLevel::TRACE, iop::LogType::END);
 }
@@ -406,10 +764,119 @@ void HttpConnection::sendData(iop::StaticString content) const noexcept {
   iop_assert(this->currentClient, IOP_STR("No active client"));
 
   if (logger().isTracing()) iop::Log::print(IOP_STR(""), iop::LogLevel::TRACE, iop::LogType::START);
-  ::send(*this->currentClient, content.asCharPtr(), content.length());
+  auto iov = iovec { const_cast<char*>(content.asCharPtr()), this->currentMethod == "HEAD" ? 0 : content.length() };
+  ::send(*this, &iov, 1);
   if (logger().isTracing()) iop::Log::print(IOP_STR(""), iop::LogLevel::TRACE, iop::LogType::END);
 }
 
+void HttpConnection::sendAsset(const StaticAsset &asset) noexcept {
+  IOP_TRACE();
+  iop_assert(this->currentClient, IOP_STR("No active client"));
+
+  // Browsers revalidate their copy every time, it's cheap as the asset only changes with the firmware
+  this->sendHeader(IOP_STR("ETag"), asset.etag);
+  this->sendHeader(IOP_STR("Cache-Control"), IOP_STR("no-cache"));
+  const auto ifNoneMatch = requestHeader(*this, "If-None-Match");
+  if (ifNoneMatch && etagMatches(*ifNoneMatch, std::string_view(asset.etag.asCharPtr(), asset.etag.length()))) {
+    // It has no body, but the length is the one the full response would have
+    this->currentContentLength = asset.length;
+    this->send(304, asset.contentType, IOP_STR(""));
+    return;
+  }
+
+  // Every browser accepts gzip, so `Accept-Encoding` isn't checked
+  this->sendHeader(IOP_STR("Content-Encoding"), IOP_STR("gzip"));
+  auto head = responseHead(*this, 200, asset.contentType, asset.length);
+  this->responded = true;
+  std::array<iovec, 2> iov = {{
+    { head.data(), head.length() },
+    { const_cast<uint8_t*>(asset.data), this->currentMethod == "HEAD" ? 0 : asset.length },
+  }};
+  ::send(*this, iov.data(), iov.size());
+}
+
+void HttpConnection::beginResponse(const uint16_t code, const iop::StaticString contentType) noexcept {
+  IOP_TRACE();
+  iop_assert(this->currentClient, IOP_STR("No active client"));
+  iop_assert(!this->streaming, IOP_STR("Response already started"));
+
+  const auto head = this->currentMethod == "HEAD";
+  // HTTP/1.0 clients don't understand chunks, the end of the body is signaled by closing the connection
+  this->chunked = !this->currentContentLength && !head && this->currentVersion > 0;
+  if (!this->currentContentLength && !head && !this->chunked) this->keepAlive = false;
+
+  // The head waits in the buffer, to be sent with the first chunk
+  this->currentStream = responseHead(*this, code, contentType, this->currentContentLength);
+  this->streamHead = this->currentStream.length();
+  this->streaming = true;
+  this->responded = true;
+}
+auto HttpConnection::write(const std::string_view data) noexcept -> bool {
+  IOP_TRACE();
+  iop_assert(this->streaming, IOP_STR("Response not started"));
+  if (this->broken) return false;
+  if (this->currentMethod == "HEAD") return true;
+
+  if (this->currentStream.length() - this->streamHead + data.length() <= streamBufferSize) {
+    this->currentStream.append(data);
+    return writable(*this);
+  }
+  // Big writes aren't copied to the buffer, they are sent with it
+  return flushStream(*this, data, false);
+}
+auto HttpConnection::write(const iop::StaticString data) noexcept -> bool {
+  return this->write(std::string_view(data.asCharPtr(), data.length()));
+}
+void HttpConnection::endResponse() noexcept {
+  IOP_TRACE();
+  iop_assert(this->streaming, IOP_STR("Response not started"));
+  this->streaming = false;
+  if (this->broken) return;
+  flushStream(*this, "", true);
+}
+void HttpConnection::onWritable(Writer writer) noexcept {
+  IOP_TRACE();
+  iop_assert(this->streaming, IOP_STR("Response not started"));
+  this->currentWriter = std::move(writer);
+}
+auto HttpConnection::sendFile(const uint16_t code, const iop::StaticString contentType, const std::string &path) noexcept -> bool {
+  IOP_TRACE();
+  iop_assert(this->currentClient, IOP_STR("No active client"));
+
+  const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+    logger().error(IOP_STR("Unable to open file: "));
+    logger().errorln(path);
+    if (fd >= 0) ::close(fd);
+    return false;
+  }
+
+  const auto length = static_cast<size_t>(info.st_size);
+  auto head = responseHead(*this, code, contentType, this->currentContentLength.value_or(length));
+  this->responded = true;
+  auto iov = iovec { head.data(), head.length() };
+  ::send(*this, &iov, 1);
+
+  if (this->currentMethod == "HEAD" || length == 0) {
+    ::close(fd);
+    return true;
+  }
+  // The rest is sent by the server as the socket takes it
+  this->currentFile = fd;
+  this->fileOffset = 0;
+  this->fileLeft = length;
+  if (!sendFileBody(*this)) {
+    logger().warnln(IOP_STR("Unable to send file"));
+    this->broken = true;
+  }
+  if (this->fileLeft == 0 || this->broken) {
+    ::close(fd);
+    this->currentFile = -1;
+  }
+  return true;
+}
+
 // NOOP
 CaptivePortal::CaptivePortal(CaptivePortal &&other) noexcept { (void) other; }
 auto CaptivePortal::operator=(CaptivePortal &&other) noexcept -> CaptivePortal & { (void) other; return *this; }
@@ -0,0 +1,176 @@
+#if defined(IOP_LINUX_MOCK) || defined(IOP_LINUX)
+#include "posix/queue.hpp"
+#elif defined(IOP_ESP8266)
+#include "arduino/queue.hpp"
+#elif defined(IOP_ESP32)
+#include "arduino/queue.hpp"
+#elif defined(IOP_NOOP)
+#include "noop/queue.hpp"
+#else
+#error "Target not supported"
+#endif
+
+#include "iop-hal/log.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace iop_hal {
+static iop::Log queueLogger(IOP_STR("QUEUE"));
+
+// Region layout: magic, head, used and count, then the ring. Records are their path and data lengths, followed by both
+constexpr uint32_t queueMagic = 0x51504F49; // "IOPQ"
+constexpr size_t queueHeaderSize = 4 * sizeof(uint32_t);
+constexpr size_t recordHeaderSize = 2 * sizeof(uint16_t);
+
+PersistentQueue::PersistentQueue() noexcept:
+  address(0), capacity(0), head(0), used(0), count(0), dirty(0), lastCommit(0), ready(false) {}
+
+auto PersistentQueue::dataSize() const noexcept -> size_t {
+  return this->capacity - queueHeaderSize;
+}
+
+auto PersistentQueue::readRing(const uint32_t position, uint8_t *output, const size_t length) const noexcept -> void {
+  const auto first = std::min(length, this->dataSize() - position);
+  this->readBytes(queueHeaderSize + position, output, first);
+  if (first < length) this->readBytes(queueHeaderSize, output + first, length - first);
+}
+
+auto PersistentQueue::writeRing(const uint32_t position, const uint8_t *input, const size_t length) noexcept -> void {
+  const auto first = std::min(length, this->dataSize() - position);
+  this->writeBytes(queueHeaderSize + position, input, first);
+  if (first < length) this->writeBytes(queueHeaderSize, input + first, length - first);
+}
+
+auto PersistentQueue::writeHeader() noexcept -> void {
+  const uint32_t header[] = { queueMagic, this->head, this->used, this->count };
+  this->writeBytes(0, reinterpret_cast<const uint8_t *>(header), sizeof(header));
+}
+
+auto PersistentQueue::changed(const size_t bytes) noexcept -> void {
+  this->writeHeader();
+  this->dirty += bytes + queueHeaderSize;
+  this->commit();
+}
+
+auto PersistentQueue::setup(const uintmax_t address, const size_t size) noexcept -> bool {
+  IOP_TRACE();
+  if (size <= queueHeaderSize + recordHeaderSize) return false;
+  this->address = address;
+  this->capacity = size;
+  this->ready = this->load();
+  if (!this->ready) {
+    queueLogger.errorln(IOP_STR("Unable to load queue"));
+    return false;
+  }
+
+  uint32_t header[4];
+  this->readBytes(0, reinterpret_cast<uint8_t *>(header), sizeof(header));
+  this->head = header[1];
+  this->used = header[2];
+  this->count = header[3];
+  // A new queue is zeroed
+  const auto isNew = header[0] == 0 && this->head == 0 && this->used == 0 && this->count == 0;
+  if (isNew || header[0] != queueMagic || this->head >= this->dataSize() || this->used > this->dataSize() || this->count * recordHeaderSize > this->used) {
+    if (!isNew) queueLogger.warnln(IOP_STR("Queue is invalid, clearing it"));
+    this->head = 0;
+    this->used = 0;
+    this->count = 0;
+    this->writeHeader();
+    this->dirty = queueHeaderSize;
+    return this->flush();
+  }
+
+  queueLogger.info(IOP_STR("Queued records: "));
+  queueLogger.infoln(this->count);
+  this->lastCommit = iop_hal::thisThread.timeRunning();
+  return true;
+}
+
+auto PersistentQueue::push(const std::string_view path, const std::string_view data) noexcept -> bool {
+  IOP_TRACE();
+  const auto length = recordHeaderSize + path.length() + data.length();
+  if (!this->ready || path.length() > UINT16_MAX || data.length() > UINT16_MAX || length > this->dataSize()) return false;
+
+  // Newer records are more valuable, so the oldest make room
+  uint32_t dropped = 0;
+  while (this->dataSize() - this->used < length) {
+    this->pop(1);
+    dropped++;
+  }
+  if (dropped > 0) {
+    queueLogger.warn(IOP_STR("Queue is full, dropped records: "));
+    queueLogger.warnln(dropped);
+  }
+
+  const uint16_t lengths[] = { static_cast<uint16_t>(path.length()), static_cast<uint16_t>(data.length()) };
+  auto position = static_cast<uint32_t>((this->head + this->used) % this->dataSize());
+  this->writeRing(position, reinterpret_cast<const uint8_t *>(lengths), sizeof(lengths));
+  position = static_cast<uint32_t>((position + sizeof(lengths)) % this->dataSize());
+  this->writeRing(position, reinterpret_cast<const uint8_t *>(path.data()), path.length());
+  position = static_cast<uint32_t>((position + path.length()) % this->dataSize());
+  this->writeRing(position, reinterpret_cast<const uint8_t *>(data.data()), data.length());
+
+  this->used += static_cast<uint32_t>(length);
+  this->count++;
+  this->changed(length);
+  return true;
+}
+
+auto PersistentQueue::front(std::vector<QueuedRecord> &records, const size_t maxRecords, const size_t maxBytes) const noexcept -> void {
+  IOP_TRACE();
+  records.clear();
+  auto position = this->head;
+  size_t bytes = 0;
+  for (uint32_t index = 0; index < this->count && records.size() < maxRecords; ++index) {
+    uint16_t lengths[2];
+    this->readRing(position, reinterpret_cast<uint8_t *>(lengths), sizeof(lengths));
+    if (records.size() > 0 && bytes + lengths[1] > maxBytes) break;
+    bytes += lengths[1];
+
+    QueuedRecord record;
+    record.path.resize(lengths[0]);
+    record.data.resize(lengths[1]);
+    position = static_cast<uint32_t>((position + sizeof(lengths)) % this->dataSize());
+    this->readRing(position, reinterpret_cast<uint8_t *>(&record.path[0]), lengths[0]);
+    position = static_cast<uint32_t>((position + lengths[0]) % this->dataSize());
+    this->readRing(position, reinterpret_cast<uint8_t *>(&record.data[0]), lengths[1]);
+    position = static_cast<uint32_t>((position + lengths[1]) % this->dataSize());
+    records.push_back(std::move(record));
+  }
+}
+
+auto PersistentQueue::pop(size_t records) noexcept -> void {
+  IOP_TRACE();
+  size_t bytes = 0;
+  while (records-- > 0 && this->count > 0) {
+    uint16_t lengths[2];
+    this->readRing(this->head, reinterpret_cast<uint8_t *>(lengths), sizeof(lengths));
+    const auto length = recordHeaderSize + lengths[0] + lengths[1];
+    this->head = static_cast<uint32_t>((this->head + length) % this->dataSize());
+    this->used -= static_cast<uint32_t>(length);
+    this->count--;
+    bytes += length;
+  }
+  // Only the header changes, so it's cheap to commit
+  if (bytes > 0) this->changed(0);
+}
+
+auto PersistentQueue::commit() noexcept -> bool {
+  if (this->dirty == 0) return true;
+  const auto now = iop_hal::thisThread.timeRunning();
+  if (this->dirty < this->capacity / 4 && now - this->lastCommit < commitInterval) return true;
+  return this->flush();
+}
+
+auto PersistentQueue::flush() noexcept -> bool {
+  IOP_TRACE();
+  if (!this->ready || this->dirty == 0) return true;
+  this->lastCommit = iop_hal::thisThread.timeRunning();
+  this->dirty = 0;
+  if (!this->persist()) {
+    queueLogger.errorln(IOP_STR("Unable to persist queue"));
+    return false;
+  }
+  return true;
+}
+}
@@ -8,4 +8,10 @@
 #include "noop/server.hpp"
 #else
 echo "Target not supported"
-#endif
\ No newline at end of file
+#endif
+
+namespace iop_hal {
+auto HttpConnection::param(const std::string_view name) const noexcept -> std::optional<std::string_view> {
+  return this->currentParams.get(name);
+}
+}